@@ -0,0 +1,78 @@
+#ifndef HOST_ARDUINO_H_
+#define HOST_ARDUINO_H_
+//Host build shim: the subset of Arduino-ESP32 and FreeRTOS used by the stratum core.
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+class String : public std::string{
+public:
+    String(){}
+    String(const char *str):std::string(str ? str : ""){}
+    String(const std::string &str):std::string(str){}
+    String(char c):std::string(1, c){}
+    String(int val):std::string(std::to_string(val)){}
+    String(long val):std::string(std::to_string(val)){}
+    String(unsigned long val):std::string(std::to_string(val)){}
+    String(unsigned int val, unsigned char base = 10){
+        char buf[16];
+        snprintf(buf, sizeof(buf), (base == 16) ? "%x" : "%u", val);
+        this->assign(buf);
+    }
+    String(double val, unsigned int decimals = 2){
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, val);
+        this->assign(buf);
+    }
+    const char *c_str() const { return std::string::c_str(); }
+    unsigned int length() const { return this->size(); }
+    bool concat(const char *str, unsigned int len){ this->append(str, len); return true; }
+    bool concat(const String &str){ this->append(str); return true; }
+    String substring(unsigned int from, unsigned int to) const { return String(this->substr(from, to - from)); }
+    String substring(unsigned int from) const { return String(this->substr(from)); }
+    int indexOf(char c) const { size_t pos = this->find(c); return (pos == npos) ? -1 : (int)pos; }
+    bool startsWith(const char *prefix) const { return this->rfind(prefix, 0) == 0; }
+};
+
+inline String operator+(const String &lhs, const String &rhs){ String str(lhs); str.append(rhs); return str; }
+inline String operator+(const String &lhs, const char *rhs){ String str(lhs); str.append(rhs); return str; }
+inline String operator+(const char *lhs, const String &rhs){ String str(lhs); str.append(rhs); return str; }
+
+uint32_t millis();
+uint32_t micros();
+void     delay(uint32_t ms);
+
+//FreeRTOS
+typedef uint32_t TickType_t;
+typedef int      BaseType_t;
+typedef struct host_queue_t *QueueHandle_t;
+typedef QueueHandle_t SemaphoreHandle_t;
+typedef void *TaskHandle_t;
+#define pdTRUE              (1)
+#define pdFALSE             (0)
+#define portMAX_DELAY       (0xffffffff)
+#define pdMS_TO_TICKS(ms)   (ms)
+
+QueueHandle_t     xQueueCreate(uint32_t length, uint32_t item_size);
+BaseType_t        xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait);
+BaseType_t        xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait);
+BaseType_t        xQueueReset(QueueHandle_t queue);
+uint32_t          uxQueueMessagesWaiting(QueueHandle_t queue);
+void              vQueueDelete(QueueHandle_t queue);
+SemaphoreHandle_t xSemaphoreCreateCounting(uint32_t max, uint32_t initial);
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t        xSemaphoreGive(SemaphoreHandle_t sem);
+BaseType_t        xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait);
+void              vSemaphoreDelete(SemaphoreHandle_t sem);
+BaseType_t        xTaskCreate(void (*entry)(void*), const char *name, uint32_t stack, void *args, uint32_t priority, TaskHandle_t *handle);
+inline int        xPortGetCoreID(){ return 0; }
+
+class EspClass{
+public:
+    void restart(){ exit(1); }
+};
+extern EspClass ESP;
+
+#endif
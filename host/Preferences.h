@@ -0,0 +1,52 @@
+#ifndef HOST_PREFERENCES_H_
+#define HOST_PREFERENCES_H_
+#include <Arduino.h>
+#include <map>
+#include <mutex>
+#include <string>
+
+/**
+ * @brief Host stand-in for the ESP32 NVS preferences.
+ *
+ * Every namespace lives in one process wide map, so it outlives the
+ * objects that wrote it like NVS outlives a reboot. Only the byte blob
+ * calls the stratum core uses are provided.
+ */
+class Preferences{
+private:
+    std::string _ns;
+    bool        _open = false;
+    static std::map<std::string, std::string> &store(){
+        static std::map<std::string, std::string> s_store;
+        return s_store;
+    }
+    static std::mutex &lock(){
+        static std::mutex s_lock;
+        return s_lock;
+    }
+public:
+    bool   begin(const char *name, bool read_only = false){ this->_ns = name; this->_open = true; return true; }
+    void   end(){ this->_open = false; }
+    size_t putBytes(const char *key, const void *value, size_t len){
+        if(!this->_open) return 0;
+        std::lock_guard<std::mutex> guard(lock());
+        store()[this->_ns + "/" + key].assign((const char*)value, len);
+        return len;
+    }
+    size_t getBytes(const char *key, void *buf, size_t max_len){
+        if(!this->_open) return 0;
+        std::lock_guard<std::mutex> guard(lock());
+        auto it = store().find(this->_ns + "/" + key);
+        if(it == store().end()) return 0;
+        if(it->second.size() > max_len) return 0;//like NVS, a blob never comes back cut
+        memcpy(buf, it->second.data(), it->second.size());
+        return it->second.size();
+    }
+    bool   remove(const char *key){
+        if(!this->_open) return false;
+        std::lock_guard<std::mutex> guard(lock());
+        return store().erase(this->_ns + "/" + key) > 0;
+    }
+};
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef HOST_WIFI_H_
+#define HOST_WIFI_H_
+#include <Arduino.h>
+
+#define WL_CONNECTED    (3)
+
+typedef int WiFiEvent_t;
+typedef void (*WiFiEventCb)(WiFiEvent_t event);
+
+//the host link never changes state, callbacks are accepted and never called
+class WiFiClass{
+public:
+    int onEvent(WiFiEventCb cb){ return 0; }
+};
+
+extern WiFiClass WiFi;
+
+#endif
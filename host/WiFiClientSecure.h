@@ -0,0 +1,4 @@
+#ifndef HOST_WIFI_CLIENT_SECURE_H_
+#define HOST_WIFI_CLIENT_SECURE_H_
+#include <Arduino.h>
+#endif
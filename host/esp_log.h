@@ -0,0 +1,4 @@
+#ifndef HOST_ESP_LOG_H_
+#define HOST_ESP_LOG_H_
+#include "logger.h"
+#endif
@@ -0,0 +1,37 @@
+#ifndef HOST_GLOBAL_H_
+#define HOST_GLOBAL_H_
+//Host build: only the parts of the firmware globals the stratum core touches.
+#include <Arduino.h>
+#include "stratum.h"
+
+#define CURRENT_FW_VERSION          "host"
+#define POOL_INACTIVITY_TIME_MS     (1000*60*5)
+
+typedef struct {
+    struct {
+        String hw_model;
+    } board;
+    struct {
+        struct {
+            struct {
+                int status;
+            } status_param;
+            SemaphoreHandle_t reconnect_xsem;
+        } wifi;
+        pool_info_t     pool_use, pool_primary, pool_fallback;
+        stratum_info_t  stratum_use, stratum_primary, stratum_fallback;
+        uint32_t        stratum_update;
+    } connection;
+    struct {
+        uint32_t share_accepted;
+        uint32_t share_rejected;
+        struct {
+            double last;
+        } diff;
+    } mstatus;
+    StratumClass *stratum;
+} nmaxe_t;
+
+extern nmaxe_t g_nmaxe;
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef HOST_HELPER_H_
+#define HOST_HELPER_H_
+#include <Arduino.h>
+
+inline String formatNumber(double num, int precision){
+    return String(num, precision);
+}
+
+#endif
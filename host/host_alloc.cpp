@@ -0,0 +1,87 @@
+#include "host_alloc.h"
+#include <atomic>
+#include <malloc.h>
+#include <stddef.h>
+
+//The executable interposes the allocator entry points and forwards them to
+//glibc, so every heap call of the stratum core and the C++ runtime is counted.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void  __libc_free(void *ptr);
+}
+
+static std::atomic<bool>     s_track(false);
+static std::atomic<uint64_t> s_allocs(0);
+static std::atomic<uint64_t> s_frees(0);
+static std::atomic<int64_t>  s_bytes(0);
+static std::atomic<int64_t>  s_peak(0);
+
+static void on_alloc(void *ptr){
+    if(ptr == NULL) return;
+    int64_t bytes = s_bytes.fetch_add(malloc_usable_size(ptr)) + malloc_usable_size(ptr);
+    int64_t peak  = s_peak.load();
+    while(bytes > peak && !s_peak.compare_exchange_weak(peak, bytes));
+    if(s_track.load(std::memory_order_relaxed)) s_allocs++;
+}
+
+static void on_free(void *ptr){
+    if(ptr == NULL) return;
+    s_bytes.fetch_sub(malloc_usable_size(ptr));
+    if(s_track.load(std::memory_order_relaxed)) s_frees++;
+}
+
+extern "C" {
+void *malloc(size_t size){
+    void *ptr = __libc_malloc(size);
+    on_alloc(ptr);
+    return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size){
+    void *ptr = __libc_calloc(nmemb, size);
+    on_alloc(ptr);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size){
+    on_free(ptr);
+    void *out = __libc_realloc(ptr, size);
+    on_alloc(out ? out : ptr);
+    return out;
+}
+
+void *memalign(size_t alignment, size_t size){
+    void *ptr = __libc_memalign(alignment, size);
+    on_alloc(ptr);
+    return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size){
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size){
+    *out = memalign(alignment, size);
+    return (*out == NULL) ? 12 : 0;
+}
+
+void free(void *ptr){
+    on_free(ptr);
+    __libc_free(ptr);
+}
+}
+
+void host_alloc_track(bool enable){
+    s_track.store(enable);
+}
+
+host_alloc_stats_t host_alloc_stats(){
+    return {s_allocs.load(), s_frees.load(), s_bytes.load(), s_peak.load()};
+}
+
+void host_alloc_reset_peak(){
+    s_peak.store(s_bytes.load());
+}
@@ -0,0 +1,17 @@
+#ifndef HOST_ALLOC_H_
+#define HOST_ALLOC_H_
+#include <stdint.h>
+
+//heap accounting of the host build, glibc only
+typedef struct {
+    uint64_t    allocs;
+    uint64_t    frees;
+    int64_t     bytes;
+    int64_t     peak;
+} host_alloc_stats_t;
+
+void               host_alloc_track(bool enable);
+host_alloc_stats_t host_alloc_stats();
+void               host_alloc_reset_peak();
+
+#endif
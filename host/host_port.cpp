@@ -0,0 +1,151 @@
+#include <Arduino.h>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "global.h"
+#include "pool.h"
+
+nmaxe_t   g_nmaxe;
+EspClass  ESP;
+WiFiClass WiFi;
+
+static const auto s_boot = std::chrono::steady_clock::now();
+
+uint32_t millis(){
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - s_boot).count();
+}
+
+uint32_t micros(){
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - s_boot).count();
+}
+
+void delay(uint32_t ms){
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+//tasks run as detached threads, stack size and priority are the host scheduler's business
+BaseType_t xTaskCreate(void (*entry)(void*), const char *name, uint32_t stack, void *args, uint32_t priority, TaskHandle_t *handle){
+    std::thread(entry, args).detach();
+    if(handle != NULL) *handle = NULL;
+    return pdTRUE;
+}
+
+//queues and semaphores share one implementation, a semaphore is a queue of empty items
+struct host_queue_t {
+    std::mutex                          lock;
+    std::condition_variable             cond;
+    std::deque<std::vector<uint8_t>>    items;
+    uint32_t                            length;
+    uint32_t                            item_size;
+};
+
+QueueHandle_t xQueueCreate(uint32_t length, uint32_t item_size){
+    host_queue_t *queue = new host_queue_t();
+    queue->length    = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait){
+    std::unique_lock<std::mutex> lock(queue->lock);
+    if(queue->items.size() >= queue->length) return pdFALSE;
+    const uint8_t *bytes = (const uint8_t*)item;
+    queue->items.emplace_back(bytes, bytes + queue->item_size);
+    queue->cond.notify_one();
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait){
+    std::unique_lock<std::mutex> lock(queue->lock);
+    if(!queue->cond.wait_for(lock, std::chrono::milliseconds(wait), [queue]{ return !queue->items.empty(); })) return pdFALSE;
+    if(queue->item_size > 0) memcpy(item, queue->items.front().data(), queue->item_size);
+    queue->items.pop_front();
+    return pdTRUE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue){
+    std::unique_lock<std::mutex> lock(queue->lock);
+    queue->items.clear();
+    return pdTRUE;
+}
+
+uint32_t uxQueueMessagesWaiting(QueueHandle_t queue){
+    std::unique_lock<std::mutex> lock(queue->lock);
+    return queue->items.size();
+}
+
+void vQueueDelete(QueueHandle_t queue){
+    delete queue;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(uint32_t max, uint32_t initial){
+    SemaphoreHandle_t sem = xQueueCreate(max, 0);
+    for(uint32_t i = 0; i < initial; i++) xQueueSend(sem, NULL, 0);
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(){
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem){
+    return xQueueSend(sem, NULL, 0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait){
+    return xQueueReceive(sem, NULL, wait);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem){
+    vQueueDelete(sem);
+}
+
+//one byte in the socketpair while there is something to read
+void PoolClass::_readable(bool on){
+    char byte = 0;
+    if(this->_signal[0] < 0) return;
+    if(on && !this->available()) return;
+    if(on) ::send(this->_signal[1], &byte, 1, MSG_DONTWAIT);
+    else   while(::recv(this->_signal[0], &byte, 1, MSG_DONTWAIT) > 0);
+}
+
+String PoolClass::readline(uint32_t timeout_ms){
+    if(this->_rx.empty()) return "";
+    String line;
+    line.swap(this->_rx.front());
+    this->_rx.pop_front();
+    if(!this->available()) this->_readable(false);
+    this->bytes_in += line.length() + 1;
+    this->_last_read_ms = millis();
+    return line;
+}
+
+size_t PoolClass::write(String data){
+    if(!this->_connected) return 0;
+    this->_tx.append(data);
+    this->bytes_out += data.length();
+    this->_last_write_ms = millis();
+    return data.length();
+}
+
+int PoolClass::read(uint8_t *data, size_t len){
+    size_t n = std::min(len, this->_rx_raw.size());
+    memcpy(data, this->_rx_raw.data(), n);
+    this->_rx_raw.erase(0, n);
+    if(!this->available()) this->_readable(false);
+    this->bytes_in += n;
+    if(n > 0) this->_last_read_ms = millis();
+    return n;
+}
+
+size_t PoolClass::write(const uint8_t *data, size_t len){
+    if(!this->_connected) return 0;
+    this->_tx.append((const char*)data, len);
+    this->bytes_out += len;
+    this->_last_write_ms = millis();
+    return len;
+}
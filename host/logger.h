@@ -0,0 +1,20 @@
+#ifndef HOST_LOGGER_H_
+#define HOST_LOGGER_H_
+#include <cstdio>
+
+//silent by default so benchmarks measure the stratum path, not stdout
+#ifdef STRATUM_HOST_VERBOSE
+#define LOG_D(fmt, ...)  printf("[D] " fmt "\n", ##__VA_ARGS__)
+#define LOG_I(fmt, ...)  printf("[I] " fmt "\n", ##__VA_ARGS__)
+#define LOG_L(fmt, ...)  printf("[L] " fmt "\n", ##__VA_ARGS__)
+#define LOG_W(fmt, ...)  printf("[W] " fmt "\n", ##__VA_ARGS__)
+#else
+#define LOG_D(fmt, ...)  do{}while(0)
+#define LOG_I(fmt, ...)  do{}while(0)
+#define LOG_L(fmt, ...)  do{}while(0)
+#define LOG_W(fmt, ...)  do{}while(0)
+#endif
+#define LOG_E(fmt, ...)  fprintf(stderr, "[E] " fmt "\n", ##__VA_ARGS__)
+#define log_i            LOG_I
+
+#endif
@@ -0,0 +1,3 @@
+#ifndef HOST_MONITOR_H_
+#define HOST_MONITOR_H_
+#endif
@@ -0,0 +1,65 @@
+#ifndef HOST_POOL_H_
+#define HOST_POOL_H_
+#include <Arduino.h>
+#include <deque>
+#include <unistd.h>
+#include <sys/socket.h>
+
+typedef struct {
+    String      url;
+    uint16_t    port;
+    bool        ssl;
+} pool_info_t;
+
+/**
+ * @brief Host stand-in for the pool connection.
+ *
+ * Lines queued with inject() are returned by readline() in order, injected
+ * bytes by read(). Everything written is counted and kept in tx until
+ * take_tx() is called. fd() is one end of a socketpair that stays readable
+ * while anything injected is left, so select() sees the pool like a socket.
+ */
+class PoolClass{
+private:
+    pool_info_t         _info;
+    std::deque<String>  _rx;
+    std::string         _rx_raw;
+    String              _tx;
+    bool                _connected;
+    uint32_t            _last_read_ms;
+    uint32_t            _last_write_ms;
+    int                 _signal[2];
+    void                _readable(bool on);
+public:
+    uint64_t            bytes_in;
+    uint64_t            bytes_out;
+
+    PoolClass(pool_info_t info):_info(info), _connected(false), _last_read_ms(0), _last_write_ms(0), bytes_in(0), bytes_out(0){
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, this->_signal) != 0) this->_signal[0] = this->_signal[1] = -1;
+    };
+    ~PoolClass(){
+        if(this->_signal[0] >= 0) ::close(this->_signal[0]);
+        if(this->_signal[1] >= 0) ::close(this->_signal[1]);
+    }
+    PoolClass(const PoolClass&) = delete;
+    PoolClass &operator=(const PoolClass&) = delete;
+
+    bool     begin(bool ssl){ return true; }
+    bool     connect(){ this->_connected = true; this->_last_read_ms = this->_last_write_ms = millis(); return true; }
+    void     end(){ this->_connected = false; }
+    bool     is_connected(){ return this->_connected; }
+    bool     available(){ return !this->_rx.empty() || !this->_rx_raw.empty(); }
+    String   readline(uint32_t timeout_ms = 0);
+    size_t   write(String data);
+    int      read(uint8_t *data, size_t len);
+    size_t   write(const uint8_t *data, size_t len);
+    uint32_t get_last_read_ms(){ return this->_last_read_ms; }
+    uint32_t get_last_write_ms(){ return this->_last_write_ms; }
+    int      fd(){ return this->_signal[0]; }
+
+    void     inject(const String &line){ this->_rx.push_back(line); this->_readable(true); }
+    void     inject(const uint8_t *data, size_t len){ this->_rx_raw.append((const char*)data, len); this->_readable(true); }
+    String   take_tx(){ String tx; tx.swap(this->_tx); return tx; }
+};
+
+#endif
@@ -0,0 +1,463 @@
+/**
+ * @brief Host replay benchmark of the stratum receive path.
+ *
+ * Every pool line goes through listen_methods() and stratum_handle_method()
+ * exactly as on the device. Lines come from a capture file or from a
+ * built-in synthetic session. A capture is either text, one pool line per
+ * line as received, or a binary capture taken on a unit, whose pool lines
+ * are replayed as fast as possible or with --realtime at their original
+ * pace. --record writes the replayed traffic as a binary capture. Response lines are
+ * preceded by an untimed submit and take over its id, so they resolve like
+ * on a live pool whatever ids the captured session used.
+ * Jobs are popped and booked as dispatched right away, so the job path
+ * trace covers the whole receive side.
+ *
+ * Before that the local share check runs on the genesis block, and stays
+ * on for the synthetic session, whose difficulty every placeholder share meets.
+ *
+ * --proxy N instead runs N simulated miners through the aggregation proxy
+ * against the same pool stand-in and checks the extranonce split and the
+ * routing of the pool answers.
+ *
+ * usage: stratum_bench [capture] [--rounds N] [--repeat N] [--proxy N]
+ *                      [--realtime] [--record path] [--max-p99-us X] [--max-allocs-per-msg X] [--max-peak-kb X]
+ * The exit code is non-zero when a threshold is exceeded or a share or proxy check fails.
+ */
+#include <Arduino.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <vector>
+#include "global.h"
+#include "host_alloc.h"
+#include "stratum.h"
+#include "stratum_metrics.h"
+#include "stratum_arena.h"
+#include "stratum_proxy.h"
+#include "stratum_capture.h"
+#include "stratum_work.h"
+#include <thread>
+
+typedef enum {
+    BENCH_NOTIFY,
+    BENCH_DIFFICULTY,
+    BENCH_RESPONSE,
+    BENCH_OTHER,
+    BENCH_KIND_MAX
+} bench_kind_t;
+
+static const char *kind_name[BENCH_KIND_MAX] = {"notify", "difficulty", "response", "other"};
+
+typedef struct {
+    std::vector<uint32_t>   ns;
+    uint64_t                allocs;
+} bench_series_t;
+
+static uint32_t s_accepted = 0, s_rejected = 0;
+
+static void on_share_result(const stratum_submit_result_t *result, void *arg){
+    if(result->accepted) s_accepted++;
+    else                 s_rejected++;
+}
+
+static bench_kind_t classify(const String &line){
+    if(line.find("\"mining.notify\"") != String::npos)         return BENCH_NOTIFY;
+    if(line.find("\"mining.set_difficulty\"") != String::npos) return BENCH_DIFFICULTY;
+    if(line.find("\"method\"") == String::npos)                return BENCH_RESPONSE;
+    return BENCH_OTHER;
+}
+
+static String hex_fill(size_t bytes, uint32_t seed){
+    String out;
+    char   buf[9];
+    while(out.length() < 2 * bytes){
+        seed = seed * 1103515245 + 12345;
+        snprintf(buf, sizeof(buf), "%08x", seed);
+        out.append(buf);
+    }
+    return out.substr(0, 2 * bytes);
+}
+
+//mainnet shaped traffic: 12 branch merkle path, ~60 byte coinb1, ~150 byte coinb2
+static std::vector<String> synthetic_session(uint32_t rounds){
+    std::vector<String> lines;
+    char     buf[2048];
+    uint32_t id = 1;
+    for(uint32_t r = 0; r < rounds; r++){
+        String branch;
+        for(int i = 0; i < 12; i++){
+            if(i) branch.append(",");
+            branch.append("\"" + hex_fill(32, r * 31 + i) + "\"");
+        }
+        snprintf(buf, sizeof(buf),
+            "{\"id\":null,\"method\":\"mining.notify\",\"params\":[\"%x\",\"%s\",\"%s\",\"%s\",[%s],\"20000000\",\"17034219\",\"%08x\",%s]}",
+            r, hex_fill(32, r).c_str(), hex_fill(59, r + 1).c_str(), hex_fill(150, r + 2).c_str(), branch.c_str(),
+            0x66000000 + r, (r % 10 == 0) ? "true" : "false");
+        lines.push_back(buf);
+        if(r % 8 == 0){
+            //low enough that any header meets the target, the placeholder shares pass the share check
+            snprintf(buf, sizeof(buf), "{\"id\":null,\"method\":\"mining.set_difficulty\",\"params\":[%g]}", ldexp(1.0, -33 - (int)(r % 4)));
+            lines.push_back(buf);
+        }
+        for(int s = 0; s < 4; s++, id++){
+            if(s == 3) snprintf(buf, sizeof(buf), "{\"id\":%u,\"result\":null,\"error\":[23,\"Low difficulty share\",null]}", id);
+            else       snprintf(buf, sizeof(buf), "{\"id\":%u,\"result\":true,\"error\":null}", id);
+            lines.push_back(buf);
+        }
+    }
+    return lines;
+}
+
+//pool lines of a binary capture with their receive time, the rest is not replayed
+static bool load_binary_capture(const char *path, std::vector<String> &lines, std::vector<uint32_t> &stamps){
+    StratumCaptureReader     reader;
+    stratum_capture_record_t record;
+    size_t                   skipped = 0;
+    if(!reader.open(path)) return false;
+    while(reader.next(&record)){
+        if(record.kind != STRATUM_CAPTURE_RX_LINE){
+            skipped++;
+            continue;
+        }
+        lines.push_back(String(std::string((const char*)record.data, record.len)));
+        stamps.push_back(record.ms);
+    }
+    printf("capture     : %zu pool lines, %zu other records skipped\n", lines.size(), skipped);
+    return true;
+}
+
+//the response line answering the request in tx, the id swapped for the request's
+static String with_id(const String &line, const String &tx){
+    uint32_t id;
+    size_t   end = 6;
+    if(line.compare(0, 6, "{\"id\":") != 0 || sscanf(tx.c_str(), "{\"id\":%u", &id) != 1) return line;
+    while(end < line.length() && isdigit((unsigned char)line[end])) end++;
+    String out("{\"id\":");
+    out.concat(String(id));
+    out.concat(line.substring(end));
+    return out;
+}
+
+static bool load_capture(const char *path, std::vector<String> &lines){
+    std::ifstream in(path);
+    if(!in) return false;
+    std::string line;
+    while(std::getline(in, line)){
+        if(!line.empty() && line.back() == '\r') line.pop_back();
+        if(!line.empty()) lines.push_back(line);
+    }
+    return true;
+}
+
+static uint32_t percentile(std::vector<uint32_t> &ns, double p){
+    if(ns.empty()) return 0;
+    size_t idx = std::min(ns.size() - 1, (size_t)(p * ns.size()));
+    std::nth_element(ns.begin(), ns.begin() + idx, ns.end());
+    return ns[idx];
+}
+
+static size_t proxy_capture(uint8_t client, const char *data, size_t len, void *arg){
+    String *rx = (String*)arg;
+    rx[client].append(data, len);
+    return len;
+}
+
+static void pool_feed(StratumClass &stratum, const char *line){
+    stratum.pool->inject(line);
+    stratum_method_data method = stratum.listen_methods();
+    stratum_handle_method(&stratum, &method);
+}
+
+#define GENESIS_CHECK(cond, ...) do{ if(!(cond)){ fprintf(stderr, "FAIL share check: " __VA_ARGS__); fprintf(stderr, "\n"); rc = 1; } }while(0)
+
+/**
+ * @brief Runs the local share check on the genesis block.
+ *
+ * The genesis coinbase is split around its scriptSig into coinb1 |
+ * extranonce1 | extranonce2 | coinb2, as a pool would hand it out. Its nonce
+ * has to pass at difficulty 1 and the next nonce must not.
+ */
+static int genesis_check(){
+    static const char *coinb1 = "01000000010000000000000000000000000000000000000000000000000000000000000000ffffffff4d04";
+    static const char *coinb2 = "68652054696d65732030332f4a616e2f32303039204368616e63656c6c6f72206f6e206272696e6b206f66207365636f6e64206261696c6f"
+                                "757420666f722062616e6b73ffffffff0100f2052a01000000434104678afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0"
+                                "ea1f61deb649f6bc3f4cef38c4f35504e51ec112de5c384df7ba0b8d578a4c702b6bf11d5fac00000000";
+    static const char *prevhash = "0000000000000000000000000000000000000000000000000000000000000000";
+    int rc = 0;
+    stratum_notify_t notify = {};
+    notify.job_id     = {"genesis", 7};
+    notify.prevhash   = {prevhash, strlen(prevhash)};
+    notify.coinb1     = {coinb1, strlen(coinb1)};
+    notify.coinb2     = {coinb2, strlen(coinb2)};
+    notify.version    = {"00000001", 8};
+    notify.nbits      = {"1d00ffff", 8};
+    notify.ntime      = {"495fab29", 8};
+    notify.clean_jobs = true;
+    pool_job_data_t *job = stratum_job_create(&notify);
+    GENESIS_CHECK(job != NULL, "genesis notify not decoded");
+    if(job == NULL) return rc;
+
+    StratumShareValidator validator;
+    stratum_share_t       share = {};
+    validator.add_job(job, 1.0);
+    strcpy(share.job_id, "genesis");
+    strcpy(share.extranonce2, "01044554");
+    share.ntime   = 0x495fab29;
+    share.nonce   = 2083236893;
+    share.version = 1;
+    stratum_share_verdict_t verdict = validator.check(&share, "ffff001d", 4, 0xffffffff, 1.0);
+    GENESIS_CHECK(verdict == STRATUM_SHARE_VALID, "genesis nonce judged %d", verdict);
+    share.nonce++;
+    verdict = validator.check(&share, "ffff001d", 4, 0xffffffff, 1.0);
+    GENESIS_CHECK(verdict == STRATUM_SHARE_LOW_DIFFICULTY, "genesis nonce + 1 judged %d", verdict);
+    stratum_job_free(job);
+    if(rc == 0) printf("share check : genesis block valid, nonce + 1 low difficulty\n");
+    return rc;
+}
+
+#define PROXY_CHECK(cond, ...) do{ if(!(cond)){ fprintf(stderr, "FAIL proxy: " __VA_ARGS__); fprintf(stderr, "\n"); rc = 1; } }while(0)
+
+//miners 0..n-1 subscribe, get the job and submit one share each, miner 0 reconnects before its answer
+static int proxy_session(StratumClass &stratum, uint32_t clients){
+    String rx[STRATUM_PROXY_CLIENTS_MAX];
+    char   line[512];
+    int    rc = 0;
+    clients = std::min(clients, (uint32_t)STRATUM_PROXY_CLIENTS_MAX);
+    stratum.set_subscribe(true);
+    StratumProxy proxy(&stratum, proxy_capture, rx);
+    g_stratum_proxy = &proxy;//pool lines reach the clients through on_upstream
+    pool_feed(stratum, synthetic_session(1)[1].c_str());//a difficulty every placeholder share meets
+
+    for(uint32_t c = 0; c < clients; c++){
+        PROXY_CHECK(proxy.open() == (int)c, "client %u got another slot", c);
+        snprintf(line, sizeof(line), "{\"id\":1,\"method\":\"mining.subscribe\",\"params\":[\"bench/1.0\"]}");
+        proxy.on_line(c, line, strlen(line));
+        snprintf(line, sizeof(line), "{\"id\":2,\"method\":\"mining.authorize\",\"params\":[\"w%u\",\"x\"]}", c);
+        proxy.on_line(c, line, strlen(line));
+        snprintf(line, sizeof(line), "\"f0000001%02x\",3]", c);
+        PROXY_CHECK(rx[c].find(line) != String::npos, "client %u subscribe answer %s", c, rx[c].c_str());
+    }
+    pool_feed(stratum, synthetic_session(1)[0].c_str());
+    for(uint32_t c = 0; c < clients; c++){
+        PROXY_CHECK(rx[c].find("\"method\":\"mining.notify\"") != String::npos, "client %u got no job", c);
+        rx[c].clear();
+        snprintf(line, sizeof(line), "{\"id\":%u,\"method\":\"mining.submit\",\"params\":[\"w%u\",\"0\",\"abcdef\",\"66000000\",\"%08x\",\"00002000\"]}",
+                 100 + c, c, c);
+        proxy.on_line(c, line, strlen(line));
+    }
+    stratum.flush_submits();
+    stratum.submit("0", "00000000", 0x66000000, 0xffffffff, 0x20000000);//this unit's own share
+    stratum.flush_submits();
+    String tx = stratum.pool->take_tx();
+    proxy.close(0);
+    PROXY_CHECK(proxy.open() == 0, "slot 0 not reused");
+
+    uint32_t accepted = s_accepted;
+    size_t   pos = 0, shares = 0;
+    while(pos < tx.length()){
+        size_t end = tx.find('\n', pos);
+        if(end == String::npos) end = tx.length();
+        String   req = tx.substr(pos, end - pos);
+        uint32_t id  = 0;
+        pos = end + 1;
+        if(sscanf(req.c_str(), "{\"id\":%u", &id) != 1) continue;
+        if(shares < clients){
+            snprintf(line, sizeof(line), "\"%02xabcdef\"", (unsigned)shares);
+            PROXY_CHECK(req.find(line) != String::npos, "share %zu lacks its prefix: %s", shares, req.c_str());
+        }
+        if(shares % 2) snprintf(line, sizeof(line), "{\"id\":%u,\"result\":null,\"error\":[23,\"Low difficulty share\",null]}", id);
+        else           snprintf(line, sizeof(line), "{\"id\":%u,\"result\":true,\"error\":null}", id);
+        pool_feed(stratum, line);
+        shares++;
+    }
+    PROXY_CHECK(shares == clients + 1, "%zu shares upstream, %u expected", shares, clients + 1);
+    PROXY_CHECK(rx[0].empty(), "answer reached the reconnected client 0: %s", rx[0].c_str());
+    for(uint32_t c = 1; c < clients; c++){
+        snprintf(line, sizeof(line), (c % 2) ? "{\"id\":%u,\"result\":null,\"error\":[23," : "{\"id\":%u,\"result\":true", 100 + c);
+        PROXY_CHECK(rx[c].find(line) == 0, "client %u got %s", c, rx[c].c_str());
+    }
+    PROXY_CHECK(s_accepted + s_rejected > accepted, "own share answer not chained");
+
+    //a new upstream extranonce1 goes to clients that asked for it, the others are told to reconnect, client 0 is a fresh connection
+    if(clients > 1){
+        snprintf(line, sizeof(line), "{\"id\":3,\"method\":\"mining.extranonce.subscribe\",\"params\":[]}");
+        proxy.on_line(clients - 1, line, strlen(line));
+        for(uint32_t c = 0; c < clients; c++) rx[c].clear();
+        pool_feed(stratum, "{\"id\":null,\"method\":\"mining.set_extranonce\",\"params\":[\"e0000002\",4]}");
+        snprintf(line, sizeof(line), "\"params\":[\"e0000002%02x\",3]", clients - 1);
+        PROXY_CHECK(rx[clients - 1].find(line) != String::npos, "client %u got %s", clients - 1, rx[clients - 1].c_str());
+        for(uint32_t c = 1; c + 1 < clients; c++){
+            PROXY_CHECK(rx[c].find("\"client.reconnect\"") != String::npos, "client %u got %s", c, rx[c].c_str());
+        }
+    }
+    g_stratum_proxy = NULL;
+    printf("proxy       : %u clients, %u shares forwarded, %u answers routed\n", clients, proxy.get_forwarded(), proxy.get_answered());
+    return rc;
+}
+
+int main(int argc, char **argv){
+    const char *capture        = NULL;
+    uint32_t    rounds         = 2000;
+    uint32_t    repeat         = 1;
+    double      max_p99_us     = 0;
+    double      max_allocs     = -1;
+    double      max_peak_kb    = 0;
+    uint32_t    proxy_clients  = 0;
+    bool        realtime       = false;
+    const char *record         = NULL;
+
+    for(int i = 1; i < argc; i++){
+        String arg = argv[i];
+        bool   has = (i + 1 < argc);
+        if(arg == "--rounds" && has)                  rounds      = strtoul(argv[++i], NULL, 10);
+        else if(arg == "--repeat" && has)             repeat      = strtoul(argv[++i], NULL, 10);
+        else if(arg == "--max-p99-us" && has)         max_p99_us  = strtod(argv[++i], NULL);
+        else if(arg == "--max-allocs-per-msg" && has) max_allocs  = strtod(argv[++i], NULL);
+        else if(arg == "--max-peak-kb" && has)        max_peak_kb = strtod(argv[++i], NULL);
+        else if(arg == "--proxy" && has)              proxy_clients = strtoul(argv[++i], NULL, 10);
+        else if(arg == "--record" && has)             record      = argv[++i];
+        else if(arg == "--realtime")                  realtime    = true;
+        else if(arg[0] != '-')                        capture     = argv[i];
+        else{
+            fprintf(stderr, "usage: %s [capture] [--rounds N] [--repeat N] [--proxy N] [--realtime] [--record path] [--max-p99-us X] [--max-allocs-per-msg X] [--max-peak-kb X]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<String>   lines;
+    std::vector<uint32_t> stamps;   //receive ms per line, binary captures only
+    if(capture != NULL){
+        if(!load_binary_capture(capture, lines, stamps) && !load_capture(capture, lines)){
+            fprintf(stderr, "cannot read %s\n", capture);
+            return 2;
+        }
+    }else{
+        lines = synthetic_session(rounds);
+    }
+
+    g_nmaxe.connection.pool_use = {"bench.pool", 3333, false};
+    StratumClass stratum(g_nmaxe.connection.pool_use, {"bench.worker", "x"}, 3);
+    g_nmaxe.stratum = &stratum;
+    stratum.pool->connect();
+    stratum.set_sub_extranonce1("f0000001");
+    stratum.set_sub_extranonce2_size(4);
+    stratum.set_submit_callback(on_share_result, NULL);
+    //placeholder shares can not meet the target of a captured pool, the synthetic one takes any
+    stratum.set_share_check(capture == NULL);
+    if(genesis_check() != 0) return 1;
+    if(proxy_clients > 0) return proxy_session(stratum, proxy_clients);
+
+    bench_series_t series[BENCH_KIND_MAX] = {};
+    String         last_job = "0";          //the placeholder shares go to the newest job
+    uint64_t       total_ns = 0, total_msgs = 0;
+    stratum_trace_clear();
+    stratum_metrics_clear();
+    host_alloc_reset_peak();
+    int64_t        base_bytes = host_alloc_stats().bytes;
+    if(record != NULL && !stratum_capture_begin(record, STRATUM_CAPTURE_MAX_BYTES)){
+        fprintf(stderr, "cannot record to %s\n", record);
+        return 2;
+    }
+
+    for(uint32_t rep = 0; rep < repeat; rep++){
+        auto start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < lines.size(); i++){
+            const String &line = lines[i];
+            bench_kind_t kind = classify(line);
+            if(realtime && i < stamps.size()){
+                std::this_thread::sleep_until(start + std::chrono::milliseconds(stamps[i] - stamps[0]));
+            }
+            if(kind == BENCH_RESPONSE){
+                stratum.submit(last_job.c_str(), "00000000", 0x66000000, 0, 0x20000000);
+                stratum.flush_submits();
+                stratum.pool->inject(with_id(line, stratum.pool->take_tx()));
+            }else{
+                stratum.pool->inject(line);
+            }
+
+            host_alloc_stats_t before = host_alloc_stats();
+            host_alloc_track(true);
+            auto t0 = std::chrono::steady_clock::now();
+            stratum_method_data method = stratum.listen_methods();
+            stratum_handle_method(&stratum, &method);
+            auto t1 = std::chrono::steady_clock::now();
+            host_alloc_track(false);
+
+            uint32_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+            series[kind].ns.push_back(ns);
+            series[kind].allocs += host_alloc_stats().allocs - before.allocs;
+            total_ns += ns;
+            total_msgs++;
+
+            //the asic tx thread would consume the job, keep the ring draining
+            pool_job_data_t *job;
+            while((job = stratum.pop_job_cache()) != NULL){
+                last_job = job->id();
+                stratum_job_dispatched(job);
+                stratum_job_free(job);
+            }
+            if(record != NULL) stratum_capture_flush();//the flush task's work, not timed
+        }
+    }
+
+    if(record != NULL){
+        stratum_capture_end();
+        printf("recorded    : %s.0, %u records dropped\n", record, stratum_capture_get_dropped());
+    }
+
+    host_alloc_stats_t stats = host_alloc_stats();
+    double   peak_kb = (stats.peak - base_bytes) / 1024.0;
+    uint64_t allocs  = 0;
+    std::vector<uint32_t> all;
+    printf("%-11s %9s %9s %9s %12s\n", "kind", "msgs", "p50 us", "p99 us", "allocs/msg");
+    for(int k = 0; k < BENCH_KIND_MAX; k++){
+        if(series[k].ns.empty()) continue;
+        allocs += series[k].allocs;
+        all.insert(all.end(), series[k].ns.begin(), series[k].ns.end());
+        size_t n = series[k].ns.size();
+        printf("%-11s %9zu %9.2f %9.2f %12.2f\n", kind_name[k], n,
+            percentile(series[k].ns, 0.50) / 1000.0, percentile(series[k].ns, 0.99) / 1000.0, (double)series[k].allocs / n);
+    }
+    double p99_us         = percentile(all, 0.99) / 1000.0;
+    double allocs_per_msg = total_msgs ? (double)allocs / total_msgs : 0;
+    printf("%-11s %9llu %9.2f %9.2f %12.2f\n", "all", (unsigned long long)total_msgs, percentile(all, 0.50) / 1000.0, p99_us, allocs_per_msg);
+    printf("throughput  : %.0f msgs/s\n", total_ns ? total_msgs * 1e9 / total_ns : 0);
+    printf("peak heap   : %.1f KiB above start\n", peak_kb);
+    printf("shares      : %u accepted, %u rejected\n", s_accepted, s_rejected);
+    printf("arena spill : %u job allocations on the heap\n", stratum_arena_fallbacks());
+
+    const stratum_trace_stats_t *trace = stratum_trace_stats();
+    for(int k = 0; k < STRATUM_TRACE_KIND_MAX; k++){
+        const stratum_histogram_t *hist = trace->stage[k];
+        if(hist[0].count.load() == 0) continue;
+        printf("job path %-5s p50/p99 us:", (k == STRATUM_TRACE_CLEAN) ? "clean" : "job");
+        for(int stage = 0; stage < STRATUM_TRACE_STAGES; stage++){
+            if(hist[stage].count.load() == 0) continue;
+            printf(" %s %u/%u", stratum_trace_stage_name((stratum_trace_stage_t)stage),
+                stratum_histogram_percentile(&hist[stage], 0.50), stratum_histogram_percentile(&hist[stage], 0.99));
+        }
+        printf("\n");
+    }
+
+    stratum_metrics_snapshot_t snapshot;
+    char                       json[1024];
+    stratum_metrics_snapshot(&snapshot);
+    stratum_metrics_json(&snapshot, json, sizeof(json));
+    printf("metrics     : %s\n", json);
+
+    int rc = 0;
+    if(max_p99_us > 0 && p99_us > max_p99_us){
+        fprintf(stderr, "FAIL p99 %.2f us > %.2f us\n", p99_us, max_p99_us);
+        rc = 1;
+    }
+    if(max_allocs >= 0 && allocs_per_msg > max_allocs){
+        fprintf(stderr, "FAIL allocs/msg %.2f > %.2f\n", allocs_per_msg, max_allocs);
+        rc = 1;
+    }
+    if(max_peak_kb > 0 && peak_kb > max_peak_kb){
+        fprintf(stderr, "FAIL peak heap %.1f KiB > %.1f KiB\n", peak_kb, max_peak_kb);
+        rc = 1;
+    }
+    return rc;
+}
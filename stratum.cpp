@@ -1,6 +1,12 @@
 #include <Arduino.h>
 #include "stratum.h"
-#include "logger.h"
+#include "stratum_work.h"
+#include "stratum_v2.h"
+#include "stratum_metrics.h"
+#include "stratum_log.h"
+#include "stratum_arena.h"
+#include "stratum_proxy.h"
+#include "stratum_capture.h"
 #include "csha256.h"
 #include <cfloat>
 #include "monitor.h"
@@ -10,158 +16,543 @@
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
+#include <lwip/sockets.h>
 
-StratumClass::~StratumClass(){
-    this->_rsp_json.garbageCollect();
+//job headers live in internal RAM, the stratum thread takes a slot and any thread gives it back
+static pool_job_data_t        s_job_headers[STRATUM_JOB_HEADERS];
+static std::atomic<uint32_t>  s_job_header_used[(STRATUM_JOB_HEADERS + 31) / 32];
+
+static pool_job_data_t *job_header_alloc(){
+    for(size_t w = 0; w < sizeof(s_job_header_used) / sizeof(s_job_header_used[0]); w++){
+        uint32_t free_bits = ~s_job_header_used[w].load(std::memory_order_acquire);
+        if(free_bits == 0) continue;
+        size_t slot = w * 32 + __builtin_ctz(free_bits);
+        if(slot >= STRATUM_JOB_HEADERS) break;
+        s_job_header_used[w].fetch_or(1u << (slot % 32), std::memory_order_acq_rel);
+        return &s_job_headers[slot];
+    }
+    return (pool_job_data_t*)malloc(sizeof(pool_job_data_t));
+}
+
+static void job_header_free(pool_job_data_t *job){
+    size_t slot = job - s_job_headers;
+    if(job < s_job_headers || slot >= STRATUM_JOB_HEADERS){
+        free(job);
+        return;
+    }
+    s_job_header_used[slot / 32].fetch_and(~(1u << (slot % 32)), std::memory_order_acq_rel);
+}
+
+static size_t job_data_len(size_t id_len, size_t coinb1_len, size_t coinb2_len, uint8_t merkle_count){
+    return id_len + 1 + coinb1_len + coinb2_len + 32 * merkle_count;
+}
+
+//header from the internal slots, variable part from the job arena, the caller fills everything but the id
+pool_job_data_t *stratum_job_alloc(const char *id, size_t id_len, size_t coinb1_len, size_t coinb2_len, uint8_t merkle_count){
+    if(id_len == 0 || id_len > 0xff || coinb1_len > 0xffff || coinb2_len > 0xffff) return NULL;
+    pool_job_data_t *job = job_header_alloc();
+    if(job == NULL) return NULL;
+    job->data = (uint8_t*)stratum_arena_alloc(job_data_len(id_len, coinb1_len, coinb2_len, merkle_count));
+    if(job->data == NULL){
+        job_header_free(job);
+        return NULL;
+    }
+
+    job->id_len       = id_len;
+    job->coinb1_len   = coinb1_len;
+    job->coinb2_len   = coinb2_len;
+    job->merkle_count = merkle_count;
+    job->clean_jobs   = false;
+    job->generation   = 0;
+    job->trace        = {};
+    memcpy(job->data, id, id_len);
+    job->data[id_len] = '\0';
+    return job;
+}
+
+pool_job_data_t *stratum_job_create(const stratum_notify_t *notify){
+    if(notify->job_id.len == 0 || notify->job_id.len > 0xff) return NULL;
+    if(notify->coinb1.len % 2 || notify->coinb2.len % 2) return NULL;
+    size_t coinb1_len = notify->coinb1.len / 2;
+    size_t coinb2_len = notify->coinb2.len / 2;
+    if(coinb1_len > 0xffff || coinb2_len > 0xffff) return NULL;
+
+    if(notify->clean_jobs) stratum_arena_rotate();//every job before is stale, so is their arena block
+    pool_job_data_t *job = stratum_job_alloc(notify->job_id.ptr, notify->job_id.len, coinb1_len, coinb2_len, notify->merkle_count);
+    if(job == NULL) return NULL;
+
+    job->clean_jobs   = notify->clean_jobs;
+
+    bool ok = stratum_hex32_decode(notify->version, &job->version) &&
+              stratum_hex32_decode(notify->nbits, &job->nbits) &&
+              stratum_hex32_decode(notify->ntime, &job->ntime) &&
+              stratum_hex_decode(notify->prevhash, job->prevhash, sizeof(job->prevhash)) &&
+              stratum_hex_decode(notify->coinb1, (uint8_t*)job->coinb1(), coinb1_len) &&
+              stratum_hex_decode(notify->coinb2, (uint8_t*)job->coinb2(), coinb2_len);
+    for(uint8_t i = 0; ok && i < job->merkle_count; i++){
+        ok = stratum_hex_decode(notify->merkle_branch[i], (uint8_t*)job->merkle(i), 32);
+    }
+    if(!ok){
+        stratum_job_free(job);
+        return NULL;
+    }
+    return job;
+}
+
+pool_job_data_t *stratum_job_clone(const pool_job_data_t *job){
+    pool_job_data_t *copy = stratum_job_alloc(job->id(), job->id_len, job->coinb1_len, job->coinb2_len, job->merkle_count);
+    if(copy == NULL) return NULL;
+    uint8_t *data = copy->data;
+    memcpy(copy, job, sizeof(pool_job_data_t));
+    copy->data = data;
+    memcpy(copy->data, job->data, job_data_len(job->id_len, job->coinb1_len, job->coinb2_len, job->merkle_count));
+    return copy;
+}
+
+void stratum_job_free(pool_job_data_t *job){
+    if(job == NULL) return;
+    stratum_arena_free(job->data);
+    job_header_free(job);
+}
+
+//called by the asic tx thread once the job is on the chip, books its trace
+void stratum_job_dispatched(pool_job_data_t *job){
+    if(job == NULL) return;
+    stratum_trace_stamp(&job->trace, STRATUM_TRACE_DISPATCH);
+    stratum_trace_record(&job->trace, job->clean_jobs);
 }
 
-// =================== BEGIN MODIFICATION: Replaced Nonce Generation Logic ===================
+stratum_protocol_t stratum_pool_protocol(pool_info_t *info){
+    static const size_t scheme_len = strlen(STRATUM_V2_SCHEME);
+    if(!info->url.startsWith(STRATUM_V2_SCHEME)) return STRATUM_PROTOCOL_V1;
+    info->url = info->url.substring(scheme_len);
+#if STRATUM_V2
+    return STRATUM_PROTOCOL_V2;
+#else
+    //without the noise handshake no production v2 pool takes the connection
+    LOG_E("Stratum V2 pool [%s:%d] needs a STRATUM_V2 build, trying stratum v1", info->url.c_str(), info->port);
+    return STRATUM_PROTOCOL_V1;
+#endif
+}
+
+StratumClass::StratumClass(pool_info_t pConfig, stratum_info_t sConfig, uint8_t job_cached_max): 
+ _nonce_epoch(0), _work_en2_size(0), _stratum_info(sConfig), _pool_job_cache_size(job_cached_max), _job_head(0), _job_tail(0), _job_generation(0), _clean_generation(0){
+    this->_protocol = stratum_pool_protocol(&pConfig);
+    this->_pool_info = pConfig;
+    this->_v2 = NULL;
+    this->pool = new PoolClass(pConfig);
+    this->_pool_difficulty = DEFAULT_POOL_DIFFICULTY;
+    this->_gid = 1;
+    this->_rsp_str = "";
+    this->_vr_mask = 0xffffffff;
+    this->_sub_info = {"", 0, 0};
+    this->_submit_timeouts = 0;
+    this->_shares_accepted = 0;
+    this->_shares_rejected = 0;
+    this->_clear_rsp_table();
+    this->_suggest_diff_support = true;
+    this->_is_subscribed = false;
+    this->_is_authorized = false;
+    this->_handshake     = STRATUM_HANDSHAKE_IDLE;
+    this->_handshake_ms  = 0;
+    this->_handshake_resume = false;
+    this->new_job_xsem   = xSemaphoreCreateCounting(5,0);
+    this->clear_job_xsem = xSemaphoreCreateCounting(1,0);
+    for(auto &slot : this->_job_ring) slot.store(NULL);
+    if(this->_pool_job_cache_size == 0 || this->_pool_job_cache_size > STRATUM_JOB_RING_SIZE) this->_pool_job_cache_size = STRATUM_JOB_RING_SIZE;
+    this->_submit_queue  = xQueueCreate(STRATUM_SUBMIT_QUEUE_LEN, sizeof(stratum_share_t));
+    this->_submit_cb     = NULL;
+    this->_submit_cb_arg = NULL;
+    this->_share_validator = NULL;
+    this->_diff_ctl      = new StratumDiffController();
+    this->_work_registry.store(NULL);
+    this->_share_check   = true;
+    this->_last_job_ms   = 0;
+    this->_lost_ms       = 0;
+    this->_encoder.set_user(sConfig.user.c_str());
+    memset(this->_share_drops, 0, sizeof(this->_share_drops));
+    this->_resumed       = false;
+    this->_resume_load();
+    if(this->_can_resume()){//a reboot starts from the difficulty the pool left us at
+        this->_pool_difficulty = this->_resume.difficulty;
+        this->_diff_ctl->seed(this->_resume.difficulty);
+    }
+}
 
-// The previous nonce generation system, including symmetrical number exclusion,
-// has been removed and replaced with quadratic probing as per the request.
-// Obsolete functions removed:
-// - generate_symmetrical_exclusion_list()
-// - is_binary_palindrome()
-// - is_symmetrical_nonce()
-// - set_symmetrical_exclusion()
-// - get_symmetrical_exclusion_stats()
-// - reset_nonce_range()
-// - reset_all_nonce_ranges()
-// - get_nonce_range_progress()
+StratumClass::~StratumClass(){
+    this->flush_session(true);
+    this->clear_job_cache();
+    delete this->_share_validator;
+    delete this->_diff_ctl;
+    delete this->_work_registry.load();
+    if(this->_v2 != NULL){
+        this->_v2_clear();
+        delete this->_v2;
+    }
+}
 
 /**
- * @brief Configures the number of workers and initializes their probe counters.
- * 
- * This function replaces the old nonce range configuration. It prepares the
- * _probe_iterations vector for the quadratic probing nonce generation strategy.
- * 
+ * @brief Splits the nonce space into one disjoint slice per worker.
+ *
+ * A worker walks its slice for the current extranonce2 and version bits,
+ * then rolls to the next version bits allowed by the negotiated mask and,
+ * once those are used up, to the next extranonce2. Slices never overlap, so
+ * no two workers ever hash the same header.
+ *
  * @param num_workers The total number of mining workers (threads).
  */
 void StratumClass::configure_nonce_ranges(uint32_t num_workers) {
+    if(num_workers == 0) num_workers = 1;
     _total_workers = num_workers;
-    _probe_iterations.assign(num_workers, 0);
-    _base_nonce = 0;
-    _current_prevhash = "";
-    LOG_I("Configured %d workers for quadratic probing nonce generation.", num_workers);
+    _nonce_ranges.assign(num_workers, nonce_range_t());
+    for(uint32_t i = 0; i < num_workers; i++){
+        nonce_range_t *range = &_nonce_ranges[i];
+        range->worker_id = i;
+        range->start     = (uint32_t)(((uint64_t)i << 32) / num_workers);
+        range->end       = (uint32_t)((((uint64_t)(i + 1) << 32) / num_workers) - 1);
+        range->coverage  = {0, 0, 0};
+        _restart_nonce_range(range, _nonce_epoch.load(std::memory_order_acquire));
+    }
+    LOG_I("Configured %d workers, %u nonces per worker slice.", num_workers, _nonce_ranges[0].end - _nonce_ranges[0].start + 1);
+}
+
+//snapshots the mask and extranonce2 size the worker rolls until the next epoch
+void StratumClass::_restart_nonce_range(nonce_range_t *range, uint32_t epoch){
+    uint32_t mask = this->_vr_mask.load(std::memory_order_relaxed);
+    int      size = this->_work_en2_size.load(std::memory_order_relaxed);
+    range->epoch            = epoch;
+    range->current          = range->start;
+    range->version_mask     = (mask == 0xffffffff) ? 0 : mask;
+    range->version_index    = 0;
+    range->extranonce2      = 0;
+    range->extranonce2_mask = (size <= 0 || size >= 8) ? UINT64_MAX : ((1ULL << (8 * size)) - 1);
 }
 
 /**
- * @brief Gets the next nonce for a worker using quadratic probing.
- * 
- * Generates a nonce based on the formula: nonce = base_nonce + (iteration^2).
- * The base_nonce is derived from the current job's prevhash.
- * Each worker has its own iteration counter.
- * 
- * @param worker_id The ID of the worker requesting a nonce.
- * @return The calculated nonce. Returns 0 on error.
+ * @brief Reserves up to count consecutive nonces from the worker's slice.
+ *
+ * Call from the worker's own thread. The range restarts by itself once a new
+ * job has been pushed, and rolls version bits / extranonce2 on exhaustion.
+ *
+ * @return false if worker_id was not configured.
  */
-uint32_t StratumClass::get_next_nonce(uint32_t worker_id) {
-    if (worker_id >= _probe_iterations.size()) {
-        LOG_W("Invalid worker_id %d, max workers: %d", worker_id, _probe_iterations.size());
-        return 0; // Return 0 to indicate error
+bool StratumClass::next_nonce_work(uint32_t worker_id, stratum_nonce_work_t *work, uint32_t count) {
+    if (worker_id >= _nonce_ranges.size() || count == 0) {
+        LOG_W("Invalid worker_id %u, max workers: %u", worker_id, (unsigned)_nonce_ranges.size());
+        return false;
     }
+    nonce_range_t *range = &_nonce_ranges[worker_id];
+    uint32_t epoch = _nonce_epoch.load(std::memory_order_acquire);
+    if(range->epoch != epoch) _restart_nonce_range(range, epoch);
 
-    uint32_t iteration = _probe_iterations[worker_id]++;
-    // Quadratic probing formula
-    uint32_t nonce = _base_nonce + (iteration * iteration);
-    
-    // Nonce will wrap around on overflow, which is standard for mining.
-    LOG_D("Worker %d, iteration %u, nonce 0x%08x", worker_id, iteration, nonce);
+    if(range->current > range->end){
+        range->current = range->start;
+        range->coverage.slices++;
+        if(++range->version_index >= stratum_version_variants(range->version_mask)){
+            range->version_index = 0;
+            range->extranonce2 = (range->extranonce2 + 1) & range->extranonce2_mask;
+            range->coverage.extranonce2_rolls++;
+        }
+    }
+
+    uint64_t left = (uint64_t)range->end - range->current + 1;
+    work->extranonce2  = range->extranonce2;
+    work->version_bits = stratum_version_bits(range->version_mask, range->version_index);
+    work->nonce        = (uint32_t)range->current;
+    work->count        = (left < count) ? (uint32_t)left : count;
+    range->current         += work->count;
+    range->coverage.hashes += work->count;
+    return true;
+}
+
+uint32_t StratumClass::get_next_nonce(uint32_t worker_id) {
+    stratum_nonce_work_t work;
+    if(!this->next_nonce_work(worker_id, &work, 1)) return 0;
+    return work.nonce;
+}
+
+bool StratumClass::reset_nonce_range(uint32_t worker_id) {
+    if (worker_id >= _nonce_ranges.size()) return false;
+    _restart_nonce_range(&_nonce_ranges[worker_id], _nonce_epoch.load(std::memory_order_acquire));
+    return true;
+}
+
+/**
+ * @brief Starts a new nonce epoch, every worker restarts on its next reservation.
+ *
+ * The extranonce2 size is published together with the epoch, so a worker
+ * that sees the new epoch also sees the size it belongs to. Call it from the
+ * stratum thread.
+ */
+void StratumClass::reset_all_nonce_ranges() {
+    _work_en2_size.store(this->_sub_info.extranonce2_size, std::memory_order_relaxed);
+    _nonce_epoch.fetch_add(1, std::memory_order_release);
+}
 
-    return nonce;
+//percentage of the worker slice covered for the current extranonce2 and version bits
+uint32_t StratumClass::get_nonce_range_progress(uint32_t worker_id) {
+    if (worker_id >= _nonce_ranges.size()) return 0;
+    const nonce_range_t *range = &_nonce_ranges[worker_id];
+    return (uint32_t)((range->current - range->start) * 100 / ((uint64_t)range->end - range->start + 1));
 }
 
-// =================== END MODIFICATION ====================================================
+bool StratumClass::get_nonce_coverage(uint32_t worker_id, stratum_nonce_coverage_t *coverage) {
+    if (worker_id >= _nonce_ranges.size()) return false;
+    *coverage = _nonce_ranges[worker_id].coverage;
+    return true;
+}
 
-bool StratumClass::submit_with_worker(String pool_job_id, String extranonce2, uint32_t ntime, uint32_t worker_id, uint32_t version) {
-    uint32_t nonce = get_next_nonce(worker_id);
-    if(nonce == 0 && worker_id > 0) { // Allow nonce 0 only if it's a valid calculation
-        LOG_E("Failed to get nonce for worker %d", worker_id);
+//submits the nonce a worker found, which has to lie in the worker's own slice
+bool StratumClass::submit_with_worker(String pool_job_id, String extranonce2, uint32_t ntime, uint32_t nonce, uint32_t worker_id, uint32_t version) {
+    if (worker_id >= _nonce_ranges.size()) {
+        LOG_E("Failed to submit for worker %u, max workers: %u", worker_id, (unsigned)_nonce_ranges.size());
+        return false;
+    }
+    const nonce_range_t *range = &_nonce_ranges[worker_id];
+    if (nonce < range->start || nonce > range->end) {
+        LOG_E("Nonce %08x is outside the slice of worker %u", nonce, worker_id);
         return false;
     }
-    
     return submit(pool_job_id, extranonce2, ntime, nonce, version);
 }
 
-// MODIFIED: Enhanced reset methods to remove obsolete nonce range reset
+/**
+ * @brief Drops the connection state, the session itself only when it can not be resumed.
+ *
+ * With a stored session the jobs, queued shares, extranonce and difficulty
+ * are kept, the asic goes on hashing and subscribe() decides once the pool
+ * answered whether they are still good.
+ */
 void StratumClass::reset(){
     this->_rsp_str = "";
-    this->_rsp_json.clear();
-    this->_msg_rsp_map.clear();
-    this->_sub_info.extranonce1 = "";
-    this->_sub_info.extranonce2 = "0";
-    this->_sub_info.extranonce2_size = 0;
-    this->_sub_info = {"", "", 0};
+    this->_fail_inflight();
+    this->_clear_rsp_table();
+    this->flush_session(true);
     this->_is_subscribed = false;
     this->_is_authorized = false;
-    this->_pool_difficulty = DEFAULT_POOL_DIFFICULTY;
-    this->_vr_mask = 0xffffffff;
+    this->_handshake = STRATUM_HANDSHAKE_IDLE;
+    this->_handshake_ms = 0;
+    this->_resumed = false;
     this->_suggest_diff_support = true;
+    this->_diff_ctl->restart(millis());//time without a pool is no hashing time
     this->_gid = 1;
-    
-    // REMOVED: Call to reset_all_nonce_ranges() as it is now obsolete.
+    if(this->_last_job_ms != 0){//a live session is gone, timed until the next one gets a job
+        g_stratum_metrics.reconnects.fetch_add(1, std::memory_order_relaxed);
+        this->_lost_ms = millis() ? millis() : 1;
+    }
+    if(this->_v2 != NULL) this->_v2_clear();
+    this->_last_job_ms = 0;
+    if(this->_can_resume()){
+        this->_pool_difficulty = this->_resume.difficulty;
+        this->_vr_mask = this->_resume.version_mask;
+    }else{
+        this->_pool_difficulty = DEFAULT_POOL_DIFFICULTY;
+        this->_vr_mask = 0xffffffff;
+        this->_drop_session_work();
+    }
 }
 
 void StratumClass::reset(pool_info_t pConfig, stratum_info_t sConfig){
     if(this->pool == NULL) return;
+    this->flush_session(true);//under the key of the old pool
     delete this->pool;
     
+    this->_protocol = stratum_pool_protocol(&pConfig);
+    this->_pool_info = pConfig;
     this->pool = new PoolClass(pConfig);
 
     this->_stratum_info = sConfig;
-    this->_rsp_str = "";
-    this->_rsp_json.clear();
-    this->_msg_rsp_map.clear();
-    this->_sub_info.extranonce1 = "";
-    this->_sub_info.extranonce2 = "0";
-    this->_sub_info.extranonce2_size = 0;
-    this->_sub_info = {"", "", 0};
-    this->_is_subscribed = false;
-    this->_is_authorized = false;
-    this->_pool_difficulty = DEFAULT_POOL_DIFFICULTY;
-    this->_vr_mask = 0xffffffff;
-    this->_suggest_diff_support = true;
-    this->_gid = 1;
-    
-    // REMOVED: Call to reset_all_nonce_ranges() as it is now obsolete.
+    this->_encoder.set_user(sConfig.user.c_str());
+    char key[sizeof(this->_resume_key)];
+    memcpy(key, this->_resume_key, sizeof(key));
+    this->_resume_load();
+    if(strcmp(key, this->_resume_key) != 0) this->_drop_session_work();//another pool or worker, nothing carries over
+    this->reset();
+}
+
+void StratumClass::_resume_load(){
+    stratum_resume_key(this->_pool_info.url.c_str(), this->_pool_info.port, this->_stratum_info.user.c_str(), this->_resume_key, sizeof(this->_resume_key));
+    if(this->_protocol != STRATUM_PROTOCOL_V1 || !stratum_resume_load(this->_resume_key, &this->_resume)){
+        memset(&this->_resume, 0, sizeof(this->_resume));
+    }
+    this->_resume_saved    = this->_resume;
+    this->_resume_dirty_ms = 0;
+}
+
+//stratum v2 channels are opened fresh, only v1 subscriptions are resumed
+bool StratumClass::_can_resume(){
+    return (this->_protocol == STRATUM_PROTOCOL_V1) && (this->_resume.magic == STRATUM_RESUME_MAGIC);
+}
+
+//everything that was only good under the old extranonce1
+void StratumClass::_drop_session_work(){
+    this->_sub_info = {"", 0, 0};
+    xQueueReset(this->_submit_queue);
+    this->clear_job_cache();
+    if(this->_share_validator != NULL) this->_share_validator->clear();
+    this->reset_all_nonce_ranges();
+}
+
+/**
+ * @brief Takes the live session into the resume record, NVS is written later by flush_session().
+ *
+ * Pools resend the same difficulty and version mask, those leave the record
+ * as it is on flash and nothing gets written. A real change waits
+ * STRATUM_RESUME_SAVE_MS so a burst of them costs one flash write.
+ */
+bool StratumClass::save_session(){
+    if(this->_protocol != STRATUM_PROTOCOL_V1 || !this->_is_subscribed) return false;
+    this->_resume.magic            = STRATUM_RESUME_MAGIC;
+    this->_resume.extranonce2_size = this->_sub_info.extranonce2_size;
+    this->_resume.version_mask     = this->_vr_mask;
+    this->_resume.difficulty       = this->_pool_difficulty;
+    memset(this->_resume.extranonce1, 0, sizeof(this->_resume.extranonce1));
+    strncpy(this->_resume.extranonce1, this->_sub_info.extranonce1.c_str(), sizeof(this->_resume.extranonce1) - 1);
+    if(memcmp(&this->_resume, &this->_resume_saved, sizeof(this->_resume)) == 0){
+        this->_resume_dirty_ms = 0;
+    }else if(this->_resume_dirty_ms == 0){
+        this->_resume_dirty_ms = millis() ? millis() : 1;
+    }
+    return true;
+}
+
+//writes a pending resume record once it settled, force writes it right away
+bool StratumClass::flush_session(bool force){
+    if(this->_resume_dirty_ms == 0) return true;
+    if(!force && (millis() - this->_resume_dirty_ms < STRATUM_RESUME_SAVE_MS)) return true;
+    if(!stratum_resume_save(this->_resume_key, &this->_resume)) return false;
+    this->_resume_saved    = this->_resume;
+    this->_resume_dirty_ms = 0;
+    return true;
 }
 
 uint32_t StratumClass::_get_msg_id(){
     return this->_gid++;
 }
 
-bool StratumClass::_parse_rsp(){
-    DeserializationError error = deserializeJson(this->_rsp_json, this->_rsp_str);
-    if (error) {
-        LOG_E("Failed to parse JSON: %s => %s", error.c_str(), this->_rsp_str.c_str());
+//capture false leaves the recording to the caller, for requests that carry a secret
+size_t StratumClass::_pool_write(const uint8_t *data, size_t len, bool capture){
+    size_t written = this->pool->write(data, len);
+    stratum_metrics_bytes(g_stratum_metrics.bytes_out, written);
+    if(written > 0 && capture) stratum_capture(STRATUM_CAPTURE_TX, data, written);
+    return written;
+}
+
+//writes the request the encoder just built, len is what the encoder returned
+bool StratumClass::_send_request(size_t len){
+    return (len != 0) && (this->_pool_write(this->_encoder.data(), this->_encoder.length()) == this->_encoder.length());
+}
+
+bool StratumClass::_decode_notify(int params, stratum_notify_t *notify){
+    if(this->_parser.size(params) < 9) return false;
+    int branch = this->_parser.at(params, 4);
+    size_t count = this->_parser.size(branch);
+    if(count > STRATUM_MAX_MERKLE_BRANCH){
+        LOG_E("Merkle branch too long : %u", (unsigned)count);
         return false;
     }
+    notify->job_id   = this->_parser.str(this->_parser.at(params, 0));
+    notify->prevhash = this->_parser.str(this->_parser.at(params, 1));
+    notify->coinb1   = this->_parser.str(this->_parser.at(params, 2));
+    notify->coinb2   = this->_parser.str(this->_parser.at(params, 3));
+    for(size_t i = 0; i < count; i++){
+        notify->merkle_branch[i] = this->_parser.str(this->_parser.at(branch, i));
+    }
+    notify->merkle_count = count;
+    notify->version    = this->_parser.str(this->_parser.at(params, 5));
+    notify->nbits      = this->_parser.str(this->_parser.at(params, 6));
+    notify->ntime      = this->_parser.str(this->_parser.at(params, 7));
+    notify->clean_jobs = this->_parser.as_bool(this->_parser.at(params, 8));
     return true;
 }
 
-bool StratumClass::_clear_rsp_id_cache(){
-    if(this->_msg_rsp_map.size() > this->_max_rsp_id_cache){
-        for(auto it = this->_msg_rsp_map.begin(); it != this->_msg_rsp_map.end();){
-            if(it->first < this->_gid - this->_max_rsp_id_cache){
-                it = this->_msg_rsp_map.erase(it);
-                LOG_D("Message ID [%d] [%s] cleared from cache, cache size %d", it->first, it->second.method.c_str(), this->_msg_rsp_map.size());
-            }else{
-                it++;
-            }
-        }
+static String str_from_slice(stratum_str_t s){
+    String str;
+    str.reserve(s.len);
+    str.concat(s.ptr, s.len);
+    return str;
+}
+
+static const char *method_up_name(stratum_method_up method){
+    switch(method){
+        case STRATUM_UP_SUBSCRIBE:          return "mining.subscribe";
+        case STRATUM_UP_AUTHORIZE:          return "mining.authorize";
+        case STRATUM_UP_CONFIGURE:          return "mining.configure";
+        case STRATUM_UP_SUGGEST_DIFFICULTY: return "mining.suggest_difficulty";
+        case STRATUM_UP_SUBMIT:             return "mining.submit";
+        default:                            return "";
     }
-    return true;
+}
+
+//submits the dropped connection never answered complete with an error, the pool will not answer them on the next one
+void StratumClass::_fail_inflight(){
+    for(auto &slot : this->_rsp_table){
+        if(slot.method == STRATUM_UP_SUBMIT && !slot.status) this->_complete_failed(slot.id, slot.tag, "connection lost");
+    }
+}
+
+void StratumClass::_clear_rsp_table(){
+    memset(this->_rsp_table, 0, sizeof(this->_rsp_table));
+    this->_submit_pending = 0;
+    this->_submit_wait_since = 0;
+}
+
+/**
+ * @brief Registers a request in the in-flight table, slot = id % STRATUM_RSP_TABLE_SIZE.
+ *
+ * Ids are sequential, so the slot being reused belongs to the request sent
+ * STRATUM_RSP_TABLE_SIZE messages ago. A submit still unanswered there is
+ * expired and counted as a timeout.
+ */
+stratum_rsp* StratumClass::_track_rsp(stratum_msg_rsp_id_t id, stratum_method_up method, uint32_t now){
+    stratum_rsp *slot = &this->_rsp_table[id & (STRATUM_RSP_TABLE_SIZE - 1)];
+    if(slot->method == STRATUM_UP_SUBMIT && !slot->status){
+        this->_submit_pending--;
+        this->_submit_timeouts++;
+        g_stratum_metrics.submit_timeouts.fetch_add(1, std::memory_order_relaxed);
+        LOG_W("Message ID [%d] [mining.submit] expired without response", slot->id);
+    }
+    *slot = {id, method, false, now, 0};
+    stratum_metrics_request(method);
+    if(method == STRATUM_UP_SUBMIT){
+        if(this->_submit_pending++ == 0) this->_submit_wait_since = now;
+    }
+    return slot;
+}
+
+stratum_rsp* StratumClass::_find_rsp(uint32_t id){
+    stratum_rsp *slot = &this->_rsp_table[id & (STRATUM_RSP_TABLE_SIZE - 1)];
+    if(slot->method == STRATUM_UP_NONE || slot->id != id) return NULL;
+    return slot;
 }
 
 // ... (The rest of the file from hello_pool onwards remains largely the same, with one key change in push_job_cache)
 
 bool StratumClass::hello_pool(uint32_t hello_interval, uint32_t lost_max_time){
-    this->_clear_rsp_id_cache();//clear cache of msg id
+    this->flush_session(false);
+    if(this->_handshake == STRATUM_HANDSHAKE_SENT && millis() - this->_handshake_ms > STRATUM_HANDSHAKE_TIMEOUT_MS){
+        LOG_E("Failed to read mining.subscribe response, reconnecting...");
+        this->reset();
+        this->pool->end();
+        return false;
+    }
+    //a failed write shows up through the keepalive below
+    if(this->_is_authorized && this->_diff_ctl->update(millis(), this->_pool_difficulty)){
+        if(this->_protocol == STRATUM_PROTOCOL_V2) this->_v2_update_channel();
+        else if(this->_suggest_diff_support)      this->_send_suggest_difficulty();
+    }
+    if((millis() - this->pool->get_last_write_ms() > hello_interval) && this->_protocol == STRATUM_PROTOCOL_V2){
+        if(!this->_v2_update_channel()){
+            LOG_W("Failed to send UpdateChannel, reconnecting...");
+            this->reset();
+            this->pool->end();
+            return false;
+        }
+        LOG_D("Hello pool...");
+        return true;
+    }
     if((millis() - this->pool->get_last_write_ms() > hello_interval) && this->_suggest_diff_support){
-        uint32_t id = this->_get_msg_id();
-        String payload = "{\"id\": " + String(id) + ", \"method\": \"mining.suggest_difficulty\", \"params\": [" + String(this->_pool_difficulty, 4) + "]}\n";
-        if(this->pool->write(payload) != 0){
-            this->_msg_rsp_map[id] = {"mining.suggest_difficulty", false, millis()};
+        if(this->_send_suggest_difficulty()){
             LOG_D("Hello pool...");
             return true;
         }
@@ -181,67 +572,119 @@ bool StratumClass::hello_pool(uint32_t hello_interval, uint32_t lost_max_time){
     return true;
 }
 
+bool StratumClass::available(){
+    if(this->pool->available()) return true;
+    //a whole frame may already have been pulled off the socket
+    return (this->_v2 != NULL) && (stratum_v2_next_frame_size(this->_v2) > 0);
+}
+
 stratum_method_data StratumClass::listen_methods(){
+    if(this->_protocol == STRATUM_PROTOCOL_V2) return this->_v2_listen();
+    stratum_method_data method = {};
+    method.id   = -1;
+    method.type = STRATUM_DOWN_PARSE_ERROR;
+    method.name = "";
+
+    stratum_trace_stamp(&method.trace, STRATUM_TRACE_RECV);
     this->_rsp_str = this->pool->readline();
+    if(this->_rsp_str.length() > 0){
+        stratum_metrics_bytes(g_stratum_metrics.bytes_in, this->_rsp_str.length() + 1);
+        stratum_capture(STRATUM_CAPTURE_RX_LINE, this->_rsp_str.c_str(), this->_rsp_str.length());
+    }
+    stratum_trace_stamp(&method.trace, STRATUM_TRACE_READ);
+    method.raw = {this->_rsp_str.c_str(), this->_rsp_str.length()};
     if(this->_rsp_str == ""){
-        return {-1, STRATUM_DOWN_PARSE_ERROR, "", ""};
+        return method;
     }
 
-    if(!this->_parse_rsp()){
-        return {-1, STRATUM_DOWN_PARSE_ERROR, "", ""};
+    if(!this->_parser.parse(this->_rsp_str.c_str(), this->_rsp_str.length())){
+        return method;
     }
 
-    int32_t id = (this->_rsp_json["id"] == nullptr) ? -1 : this->_rsp_json["id"];
+    int root = this->_parser.root();
+    method.id   = this->_parser.as_int(this->_parser.find(root, "id"), -1);
+    method.type = STRATUM_DOWN_UNKNOWN;
 
-    if(this->_rsp_json.containsKey("method")){
-        if(this->_rsp_json["method"] == "mining.notify"){
-            return {id, STRATUM_DOWN_NOTIFY, "mining.notify", this->_rsp_str};
+    int name = this->_parser.find(root, "method");
+    if(name >= 0){
+        int params = this->_parser.find(root, "params");
+        if(this->_parser.eq(name, "mining.notify")){
+            method.name = "mining.notify";
+            method.type = this->_decode_notify(params, &method.notify) ? STRATUM_DOWN_NOTIFY : STRATUM_DOWN_PARSE_ERROR;
         }
-        if(this->_rsp_json["method"] == "mining.set_difficulty"){
-            return {id, STRATUM_DOWN_SET_DIFFICULTY, "mining.set_difficulty", this->_rsp_str};
+        else if(this->_parser.eq(name, "mining.set_difficulty")){
+            method.name = "mining.set_difficulty";
+            method.type = STRATUM_DOWN_SET_DIFFICULTY;
+            method.difficulty = this->_parser.as_double(this->_parser.at(params, 0), 0);
         }
-        if(this->_rsp_json["method"] == "mining.set_version_mask"){
-            return {id, STRATUM_DOWN_SET_VERSION_MASK, "mining.set_version_mask", this->_rsp_str};
+        else if(this->_parser.eq(name, "mining.set_version_mask")){
+            int mask = this->_parser.at(params, 0);
+            method.name = "mining.set_version_mask";
+            method.type = STRATUM_DOWN_SET_VERSION_MASK;
+            method.has_version_mask = this->_parser.is_string(mask);
+            method.version_mask = this->_parser.as_hex32(mask, 0xffffffff);
         }
-        if(this->_rsp_json["method"] == "mining.set_extranonce"){
-            return {id, STRATUM_DOWN_SET_EXTRANONCE, "mining.set_extranonce", this->_rsp_str};
+        else if(this->_parser.eq(name, "mining.set_extranonce")){
+            method.name = "mining.set_extranonce";
+            method.type = STRATUM_DOWN_SET_EXTRANONCE;
+            method.extranonce1 = this->_parser.str(this->_parser.at(params, 0));
+            method.extranonce2_size = this->_parser.as_int(this->_parser.at(params, 1), 0);
         }
     }
     else{
-        if(this->_rsp_json["error"].isNull()){
-            return {id, STRATUM_DOWN_SUCCESS, "", this->_rsp_str};
-        }else{
-            //'suggest_difficulty' method didn't support 
-            if(4 == id){
-                this->_suggest_diff_support = false;
-                LOG_W("Pool doesn't support suggest_difficulty!");
+        int error = this->_parser.find(root, "error");
+        if(this->_parser.is_null(error)){
+            int result = this->_parser.find(root, "result");
+            method.type = STRATUM_DOWN_SUCCESS;
+            method.has_result = (result >= 0);
+            method.result = this->_parser.as_bool(result);
+            stratum_rsp *rsp = this->_find_rsp(method.id);
+            if(rsp != NULL && rsp->method == STRATUM_UP_SUBSCRIBE){
+                method.subscribed = this->_decode_subscribe(result, &method);
             }
-            return {id, STRATUM_DOWN_ERROR, "", this->_rsp_str};
+            //mining.configure
+            int vr = this->_parser.find(result, "version-rolling");
+            if(vr >= 0){
+                int mask = this->_parser.find(result, "version-rolling.mask");
+                method.version_rolling = this->_parser.as_bool(vr);
+                method.has_version_mask = (mask >= 0);
+                method.version_mask = this->_parser.as_hex32(mask, 0xffffffff);
+            }
+        }else{
+            method.type = STRATUM_DOWN_ERROR;
+            method.error = this->_parser.str(error);
         }
     }
-    return {id, STRATUM_DOWN_UNKNOWN, "", this->_rsp_str};
+    stratum_trace_stamp(&method.trace, STRATUM_TRACE_PARSE);
+    return method;
 }
 
 String StratumClass::get_sub_extranonce1(){
     return this->_sub_info.extranonce1;
 }
 
+int StratumClass::get_sub_extranonce2_size(){
+    return this->_sub_info.extranonce2_size;
+}
+
 String StratumClass::get_sub_extranonce2() {
-    uint64_t ext2 = strtoull(this->_sub_info.extranonce2.c_str(), NULL, 16); 
-    ext2++;
-    ext2 = ext2 & ((1ULL << (8 * this->_sub_info.extranonce2_size)) - 1);
+    int size = this->_sub_info.extranonce2_size;
+    if(size <= 0 || size > STRATUM_EXTRANONCE2_MAX) return "";
 
-    char buffer[2 * this->_sub_info.extranonce2_size + 1];
-    snprintf(buffer, sizeof(buffer), "%0*llx", 2 * this->_sub_info.extranonce2_size, ext2);
-    String next_ext2(buffer);
+    uint64_t ext2 = this->_sub_info.extranonce2 + 1;
+    if(size < 8) ext2 &= (1ULL << (8 * size)) - 1;
+    this->_sub_info.extranonce2 = ext2;
 
-    this->_sub_info.extranonce2 = next_ext2;
-    return next_ext2;
+    uint8_t bytes[STRATUM_EXTRANONCE2_MAX];
+    char    buffer[2 * STRATUM_EXTRANONCE2_MAX + 1];
+    for(int i = size - 1; i >= 0; i--, ext2 >>= 8) bytes[i] = ext2 & 0xff;
+    stratum_hex_encode(bytes, size, buffer);
+    return String(buffer);
 }
 
 bool StratumClass::clear_sub_extranonce2(){
-    this->_sub_info.extranonce2 = "0";
-    return (this->_sub_info.extranonce2 == "0");
+    this->_sub_info.extranonce2 = 0;
+    return true;
 }   
 
 void StratumClass::set_sub_extranonce1(String extranonce1){
@@ -252,248 +695,961 @@ void StratumClass::set_sub_extranonce2_size(int size){
     this->_sub_info.extranonce2_size = size;
 }
 
-bool StratumClass::subscribe(){
-    this->_sub_info.extranonce2 = "";
-    this->_sub_info.extranonce2_size = 0;
+double StratumClass::get_suggested_difficulty(){
+    return this->_diff_ctl->get_suggested();
+}
+
+double StratumClass::get_estimated_hashrate(){
+    return this->_diff_ctl->get_hashrate();
+}
+
+void StratumClass::set_share_interval(uint32_t interval_ms){
+    this->_diff_ctl->set_interval(interval_ms);
+}
+
+/**
+ * @brief Writes the whole v1 connection setup in one go, the answers are matched by id later.
+ *
+ * configure, subscribe (offering the stored session id), authorize and
+ * suggest_difficulty go out back to back in a single write. Pools handle
+ * them in order, resolve_subscribe() completes the handshake and the first
+ * notify starts the asic, about one round trip after connect.
+ */
+bool StratumClass::handshake(){
+    if(this->_protocol == STRATUM_PROTOCOL_V2){
+        //SetupConnection has to be answered before a channel can be opened
+        if(!this->_v2_subscribe()) return false;
+        this->set_version_mask(0x1fffe000);//negotiated by SetupConnection, v2 allows the BIP320 bits
+        this->_handshake = STRATUM_HANDSHAKE_DONE;
+        return true;
+    }
     this->_is_subscribed = false;
-    
-    uint32_t id = this->_get_msg_id();
-    String payload = "{\"id\": " + String(id) + ", \"method\": \"mining.subscribe\", \"params\": [\"" +  g_nmaxe.board.hw_model + "/" + CURRENT_FW_VERSION +"\"]}\n";
-    if(this->pool->write(payload) == 0){
-        LOG_E("Failed to send mining.subscribe request");
+    this->_resumed = false;
+    this->_handshake_resume = this->_can_resume();
+
+    stratum_msg_rsp_id_t configure_id = this->_get_msg_id();
+    stratum_msg_rsp_id_t subscribe_id = this->_get_msg_id();
+    stratum_msg_rsp_id_t authorize_id = this->_get_msg_id();
+    stratum_msg_rsp_id_t suggest_id   = this->_suggest_diff_support ? this->_get_msg_id() : 0;
+    this->_encoder.clear();
+    bool encoded = this->_encoder.configure(configure_id, 0xffffffff) &&
+                   this->_encoder.subscribe(subscribe_id, g_nmaxe.board.hw_model.c_str(), CURRENT_FW_VERSION, this->_handshake_resume ? this->_resume.session_id : NULL) &&
+                   this->_encoder.authorize(authorize_id, this->_stratum_info.user.c_str(), this->_stratum_info.pwd.c_str()) &&
+                   (suggest_id == 0 || this->_encoder.suggest_difficulty(suggest_id, this->_diff_ctl->get_suggested()));
+    size_t written = encoded ? this->_pool_write(this->_encoder.data(), this->_encoder.length(), false) : 0;
+    this->_encoder.mask_secret();//the password stays out of the capture and the log
+    if(written > 0) stratum_capture(STRATUM_CAPTURE_TX, this->_encoder.data(), written);
+    if(!encoded || written != this->_encoder.length()){
+        LOG_E("Failed to send the handshake requests");
         return false;
     }
-    //wait for response
-    uint32_t start = millis();
-    while (true){
-        this->_rsp_str = this->pool->readline(100);
-        if(this->_rsp_str == "" ) {
-            if(millis() - start > 1000*10){
-                LOG_E("Failed to read mining.subscribe response");
-                return false;
-            }
+    uint32_t now = millis();
+    this->_track_rsp(configure_id, STRATUM_UP_CONFIGURE, now);
+    this->_track_rsp(subscribe_id, STRATUM_UP_SUBSCRIBE, now);
+    this->_track_rsp(authorize_id, STRATUM_UP_AUTHORIZE, now);
+    if(suggest_id != 0) this->_track_rsp(suggest_id, STRATUM_UP_SUGGEST_DIFFICULTY, now);
+    this->_handshake    = STRATUM_HANDSHAKE_SENT;
+    this->_handshake_ms = now;
+    log_i("Sending handshake : %s", this->_encoder.c_str());
+    return true;
+}
+
+//result = [subscriptions, extranonce1, extranonce2_size]
+bool StratumClass::_decode_subscribe(int result, stratum_method_data *method){
+    if(this->_parser.size(result) < 3 || !this->_parser.is_string(this->_parser.at(result, 1))) return false;
+    method->extranonce1      = this->_parser.str(this->_parser.at(result, 1));
+    method->extranonce2_size = this->_parser.as_int(this->_parser.at(result, 2), 0);
+    method->session_id       = {"", 0};
+
+    //[method, subscription id] pairs, or just one pair, the notify one is the session
+    int  subs = this->_parser.at(result, 0);
+    bool flat = this->_parser.is_string(this->_parser.at(subs, 0));
+    for(size_t i = 0; i < (flat ? 1 : this->_parser.size(subs)); i++){
+        int sub = flat ? subs : this->_parser.at(subs, i);
+        if(this->_parser.eq(this->_parser.at(sub, 0), "mining.notify")) method->session_id = this->_parser.str(this->_parser.at(sub, 1));
+    }
+    return true;
+}
+
+/**
+ * @brief Completes the handshake with the mining.subscribe response.
+ *
+ * A pool that resumes hands back the stored extranonce1, the work kept by
+ * reset() then goes on as if nothing happened. Otherwise it is dropped and
+ * the session starts cold. A refused resume is retried cold on the same
+ * connection, any other refusal drops the connection.
+ *
+ * @return false if the message does not answer a pending subscribe.
+ */
+bool StratumClass::resolve_subscribe(const stratum_method_data *method){
+    stratum_rsp *rsp = (method->id >= 0) ? this->_find_rsp(method->id) : NULL;
+    if(rsp == NULL || rsp->method != STRATUM_UP_SUBSCRIBE || rsp->status) return false;
+    rsp->status = true;
+    stratum_metrics_response(STRATUM_UP_SUBSCRIBE, millis() - rsp->stamp);
+
+    bool resume = this->_handshake_resume;
+    if(method->type != STRATUM_DOWN_SUCCESS || !method->subscribed){
+        LOG_E("mining.subscribe refused => %.*s", (int)method->raw.len, method->raw.ptr);
+        if(resume){//some pools refuse an unknown session id outright, retry without it
+            stratum_resume_forget(this->_resume_key);
+            memset(&this->_resume, 0, sizeof(this->_resume));
+            this->_resume_saved    = this->_resume;
+            this->_resume_dirty_ms = 0;
+            this->_handshake = STRATUM_HANDSHAKE_IDLE;
         }else{
-            break;
+            this->reset();
+            this->pool->end();
         }
+        return true;
     }
-    
-    if(!this->_parse_rsp()){
-        LOG_E("Failed to parse mining.subscribe response");
-        return false;
+    String extranonce1 = str_from_slice(method->extranonce1);
+    this->_resumed = resume && (extranonce1 == this->_resume.extranonce1) && (method->extranonce2_size == this->_resume.extranonce2_size);
+    bool keep_work = this->_resumed && (this->_lost_ms == 0 || (int32_t)(millis() - this->_lost_ms) <= STRATUM_RESUME_HOLD_MS);
+    if(!keep_work){
+        this->_drop_session_work();
+        //the mask comes with the configure response, sent ahead of the subscribe
+        if(!this->_resumed) this->_pool_difficulty = DEFAULT_POOL_DIFFICULTY;
     }
-    this->_sub_info.extranonce1 = String((const char*)this->_rsp_json["result"][1]);
-    this->_sub_info.extranonce2_size = this->_rsp_json["result"][2];
+    this->_sub_info.extranonce1 = extranonce1;
+    this->_sub_info.extranonce2_size = method->extranonce2_size;
     this->_is_subscribed = true;
-    this->_msg_rsp_map[id] = {"mining.subscribe", false, millis()};
-    log_i("Sending mining.subscribe : %s", payload.c_str());
+    this->_handshake = STRATUM_HANDSHAKE_DONE;
     LOG_I("extranonce1 : %s", this->_sub_info.extranonce1.c_str());
     LOG_I("extranonce2 size : %d", this->_sub_info.extranonce2_size);
+    if(this->_resumed) LOG_I("Session %s resumed%s", this->_resume.session_id, keep_work ? ", queued work kept" : "");
+
+    if(method->session_id.len > 0 || !this->_resumed){
+        size_t len = std::min(method->session_id.len, sizeof(this->_resume.session_id) - 1);
+        memcpy(this->_resume.session_id, method->session_id.ptr, len);
+        this->_resume.session_id[len] = '\0';
+    }
+    this->save_session();
     return true;
 }
 
-bool StratumClass::authorize(){
+//sends the difficulty the controller settled on, not the one the pool assigned
+bool StratumClass::_send_suggest_difficulty(){
     uint32_t id = this->_get_msg_id();
-    String payload = "{\"id\": " + String(id) + ", \"method\": \"mining.authorize\", \"params\": [\"" + this->_stratum_info.user+ "\", \"" + this->_stratum_info.pwd + "\"]}\n";
-    if(this->pool->write(payload) != payload.length()){
-        LOG_E("Failed to send mining.authorize request");
-        return false;
-    }
-    this->_msg_rsp_map[id] = {"mining.authorize", false, millis()};
-    log_i("Sending mining.authorize : %s", payload.c_str());
-    delay(100);
+    this->_encoder.clear();
+    if(!this->_send_request(this->_encoder.suggest_difficulty(id, this->_diff_ctl->get_suggested()))) return false;
+    this->_track_rsp(id, STRATUM_UP_SUGGEST_DIFFICULTY, millis());
+    log_i("Sending mining.suggest_difficulty : %s", this->_encoder.c_str());
     return true;
 }
 
-bool StratumClass::suggest_difficulty(){
-    uint32_t id = this->_get_msg_id();
-    String payload = "{\"id\": " + String(id) + ", \"method\": \"mining.suggest_difficulty\", \"params\": [" + String(this->_pool_difficulty, 4) + "]}\n";
-    if(this->pool->write(payload) != payload.length()){
-        LOG_E("Failed to send mining.suggest_difficulty request");
+/**
+ * @brief Queues a share for the stratum thread, never blocks the caller.
+ *
+ * The share is written by flush_submits() and its outcome is reported through
+ * the callback set with set_submit_callback() once the pool responds.
+ *
+ * @return false if the share is malformed or the queue is full.
+ */
+bool StratumClass::submit(const char *pool_job_id, const char *extranonce2, uint32_t ntime, uint32_t nonce, uint32_t version, uint32_t tag){
+    stratum_share_t share;
+    if(strlen(pool_job_id) >= sizeof(share.job_id) || strlen(extranonce2) >= sizeof(share.extranonce2)){
+        LOG_E("Share [%s] [%s] too long to submit", pool_job_id, extranonce2);
         return false;
     }
-    this->_msg_rsp_map[id] = {"mining.suggest_difficulty", false, millis()};
-    log_i("Sending mining.suggest_difficulty : %s", payload.c_str());
-    delay(100);
+    strcpy(share.job_id, pool_job_id);
+    strcpy(share.extranonce2, extranonce2);
+    share.ntime   = ntime;
+    share.nonce   = nonce;
+    share.version = version;
+    share.stamp   = millis();
+    share.tag     = tag;
+    if(xQueueSend(this->_submit_queue, &share, 0) != pdTRUE){
+        LOG_W("Submit queue full, share [%s] dropped", share.job_id);
+        return false;
+    }
+    stratum_wake();
     return true;
 }
 
-bool StratumClass::config_version_rolling(){
-    uint32_t id = this->_get_msg_id();
-    String payload = "{\"id\": " + String(id) + ", \"method\": \"mining.configure\", \"params\": [[\"version-rolling\"], {\"version-rolling.mask\": \"ffffffff\"}]}\n";
-    if(this->pool->write(payload) != payload.length()){
-        LOG_E("Failed to send mining.configure request");
-        return false;
+//session that last dispatched work under each asic job id, results go back to it
+static std::atomic<StratumClass*> s_work_owner[STRATUM_ASIC_JOB_IDS];
+
+/**
+ * @brief Records work the asic tx thread just sent under asic_job_id.
+ *
+ * The work is stamped with the clean_jobs generation its job was published
+ * in, a flush after that turns it stale in resolve_work(). Switching pools
+ * does not, results of the previous pool still reach it.
+ */
+bool StratumClass::register_work(uint8_t asic_job_id, const pool_job_data_t *job, const char *extranonce2, uint32_t ntime, uint32_t version){
+    stratum_asic_work_t work;
+    if(job == NULL || job->id_len >= sizeof(work.job_id) || strlen(extranonce2) >= sizeof(work.extranonce2)) return false;
+    StratumWorkRegistry *registry = this->_work_registry.load(std::memory_order_acquire);
+    if(registry == NULL){
+        registry = new StratumWorkRegistry();
+        this->_work_registry.store(registry, std::memory_order_release);
     }
-    this->_msg_rsp_map[id] = {"mining.configure", false, millis()};
-    log_i("Sending mining.configure : %s", payload.c_str());
-    delay(100);
+    memcpy(work.job_id, job->id(), job->id_len + 1);
+    strcpy(work.extranonce2, extranonce2);
+    work.ntime      = ntime;
+    work.version    = version;
+    work.generation = job->generation;
+    work.stamp      = millis();
+    registry->put(asic_job_id, &work);
+    s_work_owner[asic_job_id & (STRATUM_ASIC_JOB_IDS - 1)].store(this, std::memory_order_release);
     return true;
 }
 
-bool StratumClass::submit(String pool_job_id, String extranonce2, uint32_t ntime, uint32_t nonce, uint32_t version){
-    uint32_t msgid = this->_get_msg_id();
-    char version_str[9] = {0,}, nonce_str[9] = {0,};
-    sprintf(version_str, "%08x", version);
-    sprintf(nonce_str, "%08x", nonce);
-
-    String payload = "{\"id\": " + String(msgid) + ", \"method\": \"mining.submit\", \"params\": [\"" + 
-    this->_stratum_info.user + "\", \"" + 
-    pool_job_id + "\", \"" + 
-    extranonce2 + "\", \"" + 
-    String(ntime, 16) + "\", \"" + 
-    String(nonce_str) + "\", \"" + 
-    String(version_str) + "\"]}\n";
+//asic rx thread, maps a returning nonce back to its work, a stale one is counted as a submit saved
+stratum_work_lookup_t StratumClass::resolve_work(uint8_t asic_job_id, stratum_asic_work_t *work){
+    StratumWorkRegistry *registry = this->_work_registry.load(std::memory_order_acquire);
+    if(registry == NULL) return STRATUM_WORK_UNKNOWN;
+    stratum_work_lookup_t lookup = registry->get(asic_job_id, this->_clean_generation.load(std::memory_order_acquire), millis(), work);
+    if(lookup == STRATUM_WORK_STALE) g_stratum_metrics.stale_avoided.fetch_add(1, std::memory_order_relaxed);
+    return lookup;
+}
 
-    if(this->pool->write(payload) != payload.length()){
-        LOG_E("Failed to send mining.submit request");
+//queues the share of a nonce found under asic_job_id, false if its work is no longer live
+bool StratumClass::submit_work(uint8_t asic_job_id, uint32_t nonce, uint32_t version){
+    stratum_asic_work_t work;
+    stratum_work_lookup_t lookup = this->resolve_work(asic_job_id, &work);
+    if(lookup != STRATUM_WORK_LIVE){
+        LOG_D("Nonce %08x of asic job %d dropped, work %s", nonce, asic_job_id, (lookup == STRATUM_WORK_STALE) ? "stale" : (lookup == STRATUM_WORK_EXPIRED) ? "expired" : "unknown");
         return false;
     }
-    this->_msg_rsp_map[msgid] = {"mining.submit", false, millis()};
-    // log_i("%s", payload.c_str());
+    return this->submit(work.job_id, work.extranonce2, work.ntime, nonce, version);
+}
 
-    //wait for response from pool
-    uint32_t start = millis();
-    while(true){
-        if(this->_msg_rsp_map[msgid].status) return true;
-        if(millis() - start > 1000*20) return false;
-        delay(1);
+//asic rx thread, submits a nonce to the session that dispatched its work
+bool stratum_submit_asic_result(uint8_t asic_job_id, uint32_t nonce, uint32_t version){
+    StratumClass *owner = s_work_owner[asic_job_id & (STRATUM_ASIC_JOB_IDS - 1)].load(std::memory_order_acquire);
+    if(owner == NULL) return false;
+    return owner->submit_work(asic_job_id, nonce, version);
+}
+
+//short name of a local share check verdict, for the log and the local submit result
+static const char *share_verdict_name(stratum_share_verdict_t verdict){
+    switch(verdict){
+        case STRATUM_SHARE_VALID:           return "valid";
+        case STRATUM_SHARE_STALE:           return "stale job";
+        case STRATUM_SHARE_LOW_DIFFICULTY:  return "above target";
+        case STRATUM_SHARE_MALFORMED:       return "malformed";
+        default:                            return "unknown";
     }
-    return false;
 }
 
-bool StratumClass::is_submit_timeout(){
-    bool timeout = true, has_submit = false;
-    
-    //cache size check
-    if(this->_msg_rsp_map.size() <= this->_max_rsp_id_cache / 2) return false;
+stratum_share_verdict_t StratumClass::_check_share(const stratum_share_t *share){
+    if(!this->_share_check || this->_share_validator == NULL) return STRATUM_SHARE_VALID;
+    return this->_share_validator->check(share, this->_sub_info.extranonce1, this->_sub_info.extranonce2_size, this->_vr_mask, this->_pool_difficulty);
+}
 
-    //check if there is any submit request
-    for(auto it = this->_msg_rsp_map.begin(); it != this->_msg_rsp_map.end();it++){
-        if(it->second.method == "mining.submit"){
-            has_submit = true;
-            break;
+//drains the submit queue into a single socket write, called from the stratum thread
+size_t StratumClass::flush_submits(){
+    stratum_share_t share;
+    stratum_msg_rsp_id_t ids[STRATUM_SUBMIT_QUEUE_LEN];
+    uint32_t             tags[STRATUM_SUBMIT_QUEUE_LEN];
+    size_t count = 0;
+    size_t sent  = 0;
+    uint8_t frames[STRATUM_SUBMIT_QUEUE_LEN * 64];
+    size_t  frames_len = 0;
+
+    while(count < STRATUM_SUBMIT_QUEUE_LEN && xQueueReceive(this->_submit_queue, &share, 0) == pdTRUE){
+        stratum_share_verdict_t verdict = this->_check_share(&share);
+        if(verdict != STRATUM_SHARE_VALID){
+            this->_share_drops[verdict]++;
+            LOG_W("Share [%s] nonce %08x dropped locally, %s", share.job_id, share.nonce, share_verdict_name(verdict));
+            if(this->_submit_cb != NULL){
+                const char *name = share_verdict_name(verdict);
+                stratum_submit_result_t result = {
+                    .id       = 0,
+                    .accepted = false,
+                    .latency  = 0,
+                    .error    = {name, strlen(name)},
+                    .tag      = share.tag,
+                    .local    = true
+                };
+                this->_submit_cb(&result, this->_submit_cb_arg);
+            }
+            continue;
+        }
+        tags[count] = share.tag;
+        ids[count] = this->_get_msg_id();
+        if(this->_protocol == STRATUM_PROTOCOL_V2){
+            size_t len = this->_v2_encode_submit(&share, ids[count], frames + frames_len, sizeof(frames) - frames_len);
+            if(len == 0){
+                LOG_E("Share [%s] dropped, can not encode SubmitSharesExtended", share.job_id);
+                this->_complete_failed(ids[count], share.tag, "encode failed");
+                continue;
+            }
+            frames_len += len;
+            count++;
+            continue;
+        }
+        if(count == 0) this->_encoder.clear();
+        size_t len = this->_encoder.submit(ids[count], share.job_id, share.extranonce2, share.ntime, share.nonce, share.version);
+        if(len == 0 && count > 0){
+            //long worker names or job ids fill the buffer early, the batch goes out and this share opens the next one
+            sent += this->_send_submits(this->_encoder.data(), this->_encoder.length(), ids, tags, count);
+            ids[0]  = ids[count];
+            tags[0] = tags[count];
+            count   = 0;
+            this->_encoder.clear();
+            len = this->_encoder.submit(ids[0], share.job_id, share.extranonce2, share.ntime, share.nonce, share.version);
+        }
+        if(len == 0){
+            LOG_E("Share [%s] dropped, payload too long", share.job_id);
+            this->_complete_failed(ids[count], share.tag, "payload too long");
+            continue;
         }
+        count++;
     }
-    if(!has_submit) return false;
+    if(count == 0) return sent;
 
-    //timeout check, if all submit has no response, return true
-    for(auto it = this->_msg_rsp_map.begin(); it != this->_msg_rsp_map.end();it++){
-        if((it->second.method == "mining.submit") && (it->second.status)){//submit response received
-            timeout = false;
-            break;
+    const uint8_t *data    = (this->_protocol == STRATUM_PROTOCOL_V2) ? frames : this->_encoder.data();
+    size_t         expect  = (this->_protocol == STRATUM_PROTOCOL_V2) ? frames_len : this->_encoder.length();
+    return sent + this->_send_submits(data, expect, ids, tags, count);
+}
+
+//writes a batch of encoded submits in one go and tracks them, the shares of a failed write complete with an error
+size_t StratumClass::_send_submits(const uint8_t *data, size_t len, const stratum_msg_rsp_id_t *ids, const uint32_t *tags, size_t count){
+    if(this->_pool_write(data, len) != len){
+        //the session is going down with the socket, these shares would be stale on the next one
+        LOG_E("Failed to send %u mining.submit request", (unsigned)count);
+        for(size_t i = 0; i < count; i++) this->_complete_failed(ids[i], tags[i], "send failed");
+        return 0;
+    }
+    uint32_t now = millis();
+    for(size_t i = 0; i < count; i++){
+        this->_track_rsp(ids[i], STRATUM_UP_SUBMIT, now)->tag = tags[i];
+    }
+    return count;
+}
+
+//a dequeued share that never made it onto the wire or was never answered still gets its callback
+void StratumClass::_complete_failed(stratum_msg_rsp_id_t id, uint32_t tag, const char *error){
+    g_stratum_metrics.submit_failed.fetch_add(1, std::memory_order_relaxed);
+    if(this->_submit_cb == NULL) return;
+    stratum_submit_result_t result = {
+        .id       = id,
+        .accepted = false,
+        .latency  = 0,
+        .error    = {error, strlen(error)},
+        .tag      = tag,
+        .local    = true
+    };
+    this->_submit_cb(&result, this->_submit_cb_arg);
+}
+
+//marks a submit slot answered, restarts the wait window of the pending ones and fires the completion callback
+void StratumClass::_resolve_submit_slot(stratum_rsp *rsp, bool accepted, stratum_str_t error, uint32_t now){
+    rsp->status = true;
+    this->_submit_pending--;
+    this->_submit_wait_since = now;//the pool is answering, restart the wait window of the rest
+    stratum_submit_result_t result = {
+        .id       = rsp->id,
+        .accepted = accepted,
+        .latency  = now - rsp->stamp,
+        .error    = error,
+        .tag      = rsp->tag,
+        .local    = false
+    };
+    stratum_metrics_response(STRATUM_UP_SUBMIT, result.latency);
+    stratum_metrics_share(accepted, error);
+    if(accepted) this->_diff_ctl->add_share(this->_pool_difficulty);
+    if(accepted) this->_shares_accepted++;
+    else         this->_shares_rejected++;
+    if(this->_submit_cb != NULL) this->_submit_cb(&result, this->_submit_cb_arg);
+}
+
+bool StratumClass::resolve_submit(const stratum_method_data *method){
+    uint32_t now = millis();
+    if(method->batch){
+        //every submit up to the acknowledged sequence number not rejected on its own was accepted
+        bool resolved = false;
+        for(auto &rsp : this->_rsp_table){
+            if(rsp.method != STRATUM_UP_SUBMIT || rsp.status || (int32_t)(rsp.id - (uint32_t)method->id) > 0) continue;
+            this->_resolve_submit_slot(&rsp, true, method->error, now);
+            resolved = true;
         }
+        return resolved;
     }
-    return timeout;
+
+    stratum_rsp *rsp = this->_find_rsp(method->id);
+    if(rsp == NULL || rsp->method != STRATUM_UP_SUBMIT || rsp->status) return false;
+    this->_resolve_submit_slot(rsp, (method->type == STRATUM_DOWN_SUCCESS) && method->result, method->error, now);
+    return true;
+}
+
+void StratumClass::set_submit_callback(stratum_submit_cb_t cb, void *arg){
+    this->_submit_cb_arg = arg;
+    this->_submit_cb     = cb;
+}
+
+//true if submits are outstanding and the pool has not answered any of them for SUBMIT_TIMEOUT_MS
+bool StratumClass::is_submit_timeout(){
+    if(this->_submit_pending == 0) return false;
+    return (millis() - this->_submit_wait_since) > SUBMIT_TIMEOUT_MS;
+}
+
+//claims the entry at head, fails if the other side moved head first
+pool_job_data_t *StratumClass::_take_job(uint32_t head){
+    pool_job_data_t *job = this->_job_ring[head & (STRATUM_JOB_RING_SIZE - 1)].load(std::memory_order_acquire);
+    if(!this->_job_head.compare_exchange_strong(head, head + 1, std::memory_order_acq_rel)) return NULL;
+    return job;
 }
 
 /**
- * @brief Adds a job to the cache and resets nonce generation if it's for a new block.
- * 
- * This function is modified to check if a new job corresponds to a new block
- * (indicated by clean_jobs flag or a new prevhash). If so, it recalculates
- * the base_nonce and resets the probe counters for all workers.
- * 
- * @param job The pool job data to cache.
+ * @brief Publishes a job to the ASIC TX thread, called from the stratum thread only.
+ *
+ * A clean_jobs job flushes the ring and bumps the job generation first. When
+ * the ring is full the oldest job is dropped instead of blocking. Every job
+ * restarts the worker nonce ranges.
+ *
+ * @param job The pool job data to cache, ownership moves to the cache.
  * @return The new size of the job cache.
  */
-size_t StratumClass::push_job_cache(pool_job_data_t job){
-    // =================== BEGIN MODIFICATION: Reset nonce on new block ===================
-    if (job.clean_jobs || _current_prevhash != job.prevhash) {
-        _current_prevhash = job.prevhash;
-        String nonce_hex = job.prevhash.substring(0, 6);
-        _base_nonce = strtoul(nonce_hex.c_str(), NULL, 16);
-        std::fill(_probe_iterations.begin(), _probe_iterations.end(), 0);
-        LOG_I("New block job received. Base nonce set to 0x%08x. Probes reset.", _base_nonce);
-    }
-    // =================== END MODIFICATION ===============================================
+size_t StratumClass::push_job_cache(pool_job_data_t *job){
+    if(job == NULL) return this->get_job_cache_size();
+    if(job->clean_jobs) this->clear_job_cache();
+    this->reset_all_nonce_ranges();
 
-    LOG_D("");
-    if (this->_pool_job_cache.size() >= this->_pool_job_cache_size) {
-        LOG_D("Job [%s] popped from cache...", this->_pool_job_cache.front().id.c_str());
-        this->_pool_job_cache.pop_front();
+    //the ring hands the job over to the asic tx thread, the share check keeps its own copy
+    if(this->_share_validator == NULL) this->_share_validator = new StratumShareValidator();
+    if(job->clean_jobs) this->_share_validator->clear();
+    this->_share_validator->add_job(job, this->_pool_difficulty);
+    if(this->_last_job_ms == 0 && this->_lost_ms != 0){
+        stratum_histogram_add(&g_stratum_metrics.reconnect_ms, millis() - this->_lost_ms);
+        this->_lost_ms = 0;
     }
-    this->_pool_job_cache.push_back(job);
-    LOG_D("---Job cache [%02d]---", this->_pool_job_cache.size());
-    for(size_t i =0; i < this->_pool_job_cache.size(); i++){
-        LOG_D("Job id : %s", this->_pool_job_cache[i].id.c_str());
+    this->_last_job_ms = millis();
+    if(this->_last_job_ms == 0) this->_last_job_ms = 1;
+
+    uint32_t tail = this->_job_tail.load(std::memory_order_relaxed);
+    while(tail - this->_job_head.load(std::memory_order_acquire) >= this->_pool_job_cache_size){
+        pool_job_data_t *old = this->_take_job(this->_job_head.load(std::memory_order_acquire));
+        if(old != NULL){
+            LOG_D("Job [%s] dropped from cache...", old->id());
+            stratum_job_free(old);
+        }
     }
-    LOG_D("--------------------");
-    return this->_pool_job_cache.size();
+    job->generation = this->_clean_generation.load(std::memory_order_relaxed);
+    stratum_trace_stamp(&job->trace, STRATUM_TRACE_PUBLISH);
+    this->_job_ring[tail & (STRATUM_JOB_RING_SIZE - 1)].store(job, std::memory_order_relaxed);
+    this->_job_tail.store(tail + 1, std::memory_order_release);
+    LOG_D("Job [%s] cached, cache size %u, generation %u", job->id(), (unsigned)this->get_job_cache_size(), this->get_job_generation());
+    return this->get_job_cache_size();
 }
 
 size_t StratumClass::get_job_cache_size(){
-    return this->_pool_job_cache.size();
+    return this->_job_tail.load(std::memory_order_acquire) - this->_job_head.load(std::memory_order_acquire);
 }
 
+/**
+ * @brief Makes this session the one the mining threads work for.
+ *
+ * The nonce slicing and the share callback follow the previous active
+ * session. The job generation jumps past both sessions' generations so the
+ * asic tx thread drops the work of the old pool.
+ */
+void StratumClass::take_over(StratumClass *from){
+    if(from == NULL || from == this) return;
+    if(!from->_nonce_ranges.empty()) this->configure_nonce_ranges(from->_total_workers);
+    this->set_submit_callback(from->_submit_cb, from->_submit_cb_arg);
+    uint32_t generation = std::max(from->get_job_generation(), this->get_job_generation()) + 1;
+    this->_job_generation.store(generation, std::memory_order_release);
+}
+
+//producer side, drops every queued job and starts a new job generation
 size_t StratumClass::clear_job_cache(){
-    this->_pool_job_cache.clear();
-    return this->_pool_job_cache.size();
+    uint32_t head;
+    while((head = this->_job_head.load(std::memory_order_acquire)) != this->_job_tail.load(std::memory_order_acquire)){
+        stratum_job_free(this->_take_job(head));
+    }
+    this->_clean_generation.fetch_add(1, std::memory_order_release);
+    this->_job_generation.fetch_add(1, std::memory_order_release);
+    return 0;
 }
 
-pool_job_data_t StratumClass::pop_job_cache(){
-    if(this->_pool_job_cache.empty()){
-        return pool_job_data_t();
+//consumer side, the caller owns the returned job and releases it with stratum_job_free()
+pool_job_data_t *StratumClass::pop_job_cache(){
+    while(true){
+        uint32_t head = this->_job_head.load(std::memory_order_acquire);
+        if(head == this->_job_tail.load(std::memory_order_acquire)) return NULL;
+        pool_job_data_t *job = this->_take_job(head);
+        if(job != NULL){
+            stratum_trace_stamp(&job->trace, STRATUM_TRACE_POP);
+            return job;
+        }
     }
-    pool_job_data_t job = this->_pool_job_cache.front();
-    this->_pool_job_cache.pop_front();
-    return job;
 }
 
 bool StratumClass::set_msg_rsp_map(uint32_t id, bool status){
-    auto it = this->_msg_rsp_map.find(id);
-    if(it == this->_msg_rsp_map.end()){
-        LOG_E("Message ID [%d] not found in response map", id);
+    stratum_rsp *rsp = this->_find_rsp(id);
+    if(rsp == NULL){
+        LOG_E("Message ID [%d] not found in response table", id);
         return false;
     }
-    LOG_D("Message [%s] with ID [%d] status set to [%s]", it->second.method.c_str(), id, status ? "true" : "false");
-    it->second.status = status;
+    LOG_D("Message [%s] with ID [%d] status set to [%s]", method_up_name(rsp->method), id, status ? "true" : "false");
+    if(rsp->method == STRATUM_UP_SUBMIT && rsp->status != status) this->_submit_pending += status ? -1 : 1;
+    if(rsp->method != STRATUM_UP_SUBMIT && !rsp->status && status) stratum_metrics_response(rsp->method, millis() - rsp->stamp);
+    rsp->status = status;
     return true;
 }
 
 bool StratumClass::del_msg_rsp_map(uint32_t id){
-    auto it = this->_msg_rsp_map.find(id);
-    if(it == this->_msg_rsp_map.end()){
-        LOG_E("Message ID [%d] not found in response map", id);
+    stratum_rsp *rsp = this->_find_rsp(id);
+    if(rsp == NULL){
+        LOG_E("Message ID [%d] not found in response table", id);
         return false;
     }
-    LOG_D("Message [%s] with ID [%d] deleted from response map, cache size %d", it->second.method.c_str(), id, this->_msg_rsp_map.size());
-    this->_msg_rsp_map.erase(it);
+    LOG_D("Message [%s] with ID [%d] deleted from response table", method_up_name(rsp->method), id);
+    if(rsp->method == STRATUM_UP_SUBMIT && !rsp->status) this->_submit_pending--;
+    *rsp = {0, STRATUM_UP_NONE, false, 0, 0};
     return true;
 }
 
 stratum_rsp StratumClass::get_method_rsp_by_id(uint32_t id){
-    stratum_rsp rsp = {
-        .method = "",
-        .status = false
-    };
-    if (!this->_msg_rsp_map.empty()) {
-       if(this->_msg_rsp_map.find(id) != this->_msg_rsp_map.end()){
-           rsp = this->_msg_rsp_map[id];
-       }
+    stratum_rsp *rsp = this->_find_rsp(id);
+    if(rsp == NULL) return {0, STRATUM_UP_NONE, false, 0, 0};
+    return *rsp;
+}
+
+static void on_share_result(const stratum_submit_result_t *result, void *arg){
+    if(result->local) return;//counted by the share check already
+    if(result->accepted){
+        g_nmaxe.mstatus.share_accepted++;
+        LOG_L("#%d share accepted, %ums", g_nmaxe.mstatus.share_accepted + g_nmaxe.mstatus.share_rejected, result->latency);      
+    }
+    else{
+        g_nmaxe.mstatus.share_rejected++;
+        LOG_E("#%d share rejected, %ums %.*s", g_nmaxe.mstatus.share_accepted + g_nmaxe.mstatus.share_rejected, result->latency, (int)result->error.len, result->error.ptr);
+    }
+}
+
+static bool s_first_job = true;
+
+static void release_mining_threads(StratumClass *stratum){
+    if(!s_first_job) return;
+    //first job will release the asic tx, asic rx, monitor and ui thread
+    xSemaphoreGive(stratum->new_job_xsem);//asic tx thread
+    xSemaphoreGive(stratum->new_job_xsem);//asic rx thread
+    xSemaphoreGive(stratum->new_job_xsem);//ui thread
+    xSemaphoreGive(stratum->new_job_xsem);//monitor thread
+    s_first_job = false;
+}
+
+//dispatches one decoded downstream message, called from the stratum thread
+void stratum_handle_method(StratumClass *stratum, const stratum_method_data *method){
+    switch (method->type){
+        case STRATUM_DOWN_PARSE_ERROR:   
+            LOG_E("Stratum parse error, id : %d, raw : %.*s", method->id, (int)method->raw.len, method->raw.ptr);
+            break;
+        case STRATUM_DOWN_NOTIFY:
+        case STRATUM_DOWN_JOB:{
+                LOG_D("Stratum notify, id : %d => %.*s", method->id, (int)method->raw.len, method->raw.ptr);
+                pool_job_data_t *job = (method->type == STRATUM_DOWN_JOB) ? method->job : stratum_job_create(&method->notify);
+                if(job == NULL){
+                    LOG_E("Failed to decode mining.notify");
+                    break;
+                }
+                job->trace = method->trace;
+                stratum_trace_stamp(&job->trace, STRATUM_TRACE_DECODE);
+
+                LOG_D("Job ID            : %s", job->id());
+                LOG_D("Prevhash          : %.*s", (int)method->notify.prevhash.len, method->notify.prevhash.ptr);
+                LOG_D("Coinb1            : %d bytes", job->coinb1_len);
+                LOG_D("Coinb2            : %d bytes", job->coinb2_len);
+                LOG_D("Merkle branch     : %d", job->merkle_count);
+                LOG_D("Version           : %08x", job->version);
+                LOG_D("Nbits             : %08x", job->nbits);
+                LOG_D("Ntime             : %08x", job->ntime);
+                LOG_D("Clean jobs        : %s", job->clean_jobs ? "true" : "false");
+                LOG_D("Version mask      : 0x%08x", stratum->get_version_mask());
+                LOG_D("Pool difficulty   : %s", formatNumber(stratum->get_pool_difficulty(), 5).c_str());
+                stratum_trace_stamp(&job->trace, STRATUM_TRACE_LOG);
+                //clean_jobs flushes the ring and bumps the job generation before the new job goes in
+                bool clean = job->clean_jobs;
+                stratum->push_job_cache(job);
+
+                if(stratum == g_nmaxe.stratum){
+                    if(clean) xSemaphoreGive(stratum->clear_job_xsem);
+                    //Give the new job semaphore to the other threads
+                    xSemaphoreGive(stratum->new_job_xsem);//asic tx thread
+                    release_mining_threads(stratum);
+                }
+            }         
+            break;
+        case STRATUM_DOWN_SET_DIFFICULTY:
+            LOG_D("Stratum set difficulty, id : %d => %.*s", method->id, (int)method->raw.len, method->raw.ptr);
+            if(method->difficulty > 0){
+                stratum->set_pool_difficulty(method->difficulty);
+                stratum->save_session();
+                LOG_D("Pool difficulty set : %s", formatNumber(method->difficulty, 5).c_str());
+            }else{
+                LOG_W("Pool difficulty not found in params");
+            }
+            break;
+        case STRATUM_DOWN_SET_VERSION_MASK:
+            LOG_D("Stratum set version mask , id : %d => %.*s", method->id, (int)method->raw.len, method->raw.ptr);
+            if(method->has_version_mask){
+                stratum->set_version_mask(method->version_mask);
+                LOG_L("Version mask set to %08x", method->version_mask);
+            }else{
+                stratum->set_version_mask(0xffffffff);
+                LOG_W("Version mask not found in params");
+            }
+            stratum->save_session();
+            break;
+        case STRATUM_DOWN_SET_EXTRANONCE:
+            LOG_L("Stratum set extranonce => %.*s", (int)method->raw.len, method->raw.ptr);
+            stratum->set_sub_extranonce1(str_from_slice(method->extranonce1));
+            stratum->set_sub_extranonce2_size(method->extranonce2_size);
+            stratum->save_session();
+            break;
+        case STRATUM_DOWN_SUCCESS: 
+            if(method->id != -1){
+                if(stratum->resolve_submit(method)) break;
+                if(stratum->resolve_subscribe(method)) break;
+                stratum->set_msg_rsp_map(method->id, true);
+                stratum_rsp rsp = stratum->get_method_rsp_by_id(method->id);
+                if(rsp.method == STRATUM_UP_CONFIGURE){
+                    stratum->set_version_mask(0xffffffff);
+                    if (method->version_rolling) {
+                        if (method->has_version_mask) {
+                            stratum->set_version_mask(method->version_mask);
+                            LOG_I("Version mask set to %08x", method->version_mask);
+                        } else {
+                            LOG_W("Version mask not found in response");
+                        }
+                    } else {
+                        LOG_W("Version rolling not supported");
+                    }
+                    stratum->save_session();
+                }
+                else if(rsp.method == STRATUM_UP_AUTHORIZE){
+                    if(method->has_result){
+                        stratum->set_authorize(method->result);
+                        LOG_W("Authorization %s ", method->result ? "success" : "failed");
+                    }
+                }
+                else{
+                    LOG_D("Stratum success, id : %d => %.*s", method->id, (int)method->raw.len, method->raw.ptr);
+                }
+            }
+            break;
+        case STRATUM_DOWN_ERROR: 
+            if(method->id != -1){
+                if(stratum->resolve_submit(method)) break;
+                if(stratum->resolve_subscribe(method)) break;
+                stratum->set_msg_rsp_map(method->id, true);
+                stratum_rsp rsp = stratum->get_method_rsp_by_id(method->id);
+                if(rsp.method == STRATUM_UP_AUTHORIZE){
+                    stratum->set_authorize(false);
+                    LOG_E("Authorization failed, id %d => %.*s", method->id, (int)method->raw.len, method->raw.ptr);
+                }
+                else if(rsp.method == STRATUM_UP_SUGGEST_DIFFICULTY){
+                    //keep the pool difficulty, hello_pool falls back to the inactivity check
+                    stratum->set_suggest_diff_support(false);
+                    LOG_W("Pool doesn't support suggest_difficulty!");
+                }
+                else{
+                    LOG_E("Unknown error response, id : %d => %.*s", method->id, (int)method->raw.len, method->raw.ptr);
+                }
+            }
+            break;
+        case STRATUM_DOWN_NONE:
+            break;
+        case STRATUM_DOWN_UNKNOWN:                   
+            LOG_E("Stratum unknown, id : %d => %.*s", method->id, (int)method->raw.len, method->raw.ptr);
+            break;
+        default :
+            LOG_E("Stratum unknown, id : %d => %.*s", method->id, (int)method->raw.len, method->raw.ptr);
+            break;
+    }
+    if(g_stratum_proxy != NULL) g_stratum_proxy->on_upstream(stratum, method);
+}
+
+//loopback udp socket stratum_wake() sends to, select() in stratum_wait() sees it next to the pool sockets
+static std::atomic<int>   s_wake_fd(-1);
+static struct sockaddr_in s_wake_addr;
+
+static void stratum_wake_open(){
+    struct sockaddr_in addr = {};
+    socklen_t          len  = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(fd < 0){
+        LOG_W("No wake socket, the stratum thread polls every %d ms", STRATUM_RX_POLL_MS);
+        return;
+    }
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = 0;
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || getsockname(fd, (struct sockaddr*)&addr, &len) != 0){
+        LOG_W("Wake socket not bound, the stratum thread polls every %d ms", STRATUM_RX_POLL_MS);
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    s_wake_addr = addr;
+    s_wake_fd.store(fd, std::memory_order_release);
+}
+
+//wakes the stratum thread, e.g. for a queued share or a Wi-Fi state change, safe from any task
+void stratum_wake(){
+    int fd = s_wake_fd.load(std::memory_order_acquire);
+    if(fd >= 0) sendto(fd, "w", 1, MSG_DONTWAIT, (struct sockaddr*)&s_wake_addr, sizeof(s_wake_addr));
+}
+
+static void stratum_on_wifi_event(WiFiEvent_t event){
+    stratum_wake();
+}
+
+//a session whose keepalive falls due within the wait cuts it short
+static uint32_t stratum_keepalive_due(StratumClass *stratum, uint32_t timeout_ms){
+    if(stratum == NULL || !stratum->pool->is_connected()) return timeout_ms;
+    uint32_t since = millis() - stratum->pool->get_last_write_ms();
+    if(since >= HELLO_POOL_INTERVAL_MS) return timeout_ms;//hello_pool had its turn, the cap bounds the next one
+    return std::min(timeout_ms, (uint32_t)HELLO_POOL_INTERVAL_MS - since);
+}
+
+/**
+ * @brief Sleeps until there is work for the stratum thread.
+ *
+ * Returns as soon as one of the sessions has a line or frame to read, once
+ * stratum_wake() was called, when a keepalive falls due or after timeout_ms.
+ * Data the pool client already buffered is checked before select(), a
+ * socket without a descriptor is checked every STRATUM_RX_POLL_MS.
+ */
+static void stratum_wait(StratumClass *stratum, StratumClass *other, uint32_t timeout_ms){
+    StratumClass *sessions[2] = {stratum, other};
+    uint32_t      start       = millis();
+    timeout_ms = stratum_keepalive_due(other, stratum_keepalive_due(stratum, timeout_ms));
+    while(true){
+        fd_set   readable;
+        int      max_fd = s_wake_fd.load(std::memory_order_relaxed);
+        bool     poll   = (max_fd < 0);
+        FD_ZERO(&readable);
+        if(max_fd >= 0) FD_SET(max_fd, &readable);
+        for(StratumClass *session : sessions){
+            if(session == NULL || !session->pool->is_connected()) continue;
+            if(session->available()) return;
+            int fd = session->pool->fd();
+            if(fd < 0){
+                poll = true;
+                continue;
+            }
+            FD_SET(fd, &readable);
+            max_fd = std::max(max_fd, fd);
+        }
+        uint32_t waited = millis() - start;
+        if(waited >= timeout_ms) return;
+        uint32_t slice  = poll ? std::min(timeout_ms - waited, (uint32_t)STRATUM_RX_POLL_MS) : timeout_ms - waited;
+        if(max_fd < 0){
+            delay(slice);
+            continue;
+        }
+        struct timeval tv = {(time_t)(slice / 1000), (suseconds_t)((slice % 1000) * 1000)};
+        int ready = select(max_fd + 1, &readable, NULL, NULL, &tv);
+        if(ready == 0) continue;
+        if(ready < 0){//a socket closed under us, the caller notices it on the next pass
+            delay(std::min(slice, (uint32_t)STRATUM_RX_POLL_MS));
+            return;
+        }
+        int  wake = s_wake_fd.load(std::memory_order_relaxed);
+        char drain[16];
+        if(wake >= 0 && FD_ISSET(wake, &readable)) while(recv(wake, drain, sizeof(drain), MSG_DONTWAIT) > 0);
+        return;
+    }
+}
+
+//one pool connection serviced by the stratum thread in hot standby or split mode
+typedef struct {
+    StratumClass   *stratum;
+    pool_info_t     pool;
+    stratum_info_t  info;
+    const char     *role;
+    uint8_t         weight;     //hashing share in split mode
+    uint32_t        retry_at;
+    uint32_t        ready_since;//0 while the session can not feed the asic
+    uint32_t        down_since; //0 while the session is ready
+} stratum_session_t;
+
+static bool pool_same(const pool_info_t &a, const pool_info_t &b){
+    return (a.url == b.url) && (a.port == b.port);
+}
+
+//never waits on the pool, the handshake is answered through the regular read loop
+static void stratum_session_step(stratum_session_t *session){
+    StratumClass *stratum = session->stratum;
+    uint32_t      now     = millis();
+
+    if(!stratum->pool->is_connected()){
+        if((int32_t)(now - session->retry_at) >= 0){
+            LOG_W("%s pool [%s:%d] connecting...", session->role, session->pool.url.c_str(), session->pool.port);
+            stratum->reset(session->pool, session->info);
+            stratum->pool->begin(session->pool.ssl);
+            stratum->pool->connect();
+            session->retry_at = now + 5000;
+        }
+    }else if(!stratum->is_handshake_sent()){
+        if(!stratum->handshake()) LOG_W("%s pool failed to send the handshake", session->role);
+    }else if(stratum->hello_pool(HELLO_POOL_INTERVAL_MS, POOL_INACTIVITY_TIME_MS)){
+        stratum->flush_submits();
+        while(stratum->available()){
+            if(stratum == g_nmaxe.stratum) g_nmaxe.connection.stratum_update = millis();//pool is alive
+            stratum_method_data method = stratum->listen_methods();
+            stratum_handle_method(stratum, &method);
+            stratum->flush_submits();
+        }
+    }
+
+    now = millis();
+    if(stratum->is_ready()){
+        if(session->ready_since == 0) session->ready_since = now ? now : 1;
+        session->down_since = 0;
+    }else{
+        if(session->down_since == 0) session->down_since = now ? now : 1;
+        session->ready_since = 0;
+    }
+}
+
+static void stratum_switch_to(stratum_session_t *next){
+    next->stratum->take_over(g_nmaxe.stratum);
+    g_nmaxe.stratum                = next->stratum;
+    g_nmaxe.connection.pool_use    = next->pool;
+    g_nmaxe.connection.stratum_use = next->info;
+    g_nmaxe.mstatus.diff.last      = 0;
+    //the work of the old pool is stale, the asic tx thread starts over on the ring of the new one
+    xSemaphoreGive(next->stratum->clear_job_xsem);
+    xSemaphoreGive(next->stratum->new_job_xsem);//asic tx thread
+    release_mining_threads(next->stratum);
+    LOG_W(">>>> Switched to %s pool [%s:%d] <<<<", next->role, next->pool.url.c_str(), next->pool.port);
+}
+
+//fails over as soon as the primary is gone and back once it has been steady for a while
+static void stratum_select_active(stratum_session_t *primary, stratum_session_t *fallback){
+    stratum_session_t *next = NULL;
+    uint32_t           now  = millis();
+    uint32_t           last = primary->stratum->get_last_job_ms();
+    //a primary that stopped sending jobs has waited a whole job cycle already, no grace on top
+    bool               stalled = (last != 0) && (now - last >= STRATUM_JOB_CYCLE_MS);
+    if(g_nmaxe.stratum == fallback->stratum){
+        if(primary->ready_since != 0 && now - primary->ready_since >= STRATUM_FAILBACK_HOLD_MS) next = primary;
+    }else if(primary->down_since != 0 && (stalled || now - primary->down_since >= STRATUM_FAILOVER_GRACE_MS) && fallback->ready_since != 0){
+        next = fallback;
+    }
+    if(next != NULL) stratum_switch_to(next);
+}
+
+/**
+ * @brief Weighted round robin of the asic over the ready sessions.
+ *
+ * Each ready session feeds the asic for its weight's share of
+ * STRATUM_SPLIT_PERIOD_MS, at least STRATUM_SPLIT_MIN_SLICE_MS, then the
+ * next one takes over. Switches only happen at slice ends, so there are at
+ * most two per session and period. The jobs of a waiting session keep
+ * flowing into its ring, it starts on its latest job. A session that
+ * drops out is skipped once it has been down for STRATUM_FAILOVER_GRACE_MS.
+ */
+static void stratum_select_weighted(stratum_session_t *sessions, size_t count){
+    static size_t   active      = 0;
+    static uint32_t slice_start = 0;
+    uint32_t now   = millis();
+    uint32_t total = 0;
+    if(slice_start == 0) slice_start = now;
+    for(size_t i = 0; i < count; i++){
+        if(sessions[i].ready_since != 0) total += sessions[i].weight;
+    }
+    stratum_session_t *current = &sessions[active];
+    if(current->ready_since != 0 && current->weight > 0){
+        uint32_t slice = std::max((uint32_t)((uint64_t)STRATUM_SPLIT_PERIOD_MS * current->weight / total), (uint32_t)STRATUM_SPLIT_MIN_SLICE_MS);
+        if(now - slice_start < slice) return;
+    }else if(current->down_since != 0 && now - current->down_since < STRATUM_FAILOVER_GRACE_MS){
+        return;
+    }
+
+    for(size_t k = 1; k <= count; k++){
+        size_t next = (active + k) % count;
+        if(sessions[next].ready_since == 0 || sessions[next].weight == 0) continue;
+        slice_start = now;
+        if(next == active) return;//the only one ready, a new slice of its own
+        active = next;
+        stratum_switch_to(&sessions[next]);
+        char   split[128];
+        size_t len = 0;
+        for(size_t i = 0; i < count && len < sizeof(split); i++){
+            len += snprintf(split + len, sizeof(split) - len, "%s%s %u/%u", i ? ", " : "", sessions[i].role,
+                            (unsigned)sessions[i].stratum->get_shares_accepted(), (unsigned)sessions[i].stratum->get_shares_rejected());
+        }
+        LOG_I("Split shares accepted/rejected : %s", split);
+        return;
     }
-    return rsp;
 }
 
-// ... (The stratum_thread_entry function remains unchanged) ...
 void stratum_thread_entry(void *args){
     char *name = (char*)malloc(20);
     strcpy(name, (char*)args);
     LOG_I("%s thread started on core %d...", name, xPortGetCoreID());
     free(name);
+#if STRATUM_LOG_DEFERRED
+    xTaskCreate(stratum_log_thread_entry, "stratum_log", 4096, NULL, 1, NULL);
+#endif
+#if STRATUM_CAPTURE
+    if(stratum_capture_begin(STRATUM_CAPTURE_PATH, STRATUM_CAPTURE_MAX_BYTES)){
+        xTaskCreate(stratum_capture_thread_entry, "stratum_capture", 3072, NULL, 1, NULL);
+    }
+#endif
+
+    if(s_wake_fd.load() < 0) stratum_wake_open();
+    WiFi.onEvent(stratum_on_wifi_event);//a link coming back ends the wait of the retry below
+    g_nmaxe.stratum->set_submit_callback(on_share_result, NULL);
+
+    static stratum_session_t sessions[2];
+    static const uint8_t     weights[2] = STRATUM_POOL_WEIGHTS;
+    bool split       = (weights[0] > 0) && (weights[1] > 0);
+    //the proxy hands its clients one upstream's extranonce1, so it stays on the session it started with
+    bool hot_standby = (STRATUM_HOT_STANDBY || split) && !STRATUM_PROXY_PORT && (g_nmaxe.connection.pool_fallback.url.length() > 0) &&
+                       !pool_same(g_nmaxe.connection.pool_primary, g_nmaxe.connection.pool_fallback);
+#if STRATUM_PROXY_PORT
+    stratum_proxy_begin(g_nmaxe.stratum);
+#endif
+    if(hot_standby){
+        StratumClass *fallback = new StratumClass(g_nmaxe.connection.pool_fallback, g_nmaxe.connection.stratum_fallback, g_nmaxe.stratum->get_job_cache_max());
+        //the mining threads wait on the semaphores of the session they started with
+        vSemaphoreDelete(fallback->new_job_xsem);
+        vSemaphoreDelete(fallback->clear_job_xsem);
+        fallback->new_job_xsem   = g_nmaxe.stratum->new_job_xsem;
+        fallback->clear_job_xsem = g_nmaxe.stratum->clear_job_xsem;
+        fallback->set_submit_callback(on_share_result, NULL);//answers of either pool count once they come
+        sessions[0] = {g_nmaxe.stratum, g_nmaxe.connection.pool_primary, g_nmaxe.connection.stratum_primary, "Primary", weights[0], 0, 0, millis()};
+        sessions[1] = {fallback, g_nmaxe.connection.pool_fallback, g_nmaxe.connection.stratum_fallback, "Fallback", weights[1], 0, 0, millis()};
+        g_nmaxe.connection.pool_use    = sessions[0].pool;
+        g_nmaxe.connection.stratum_use = sessions[0].info;
+        if(split) LOG_I("Splitting hashrate %d/%d with pool [%s:%d]", weights[0], weights[1], sessions[1].pool.url.c_str(), sessions[1].pool.port);
+        else      LOG_I("Hot standby on fallback pool [%s:%d]", sessions[1].pool.url.c_str(), sessions[1].pool.port);
+    }
 
-    g_nmaxe.stratum->set_pool_difficulty(DEFAULT_POOL_DIFFICULTY);
-    StaticJsonDocument<1024*4> json;
     while(true){
-        static int w_retry = 0, w_maxRetries = 24;
+        stratum_trace_report(STRATUM_TRACE_REPORT_MS);
+        static int      w_retry = 0, w_maxRetries = 24;
+        static uint32_t w_retry_ms = 0;
         if(g_nmaxe.connection.wifi.status_param.status != WL_CONNECTED){
-            w_retry++;
-            LOG_W("WiFi reconnecting %d/%d...", w_retry, w_maxRetries);
-            if(w_retry >= w_maxRetries) ESP.restart();
-            xSemaphoreGive(g_nmaxe.connection.wifi.reconnect_xsem);
-            g_nmaxe.stratum->reset();
-            delay(5000);
+            //other wakes land here too, an attempt is counted once per STRATUM_WIFI_RETRY_MS
+            if(w_retry == 0 || millis() - w_retry_ms >= STRATUM_WIFI_RETRY_MS){
+                w_retry++;
+                w_retry_ms = millis();
+                LOG_W("WiFi reconnecting %d/%d...", w_retry, w_maxRetries);
+                if(w_retry >= w_maxRetries) ESP.restart();
+                xSemaphoreGive(g_nmaxe.connection.wifi.reconnect_xsem);
+                g_nmaxe.stratum->reset();
+            }
+            stratum_wait(NULL, NULL, STRATUM_WIFI_RETRY_MS - std::min(millis() - w_retry_ms, (uint32_t)STRATUM_WIFI_RETRY_MS));
             continue;
         } else w_retry = 0;
+
+        if(hot_standby){
+            stratum_session_step(&sessions[0]);
+            stratum_session_step(&sessions[1]);
+            if(split) stratum_select_weighted(sessions, 2);
+            else      stratum_select_active(&sessions[0], &sessions[1]);
+            stratum_wait(sessions[0].stratum, sessions[1].stratum, STRATUM_IDLE_WAIT_MS);
+            continue;
+        }
         
         static uint16_t p_retry = 0, p_maxRetries = 5;
         if(!g_nmaxe.stratum->pool->is_connected()){
@@ -525,27 +1681,10 @@ void stratum_thread_entry(void *args){
             continue;
         }else p_retry = 0;
 
-        if(!g_nmaxe.stratum->is_subscribed()){
-            if(!g_nmaxe.stratum->subscribe()){
-                LOG_W("Failed to subscribe to pool, retrying in 5 seconds...");
-                delay(100);
-                continue;
-            }
-            if(!g_nmaxe.stratum->authorize()){
-                LOG_W("Failed to authorize to pool, retrying in 5 seconds...");
-                delay(100);
-                continue;
-            }
-            if(!g_nmaxe.stratum->config_version_rolling()){
-                LOG_W("Failed to config version rolling, retrying in 5 seconds...");
-                delay(100);
-                continue;
-            }
-            if(!g_nmaxe.stratum->suggest_difficulty()){
-                LOG_W("Failed to suggest difficulty to pool, retrying in 5 seconds...");
-                delay(100);
-                continue;
-            }
+        if(!g_nmaxe.stratum->is_handshake_sent() && !g_nmaxe.stratum->handshake()){
+            LOG_W("Failed to send the handshake to pool, retrying...");
+            delay(100);
+            continue;
         }
 
         if(!g_nmaxe.stratum->hello_pool(HELLO_POOL_INTERVAL_MS, POOL_INACTIVITY_TIME_MS)){
@@ -554,198 +1693,18 @@ void stratum_thread_entry(void *args){
             continue;
         }
 
-        while(g_nmaxe.stratum->pool->available()){
+#if STRATUM_PROXY_PORT
+        stratum_proxy_poll();
+#endif
+        g_nmaxe.stratum->flush_submits();
+        while(g_nmaxe.stratum->available()){
             g_nmaxe.connection.stratum_update = millis();//pool is alive
             stratum_method_data method = g_nmaxe.stratum->listen_methods();
-            switch (method.type){
-                case STRATUM_DOWN_PARSE_ERROR:   
-                    LOG_E("Stratum parse error, id : %d, raw : %s", method.id, method.raw.c_str());
-                    break;
-                case STRATUM_DOWN_NOTIFY:{
-                        LOG_D("Stratum notify, id : %d => %s", method.id, method.raw.c_str());
-                        pool_job_data_t job;
-                        json.clear();
-                        DeserializationError error = deserializeJson(json, method.raw);
-                        if (error) {
-                            LOG_E("Failed to parse JSON: %s", error.c_str());
-                            break;
-                        }
-                        job.id = String((const char*) json["params"][0]);
-                        job.prevhash = String((const char*) json["params"][1]);
-                        job.coinb1 = String((const char*) json["params"][2]);
-                        job.coinb2 = String((const char*) json["params"][3]);
-                        job.merkle_branch = json["params"][4];
-                        job.version = String((const char*) json["params"][5]);
-                        job.nbits = String((const char*) json["params"][6]);
-                        job.ntime = String((const char*) json["params"][7]);
-                        job.clean_jobs = json["params"][8]; 
-
-                        LOG_D("Job ID            : %s", job.id.c_str());
-                        LOG_D("Prevhash          : %s", job.prevhash.c_str());
-                        LOG_D("Coinb1            : %s", job.coinb1.c_str());
-                        LOG_D("Coinb2            : %s", job.coinb2.c_str());
-                        for(int i = 0; i < job.merkle_branch.size(); i++){
-                            LOG_D("Merkle branch[%02d] : %s", i, job.merkle_branch[i].as<String>().c_str());
-                        }
-                        LOG_D("Version           : %s", job.version.c_str());
-                        LOG_D("Nbits             : %s", job.nbits.c_str());
-                        LOG_D("Ntime             : %s", job.ntime.c_str());
-                        LOG_D("Clean jobs        : %s", job.clean_jobs ? "true" : "false");
-                        LOG_D("Stamp             : %lu", job.stamp);
-                        LOG_D("Version mask      : 0x%08x", g_nmaxe.stratum->get_version_mask());
-                        LOG_D("Pool difficulty   : %s", formatNumber(g_nmaxe.stratum->get_pool_difficulty(), 5).c_str());
-                        if(job.clean_jobs){
-                            g_nmaxe.stratum->clear_job_cache();
-                            xSemaphoreGive(g_nmaxe.stratum->clear_job_xsem);
-                        }
-                        size_t cached_size = g_nmaxe.stratum->push_job_cache(job);
-                        
-                        //Give the new job semaphore to the other threads
-                        xSemaphoreGive(g_nmaxe.stratum->new_job_xsem);//asic tx thread
-                        static bool first_job = true;
-                        if(first_job){
-                            //first job will release the asic rx , monitor and ui thread
-                            xSemaphoreGive(g_nmaxe.stratum->new_job_xsem);//asic tx thread
-                            xSemaphoreGive(g_nmaxe.stratum->new_job_xsem);//asic rx thread
-                            xSemaphoreGive(g_nmaxe.stratum->new_job_xsem);//ui thread
-                            xSemaphoreGive(g_nmaxe.stratum->new_job_xsem);//monitor thread
-                            first_job = false;
-                        }
-                    }         
-                    break;
-                case STRATUM_DOWN_SET_DIFFICULTY: {
-                    LOG_D("Stratum set difficulty, id : %d => %s", method.id, method.raw.c_str());
-                    json.clear();
-                    DeserializationError error = deserializeJson(json, method.raw);
-                    if(error){
-                        LOG_E("Failed to parse JSON: %s", error.c_str());
-                        break;
-                    }
-                    if(json["method"] == "mining.set_difficulty"){
-                        if(json["params"].size() > 0){
-                            g_nmaxe.stratum->set_pool_difficulty(json["params"][0]);
-                            LOG_D("Pool difficulty set : %s", formatNumber(json["params"][0], 5).c_str());
-                        }else{
-                            LOG_W("Pool difficulty not found in params");
-                        }
-                    }
-                }
-                    break;
-                case STRATUM_DOWN_SET_VERSION_MASK:{
-                    LOG_D("Stratum set version mask , id : %d => %s", method.id, method.raw.c_str());
-                    g_nmaxe.stratum->set_msg_rsp_map(method.id, true);
-                    json.clear();
-                    DeserializationError error = deserializeJson(json, method.raw);
-                    if (error) {
-                        LOG_E("Failed to parse JSON: %s", error.c_str());
-                        break;
-                    }
-                    if(json["method"] == "mining.set_version_mask"){
-                        if(json["params"].size() > 0){
-                            g_nmaxe.stratum->set_version_mask(strtoul(json["params"][0].as<const char*>(), NULL, 16));
-                            LOG_L("Version mask set to %s", json["params"][0].as<const char*>());
-                        }else{
-                            g_nmaxe.stratum->set_version_mask(0xffffffff);
-                            LOG_W("Version mask not found in params");
-                        }
-                    }else{
-                        g_nmaxe.stratum->set_version_mask(0xffffffff);
-                        LOG_W("Version rolling key not found in response");
-                    }
-                    g_nmaxe.stratum->del_msg_rsp_map(method.id);
-                }
-                    break;
-                case STRATUM_DOWN_SET_EXTRANONCE:{
-                        LOG_L("Stratum set extranonce => %s", method.id, method.raw.c_str());
-                        json.clear();
-                        DeserializationError error = deserializeJson(json, method.raw);
-                        if (error) {
-                            LOG_E("Failed to parse JSON: %s", error.c_str());
-                            break;
-                        }
-                        g_nmaxe.stratum->set_sub_extranonce1(json["params"][0]);
-                        g_nmaxe.stratum->set_sub_extranonce2_size(json["params"][1]);
-                    }
-                    break;
-                case STRATUM_DOWN_SUCCESS: 
-                    if(method.id != -1){
-                        g_nmaxe.stratum->set_msg_rsp_map(method.id, true);
-                        stratum_rsp rsp = g_nmaxe.stratum->get_method_rsp_by_id(method.id);
-                        if(rsp.method == "mining.submit"){
-                            uint32_t latency = millis() - rsp.stamp;
-                            if (rsp.status == true){
-                                g_nmaxe.mstatus.share_accepted++;
-                                LOG_L("#%d share accepted, %ldms", g_nmaxe.mstatus.share_accepted + g_nmaxe.mstatus.share_rejected, latency);      
-                            }
-                            else {
-                                g_nmaxe.mstatus.share_rejected++;
-                                LOG_E("#%d share rejected, %ldms", g_nmaxe.mstatus.share_accepted + g_nmaxe.mstatus.share_rejected, latency);
-                            }
-                        }
-                        else if(rsp.method == "mining.configure"){
-                            json.clear();
-                            DeserializationError error = deserializeJson(json, method.raw);
-                            if (error) {
-                                LOG_E("Failed to parse JSON: %s", error.c_str());
-                            } else {
-                                g_nmaxe.stratum->set_version_mask(0xffffffff);
-                                if (json["result"]["version-rolling"] == true) {
-                                    if (json["result"].containsKey("version-rolling.mask")) {
-                                        g_nmaxe.stratum->set_version_mask(strtoul(json["result"]["version-rolling.mask"].as<const char*>(), NULL, 16));
-                                        LOG_I("Version mask set to %s", json["result"]["version-rolling.mask"].as<const char*>());
-                                    } else {
-                                        LOG_W("Version mask not found in response");
-                                    }
-                                } else {
-                                    LOG_W("Version rolling not supported");
-                                }
-                            }
-                        }
-                        else if(rsp.method == "mining.authorize"){
-                            DeserializationError error = deserializeJson(json, method.raw);
-                            if (error) {
-                                LOG_E("Failed to parse JSON: %s", error.c_str());
-                            }
-                            else{
-                                if(json.containsKey("result")){
-                                    g_nmaxe.stratum->set_authorize(json["result"]);
-                                    LOG_W("Authorization %s ", json["result"] ? "success" : "failed");
-                                }
-                            }
-                        }
-                        else{
-                            LOG_D("Stratum success, id : %d => %s", method.id, method.raw.c_str());
-                        }
-                    }
-                    break;
-                case STRATUM_DOWN_ERROR: 
-                    if(method.id != -1){
-                        g_nmaxe.stratum->set_msg_rsp_map(method.id, true);
-                        stratum_rsp rsp = g_nmaxe.stratum->get_method_rsp_by_id(method.id);
-                        if(rsp.method == "mining.submit"){
-                            uint32_t latency = millis() - rsp.stamp;
-                            g_nmaxe.mstatus.share_rejected++;
-                            LOG_E("#%d share rejected, %ldms", g_nmaxe.mstatus.share_accepted + g_nmaxe.mstatus.share_rejected, latency);
-                        }
-                        else if(rsp.method == "mining.authorize"){
-                            g_nmaxe.stratum->set_authorize(false);
-                            LOG_E("Authorization failed, id %d => %s", method.id, method.raw.c_str());
-                        }
-                        else{
-                            LOG_E("Unknown error response, id : %d => %s", method.id, method.raw.c_str());
-                        }
-                    }
-                    break;
-                case STRATUM_DOWN_UNKNOWN:                   
-                    LOG_E("Stratum unknown, id : %d => %s", method.id, method.raw.c_str());
-                    break;
-                default :
-                    LOG_E("Stratum unknown, id : %d => %s", method.id, method.raw.c_str());
-                    break;
-            }
-            delay(5);
+            stratum_handle_method(g_nmaxe.stratum, &method);
+            g_nmaxe.stratum->flush_submits();
         }
-        delay(50);
+        //proxy clients are polled by this loop, their lines have no wake either
+        stratum_wait(g_nmaxe.stratum, NULL, STRATUM_PROXY_PORT ? STRATUM_RX_POLL_MS : STRATUM_IDLE_WAIT_MS);
     }
 }
 
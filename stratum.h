@@ -1,21 +1,66 @@
 #ifndef STRATUM_H_
 #define STRATUM_H_
 #include <WiFi.h>
-#include <ArduinoJson.h>
 #include <WiFiClientSecure.h>
-#include <map>
 #include <vector>
-#include <deque>
+#include <atomic>
 #include "helper.h"
 #include "pool.h"   
+#include "stratum_parser.h"
+#include "stratum_trace.h"
+#include "stratum_encoder.h"
+#include "stratum_resume.h"
 
 #define  DEFAULT_POOL_DIFFICULTY   (512)
 #define  HELLO_POOL_INTERVAL_MS    (1000*30)
 #define  LOST_POOL_TIMEOUT_MS      (1000*60*5)
 #define  SUBMIT_TIMEOUT_MS         (1000*60*2)
+#define  STRATUM_HANDSHAKE_TIMEOUT_MS (1000*10) //sent handshake to subscribe response
+#define  STRATUM_RX_POLL_MS        (10)     //wait slice when a socket can not be selected on, and the proxy client poll
+#define  STRATUM_IDLE_WAIT_MS      (1000)   //longest wait without an event, bounds the failover timers
+#define  STRATUM_WIFI_RETRY_MS     (5000)   //between Wi-Fi reconnect attempts
+#define  STRATUM_MAX_MERKLE_BRANCH (32)
+#define  STRATUM_JOB_ID_MAX        (64)
+#define  STRATUM_SUBMIT_QUEUE_LEN  (16)
+#define  STRATUM_RSP_TABLE_SIZE    (32) //in-flight requests, power of two
+#define  STRATUM_JOB_RING_SIZE     (8)  //job handoff ring, power of two
+#define  STRATUM_JOB_HEADERS       (64) //job headers kept in internal RAM, more spill to the heap
+#define  STRATUM_ASIC_JOB_IDS      (128)        //asic job id space, power of two
+#define  STRATUM_WORK_EXPIRE_MS    (1000*60*10) //dispatched work older than this is not resolved any more
+#ifndef  STRATUM_HOT_STANDBY
+#define  STRATUM_HOT_STANDBY       (0)  //1 keeps the fallback pool subscribed next to the primary one
+#endif
+#define  STRATUM_JOB_CYCLE_MS      (1000*60)    //longest gap between two jobs of a healthy pool, a session quiet for longer is not ready
+#define  STRATUM_FAILOVER_GRACE_MS (1000*5)
+#define  STRATUM_FAILBACK_HOLD_MS  (1000*30)
+#ifndef  STRATUM_POOL_WEIGHTS
+#define  STRATUM_POOL_WEIGHTS      {100, 0}     //hashing share of the primary and fallback pool, a 0 fallback only takes over on failure
+#endif
+#define  STRATUM_SPLIT_PERIOD_MS   (1000*60)    //every weighted pool gets its slice once per period...
+#define  STRATUM_SPLIT_MIN_SLICE_MS (1000*5)    //...and never less than this, bounds the job switches
+
+#define  STRATUM_V2_SCHEME         "stratum2+tcp://"
+#ifndef  STRATUM_V2
+#define  STRATUM_V2                (0)  //1 speaks v2 to STRATUM_V2_SCHEME pools: plaintext frames, extended channel, no noise handshake
+#endif
+
+#ifndef  STRATUM_SHARE_INTERVAL_MS
+#define  STRATUM_SHARE_INTERVAL_MS (1000*10)    //share interval the suggested difficulty aims at
+#endif
+#define  STRATUM_DIFF_MIN          (1)
+#define  STRATUM_DIFF_MAX          (4294967296.0)
+#define  STRATUM_DIFF_HYSTERESIS   (2.0)        //re-suggest once the ideal difficulty leaves [d/h, d*h]
+#define  STRATUM_DIFF_MIN_SHARES   (16)         //accepted shares that close an estimate window...
+#define  STRATUM_DIFF_WINDOW_MS    (1000*60*10) //...or the time it is closed after
+#define  STRATUM_DIFF_HOLD_MS      (1000*60*5)  //least time between two suggestions
 
 typedef uint32_t stratum_msg_rsp_id_t;
 
+typedef enum {
+    STRATUM_PROTOCOL_V1,        //line delimited json
+    STRATUM_PROTOCOL_V2         //binary frames, picked by the STRATUM_V2_SCHEME url prefix in a STRATUM_V2 build
+} stratum_protocol_t;
+
 typedef enum {
     STRATUM_DOWN_SUCCESS,
     STRATUM_DOWN_NOTIFY,
@@ -24,13 +69,34 @@ typedef enum {
     STRATUM_DOWN_SET_EXTRANONCE,
     STRATUM_DOWN_UNKNOWN,
     STRATUM_DOWN_ERROR,
-    STRATUM_DOWN_PARSE_ERROR
+    STRATUM_DOWN_PARSE_ERROR,
+    STRATUM_DOWN_JOB,           //ready made job, stratum v2
+    STRATUM_DOWN_NONE           //no complete message received yet
 } stratum_method_down;
 
+//v1 connection setup, driven by handshake() and the subscribe response
+typedef enum {
+    STRATUM_HANDSHAKE_IDLE,     //nothing sent on this connection yet
+    STRATUM_HANDSHAKE_SENT,     //configure, subscribe, authorize and suggest_difficulty written, waiting for subscribe
+    STRATUM_HANDSHAKE_DONE      //subscribed, the other responses are handled as they come
+} stratum_handshake_t;
+
+typedef enum {
+    STRATUM_UP_NONE,
+    STRATUM_UP_SUBSCRIBE,
+    STRATUM_UP_AUTHORIZE,
+    STRATUM_UP_CONFIGURE,
+    STRATUM_UP_SUGGEST_DIFFICULTY,
+    STRATUM_UP_SUBMIT,
+    STRATUM_UP_MAX
+} stratum_method_up;
+
 typedef struct{
-    String   method;
-    bool     status;
-    uint32_t stamp;
+    stratum_msg_rsp_id_t id;
+    stratum_method_up    method;
+    bool                 status;
+    uint32_t             stamp;
+    uint32_t             tag;       //submit tag, handed back with the result
 }stratum_rsp;
 
 typedef struct{
@@ -38,127 +104,351 @@ typedef struct{
     String      pwd;
 }stratum_info_t;
 
+//share waiting in the submit queue, written by the stratum thread
 typedef struct {
-    int32_t                  id;
-    stratum_method_down      type;
-    String                   name;
-    String                   raw;
-} stratum_method_data;
+    char        job_id[STRATUM_JOB_ID_MAX + 1];
+    char        extranonce2[2 * 8 + 1];
+    uint32_t    ntime;
+    uint32_t    nonce;
+    uint32_t    version;
+    uint32_t    stamp;
+    uint32_t    tag;            //set by the submitter, 0 for the shares of this unit
+} stratum_share_t;
 
+//what a nonce coming back from the asic needs to become a share
 typedef struct {
-    String id;
-    String prevhash;
-    String coinb1;
-    String coinb2;
-    String nbits;
-    JsonArray merkle_branch;
-    String version;
-    String ntime;
-    bool clean_jobs;
+    char        job_id[STRATUM_JOB_ID_MAX + 1];
+    char        extranonce2[2 * 8 + 1];
+    uint32_t    ntime;
+    uint32_t    version;        //header version handed to the asic
+    uint32_t    generation;     //job generation the work was built in
+    uint32_t    stamp;          //dispatched at, ms
+} stratum_asic_work_t;
+
+typedef enum {
+    STRATUM_WORK_LIVE,
+    STRATUM_WORK_STALE,         //flushed by clean_jobs since it was dispatched
+    STRATUM_WORK_EXPIRED,       //dispatched more than STRATUM_WORK_EXPIRE_MS ago
+    STRATUM_WORK_UNKNOWN        //nothing dispatched under that asic job id
+} stratum_work_lookup_t;
+
+//outcome of the local check flush_submits() runs before a share hits the socket
+typedef enum {
+    STRATUM_SHARE_VALID,
+    STRATUM_SHARE_STALE,            //job unknown or flushed by clean_jobs
+    STRATUM_SHARE_LOW_DIFFICULTY,   //header hash above the pool target
+    STRATUM_SHARE_MALFORMED,        //extranonce2 does not fit the subscription
+    STRATUM_SHARE_VERDICT_MAX
+} stratum_share_verdict_t;
+
+typedef struct {
+    stratum_msg_rsp_id_t    id;
+    bool                    accepted;
+    uint32_t                latency;    //ms from write to pool response
+    stratum_str_t           error;      //valid only during the callback
+    uint32_t                tag;        //the tag the share was submitted with
+    bool                    local;      //never answered by the pool, dropped by the local check, not sent or lost with the connection
+} stratum_submit_result_t;
+
+typedef void (*stratum_submit_cb_t)(const stratum_submit_result_t *result, void *arg);
+
+//mining.notify params, sliced straight out of the received line
+typedef struct {
+    stratum_str_t   job_id;
+    stratum_str_t   prevhash;
+    stratum_str_t   coinb1;
+    stratum_str_t   coinb2;
+    stratum_str_t   merkle_branch[STRATUM_MAX_MERKLE_BRANCH];
+    uint8_t         merkle_count;
+    stratum_str_t   version;
+    stratum_str_t   nbits;
+    stratum_str_t   ntime;
+    bool            clean_jobs;
+} stratum_notify_t;
+
+/**
+ * @brief Binary mining job, decoded once from mining.notify or a
+ * Stratum V2 NewExtendedMiningJob.
+ *
+ * The header comes from a fixed set of slots in internal RAM, its variable
+ * part from the job arena (PSRAM), data points to it:
+ *   job id (NUL terminated) | coinb1 | coinb2 | merkle_branch[merkle_count][32]
+ * prevhash and the merkle branch keep the byte order they have on the wire.
+ * A notify with a malformed field yields no job at all. Whoever holds the
+ * pointer owns it, the job cache until pop_job_cache() hands it over, and
+ * releases it with stratum_job_free().
+ */
+typedef struct {
+    uint8_t     prevhash[32];
+    uint32_t    version;
+    uint32_t    nbits;
+    uint32_t    ntime;
+    uint16_t    coinb1_len;
+    uint16_t    coinb2_len;
+    uint8_t     id_len;
+    uint8_t     merkle_count;
+    bool        clean_jobs;
+    uint32_t    generation;         //job generation it was published in
+    stratum_job_trace_t trace;
+    uint8_t    *data;
+
+    const char    *id() const            { return (const char*)this->data; }
+    const uint8_t *coinb1() const        { return this->data + this->id_len + 1; }
+    const uint8_t *coinb2() const        { return this->coinb1() + this->coinb1_len; }
+    const uint8_t *merkle(uint8_t i) const { return this->coinb2() + this->coinb2_len + 32 * i; }
 }pool_job_data_t;
 
+pool_job_data_t *stratum_job_create(const stratum_notify_t *notify);
+pool_job_data_t *stratum_job_clone(const pool_job_data_t *job);
+pool_job_data_t *stratum_job_alloc(const char *id, size_t id_len, size_t coinb1_len, size_t coinb2_len, uint8_t merkle_count);
+void             stratum_job_free(pool_job_data_t *job);
+void             stratum_job_dispatched(pool_job_data_t *job);
+
+//typed downstream message, decoded once by listen_methods()
+typedef struct {
+    int32_t                  id;
+    stratum_method_down      type;
+    const char              *name;
+    stratum_str_t            raw;
+    stratum_notify_t         notify;            //STRATUM_DOWN_NOTIFY
+    pool_job_data_t         *job;               //STRATUM_DOWN_JOB, owned by whoever handles the message
+    double                   difficulty;        //STRATUM_DOWN_SET_DIFFICULTY
+    bool                     has_version_mask;  //STRATUM_DOWN_SET_VERSION_MASK, mining.configure result
+    uint32_t                 version_mask;
+    bool                     version_rolling;   //mining.configure result
+    stratum_str_t            extranonce1;       //STRATUM_DOWN_SET_EXTRANONCE, mining.subscribe result
+    int                      extranonce2_size;
+    bool                     subscribed;        //mining.subscribe result
+    stratum_str_t            session_id;
+    bool                     has_result;        //STRATUM_DOWN_SUCCESS
+    bool                     result;
+    bool                     batch;             //acknowledges every submit up to id, stratum v2
+    stratum_str_t            error;             //STRATUM_DOWN_ERROR
+    stratum_job_trace_t      trace;             //receive stamps, handed on to the job
+} stratum_method_data;
+
 typedef struct {
     String extranonce1;
-    String extranonce2;
+    uint64_t extranonce2;
     int extranonce2_size;
 } stratum_subscribe_info_t;
 
+//one reservation out of a worker's slice of the (extranonce2 x version bits x nonce) space
+typedef struct {
+    uint64_t    extranonce2;
+    uint32_t    version_bits;   //rolled bits, already placed under the version mask
+    uint32_t    nonce;          //first nonce of the block
+    uint32_t    count;          //nonces in the block
+} stratum_nonce_work_t;
+
+typedef struct {
+    uint64_t    hashes;             //nonces handed out since configure_nonce_ranges()
+    uint32_t    slices;             //nonce slices fully covered
+    uint32_t    extranonce2_rolls;
+} stratum_nonce_coverage_t;
+
+//picks the protocol from the url scheme and strips the scheme off the url
+stratum_protocol_t stratum_pool_protocol(pool_info_t *info);
+
+class StratumDiffController;
+class StratumShareValidator;
+class StratumWorkRegistry;
+struct stratum_v2_session_t;
+struct stratum_v2_frame_t;
+
 class StratumClass{
 private:
-// Add these to your existing StratumClass private section:
-private:
-    String _current_prevhash;
-    uint32_t _base_nonce;
-    std::vector<uint32_t> _probe_iterations;
-
+    //a worker owns the nonces [start, end] for every (extranonce2, version) pair
     struct nonce_range_t {
         uint32_t start;
         uint32_t end;
-        uint32_t current;
+        uint64_t current;
         uint32_t worker_id;
+        uint32_t epoch;
+        uint32_t version_mask;
+        uint32_t version_index;
+        uint64_t extranonce2;
+        uint64_t extranonce2_mask;
+        stratum_nonce_coverage_t coverage;
     };
     uint32_t _total_workers = 1;
+    std::vector<nonce_range_t>                      _nonce_ranges;
+    std::atomic<uint32_t>                           _nonce_epoch;//bumped per job, ranges restart lazily
+    std::atomic<int>                                _work_en2_size;//extranonce2 size the workers roll, published with the epoch
+    void                                            _restart_nonce_range(nonce_range_t *range, uint32_t epoch);
 
     stratum_info_t                                  _stratum_info;
     bool                                            _is_subscribed;
     bool                                            _is_authorized;
+    stratum_handshake_t                             _handshake;
+    uint32_t                                        _handshake_ms;
+    bool                                            _handshake_resume;//the subscribe offered the stored session id
+    bool                                            _decode_subscribe(int result, stratum_method_data *method);
     uint32_t                                        _gid;
     uint32_t                                        _get_msg_id();
     String                                          _rsp_str;
-    bool                                            _parse_rsp();
-    bool                                            _clear_rsp_id_cache();
+    StratumParser                                   _parser;
+    bool                                            _decode_notify(int params, stratum_notify_t *notify);
+    stratum_rsp*                                    _track_rsp(stratum_msg_rsp_id_t id, stratum_method_up method, uint32_t now);
+    stratum_rsp*                                    _find_rsp(uint32_t id);
+    void                                            _clear_rsp_table();
+    void                                            _fail_inflight();
     bool                                            _suggest_diff_support;
-    uint32_t                                        _vr_mask;//version rolling mask
+    StratumDiffController                          *_diff_ctl;//created with the session
+    bool                                            _send_suggest_difficulty();
+    std::atomic<uint32_t>                           _vr_mask;//version rolling mask, the workers and the asic threads read it
     double                                          _pool_difficulty;
-    StaticJsonDocument<4096>                        _rsp_json;
     stratum_subscribe_info_t                        _sub_info;
-    uint32_t                                        _max_rsp_id_cache;
     uint8_t                                         _pool_job_cache_size;
-    std::deque<pool_job_data_t>                     _pool_job_cache;
-    std::map<stratum_msg_rsp_id_t, stratum_rsp>     _msg_rsp_map;
+    uint32_t                                        _last_job_ms;//0 until the session got its first job
+    uint32_t                                        _lost_ms;//live session dropped at, 0 once jobs flow again
+    //single producer (stratum thread) / single consumer (asic tx thread) job ring
+    std::atomic<pool_job_data_t*>                   _job_ring[STRATUM_JOB_RING_SIZE];
+    std::atomic<uint32_t>                           _job_head;
+    std::atomic<uint32_t>                           _job_tail;
+    std::atomic<uint32_t>                           _job_generation;
+    std::atomic<uint32_t>                           _clean_generation;//bumped by clear_job_cache() only, dispatched work older than it is stale
+    pool_job_data_t                                *_take_job(uint32_t head);
+    stratum_rsp                                     _rsp_table[STRATUM_RSP_TABLE_SIZE];
+    uint32_t                                        _submit_pending;
+    uint32_t                                        _submit_timeouts;
+    uint32_t                                        _shares_accepted;
+    uint32_t                                        _shares_rejected;
+    uint32_t                                        _submit_wait_since;//oldest unanswered submit since the last submit response
+    QueueHandle_t                                   _submit_queue;
+    stratum_submit_cb_t                             _submit_cb;
+    void                                           *_submit_cb_arg;
+    StratumShareValidator                          *_share_validator;//created with the first job
+    std::atomic<StratumWorkRegistry*>               _work_registry;//created by the first register_work()
+    bool                                            _share_check;
+    uint32_t                                        _share_drops[STRATUM_SHARE_VERDICT_MAX];
+    stratum_share_verdict_t                         _check_share(const stratum_share_t *share);
+    void                                            _resolve_submit_slot(stratum_rsp *rsp, bool accepted, stratum_str_t error, uint32_t now);
+    void                                            _complete_failed(stratum_msg_rsp_id_t id, uint32_t tag, const char *error);
+    size_t                                          _send_submits(const uint8_t *data, size_t len, const stratum_msg_rsp_id_t *ids, const uint32_t *tags, size_t count);
+    stratum_protocol_t                              _protocol;
+    pool_info_t                                     _pool_info;//url without the scheme
+    stratum_v2_session_t                           *_v2;//created by the first v2 subscribe
+    bool                                            _v2_frame(stratum_v2_frame_t *frame);
+    bool                                            _v2_wait(uint8_t type, uint8_t error_type, stratum_v2_frame_t *frame, uint32_t timeout_ms);
+    void                                            _v2_clear();
+    bool                                            _v2_subscribe();
+    bool                                            _v2_update_channel();
+    size_t                                          _v2_encode_submit(const stratum_share_t *share, stratum_msg_rsp_id_t seq, uint8_t *out, size_t cap);
+    stratum_method_data                             _v2_listen();
+    size_t                                          _pool_write(const uint8_t *data, size_t len, bool capture = true);
+    StratumEncoder                                  _encoder;//every v1 request is built here
+    bool                                            _send_request(size_t len);
+    stratum_resume_t                                _resume;//the live session, what a reconnect offers
+    stratum_resume_t                                _resume_saved;//mirror of the NVS record of this pool
+    uint32_t                                        _resume_dirty_ms;//first change not yet on flash, 0 when in sync
+    char                                            _resume_key[16];
+    bool                                            _resumed;//the pool took the stored session back
+    void                                            _resume_load();
+    bool                                            _can_resume();
+    void                                            _drop_session_work();
 public:
 
     // Nonce range management methods
     void configure_nonce_ranges(uint32_t num_workers);
     uint32_t get_next_nonce(uint32_t worker_id);
+    bool next_nonce_work(uint32_t worker_id, stratum_nonce_work_t *work, uint32_t count);
     bool reset_nonce_range(uint32_t worker_id);
     void reset_all_nonce_ranges();
     uint32_t get_nonce_range_progress(uint32_t worker_id);
-    bool submit_with_worker(String pool_job_id, String extranonce2, uint32_t ntime, uint32_t worker_id, uint32_t version);
+    bool get_nonce_coverage(uint32_t worker_id, stratum_nonce_coverage_t *coverage);
+    bool submit_with_worker(String pool_job_id, String extranonce2, uint32_t ntime, uint32_t nonce, uint32_t worker_id, uint32_t version);
     PoolClass  *pool;
     SemaphoreHandle_t new_job_xsem, clear_job_xsem;
 
     StratumClass(){};
-    StratumClass(pool_info_t pConfig, stratum_info_t sConfig, uint8_t job_cached_max): 
-     _stratum_info(sConfig), _pool_job_cache_size(job_cached_max){
-        this->pool = new PoolClass(pConfig);
-        this->_max_rsp_id_cache = 20;
-        this->_pool_difficulty = DEFAULT_POOL_DIFFICULTY;
-        this->_gid = 1;
-        this->_rsp_str = "";
-        this->_vr_mask = 0xffffffff;
-        this->_rsp_json.clear();
-        this->_sub_info = {"", "", 0};
-        this->_msg_rsp_map.clear();
-        this->_suggest_diff_support = true;
-        this->_is_subscribed = false;
-        this->_is_authorized = false;
-        this->new_job_xsem   = xSemaphoreCreateCounting(5,0);
-        this->clear_job_xsem = xSemaphoreCreateCounting(1,0);
-    };
+    StratumClass(pool_info_t pConfig, stratum_info_t sConfig, uint8_t job_cached_max);
     ~StratumClass();
 
     void reset();
     void reset(pool_info_t pConfig, stratum_info_t sConfig);
-    bool subscribe();
-    bool authorize();
-    bool suggest_difficulty();
-    bool config_version_rolling();
-    bool submit(String pool_job_id, String extranonce2, uint32_t ntime, uint32_t nonce, uint32_t version);
+    bool handshake();
+    bool resolve_subscribe(const stratum_method_data *method);
+    bool is_handshake_sent(){
+        return this->_handshake != STRATUM_HANDSHAKE_IDLE;
+    }
+    bool register_work(uint8_t asic_job_id, const pool_job_data_t *job, const char *extranonce2, uint32_t ntime, uint32_t version);
+    stratum_work_lookup_t resolve_work(uint8_t asic_job_id, stratum_asic_work_t *work);
+    bool submit_work(uint8_t asic_job_id, uint32_t nonce, uint32_t version);
+    bool submit(const char *pool_job_id, const char *extranonce2, uint32_t ntime, uint32_t nonce, uint32_t version, uint32_t tag = 0);
+    bool submit(const String &pool_job_id, const String &extranonce2, uint32_t ntime, uint32_t nonce, uint32_t version){
+        return this->submit(pool_job_id.c_str(), extranonce2.c_str(), ntime, nonce, version);
+    }
+    size_t flush_submits();
+    bool resolve_submit(const stratum_method_data *method);
+    void set_submit_callback(stratum_submit_cb_t cb, void *arg);
+    stratum_submit_cb_t get_submit_callback(void **arg){
+        if(arg != NULL) *arg = this->_submit_cb_arg;
+        return this->_submit_cb;
+    }
     bool hello_pool(uint32_t hello_interval, uint32_t lost_max_time);
     stratum_method_data listen_methods();
-    // NEW: Symmetrical nonce exclusion methods
-    void generate_symmetrical_exclusion_list();
-    bool is_binary_palindrome(uint32_t n);
-    bool is_symmetrical_nonce(uint32_t nonce);
-    void set_symmetrical_exclusion(bool enabled);
-    void get_symmetrical_exclusion_stats();
-    size_t push_job_cache(pool_job_data_t job);
-    pool_job_data_t pop_job_cache();
+    bool available();
+    stratum_protocol_t get_protocol(){
+        return this->_protocol;
+    }
+    //takes ownership of job, the oldest job is freed when the ring is full
+    size_t push_job_cache(pool_job_data_t *job);
+    //hands the oldest job over to the caller, who releases it with stratum_job_free(), NULL when empty
+    pool_job_data_t *pop_job_cache();
 
     size_t get_job_cache_size();
     size_t clear_job_cache();
+    uint8_t get_job_cache_max(){
+        return this->_pool_job_cache_size;
+    }
+    uint32_t get_last_job_ms(){
+        return this->_last_job_ms;
+    }
+    //connected, authorized and fed with a job within the last job cycle
+    bool is_ready(){
+        return this->pool->is_connected() && this->_is_subscribed && this->_is_authorized && (this->_last_job_ms != 0) &&
+               (millis() - this->_last_job_ms < STRATUM_JOB_CYCLE_MS);
+    }
+    void take_over(StratumClass *from);
+    //bumped on every clean_jobs flush and pool take over, the asic tx thread drops jobs of an older generation
+    uint32_t get_job_generation(){
+        return this->_job_generation.load(std::memory_order_acquire);
+    }
     
     stratum_rsp get_method_rsp_by_id(uint32_t id);
     bool set_msg_rsp_map(uint32_t id, bool status);
     bool del_msg_rsp_map(uint32_t id);
     bool is_submit_timeout();
+    uint32_t get_submit_timeout_count(){
+        return this->_submit_timeouts;
+    }
+    //shares this session got answered, whichever session was feeding the asic
+    uint32_t get_shares_accepted(){
+        return this->_shares_accepted;
+    }
+    uint32_t get_shares_rejected(){
+        return this->_shares_rejected;
+    }
+    //shares are hashed locally and dropped unless they meet the pool target
+    void set_share_check(bool enable){
+        this->_share_check = enable;
+    }
+    uint32_t get_share_drop_count(stratum_share_verdict_t verdict){
+        return (verdict < STRATUM_SHARE_VERDICT_MAX) ? this->_share_drops[verdict] : 0;
+    }
 
     void   set_sub_extranonce1(String extranonce1);
     void   set_sub_extranonce2_size(int size);
     String get_sub_extranonce1();
+    int    get_sub_extranonce2_size();
     String get_sub_extranonce2();
     bool   clear_sub_extranonce2();
+    bool   save_session();
+    bool   flush_session(bool force);
+    bool   is_resumed(){
+        return this->_resumed;
+    }
 
 
 
@@ -186,7 +476,19 @@ public:
     double get_pool_difficulty(){
         return this->_pool_difficulty;
     }
+    double get_suggested_difficulty();
+    double get_estimated_hashrate();
+    void set_share_interval(uint32_t interval_ms);
+    void set_suggest_diff_support(bool support){
+        this->_suggest_diff_support = support;
+    }
+    bool get_suggest_diff_support(){
+        return this->_suggest_diff_support;
+    }
 };
 
+void stratum_handle_method(StratumClass *stratum, const stratum_method_data *method);
+bool stratum_submit_asic_result(uint8_t asic_job_id, uint32_t nonce, uint32_t version);
+void stratum_wake();
 void stratum_thread_entry(void *args);
 #endif
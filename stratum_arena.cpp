@@ -0,0 +1,92 @@
+#include "stratum_arena.h"
+#include "stratum_log.h"
+
+typedef struct {
+    uint8_t                *base;
+    size_t                  used;   //stratum thread only
+    std::atomic<uint32_t>   refs;   //live allocations, +1 while it is the current block
+} arena_block_t;
+
+static arena_block_t          s_blocks[STRATUM_ARENA_BLOCKS];
+static int                    s_current = -1;
+static bool                   s_ready   = false;
+static std::atomic<uint32_t>  s_fallbacks(0);
+
+static void arena_init(){
+    for(auto &block : s_blocks){
+#ifdef BOARD_HAS_PSRAM
+        block.base = (uint8_t*)ps_malloc(STRATUM_ARENA_BLOCK_SIZE);
+#else
+        block.base = (uint8_t*)malloc(STRATUM_ARENA_BLOCK_SIZE);
+#endif
+        block.used = 0;
+        block.refs.store(0, std::memory_order_relaxed);
+        if(block.base == NULL) LOG_W("No memory for a %d byte stratum arena block", STRATUM_ARENA_BLOCK_SIZE);
+    }
+    s_ready = true;
+}
+
+static arena_block_t *arena_owner(const void *ptr){
+    for(auto &block : s_blocks){
+        if(block.base != NULL && (const uint8_t*)ptr >= block.base && (const uint8_t*)ptr < block.base + STRATUM_ARENA_BLOCK_SIZE) return &block;
+    }
+    return NULL;
+}
+
+//drops the reference of the stratum thread and takes the first block nobody holds
+static arena_block_t *arena_next(){
+    if(s_current >= 0){
+        arena_block_t *current = &s_blocks[s_current];
+        if(current->refs.load(std::memory_order_acquire) == 1){//no job left in it, reuse in place
+            current->used = 0;
+            return current;
+        }
+        current->refs.fetch_sub(1, std::memory_order_acq_rel);
+        s_current = -1;
+    }
+    for(int i = 0; i < STRATUM_ARENA_BLOCKS; i++){
+        arena_block_t *block = &s_blocks[i];
+        if(block->base == NULL || block->refs.load(std::memory_order_acquire) != 0) continue;
+        block->used = 0;
+        block->refs.store(1, std::memory_order_release);
+        s_current = i;
+        return block;
+    }
+    return NULL;
+}
+
+void *stratum_arena_alloc(size_t len){
+    if(!s_ready) arena_init();
+    len = (len + 3) & ~(size_t)3;
+    arena_block_t *block = (s_current >= 0) ? &s_blocks[s_current] : NULL;
+    if(len <= STRATUM_ARENA_BLOCK_SIZE && (block == NULL || block->used + len > STRATUM_ARENA_BLOCK_SIZE)){
+        block = arena_next();
+    }
+    if(block == NULL || block->used + len > STRATUM_ARENA_BLOCK_SIZE){
+        s_fallbacks.fetch_add(1, std::memory_order_relaxed);
+        return malloc(len);
+    }
+    void *ptr = block->base + block->used;
+    block->used += len;
+    block->refs.fetch_add(1, std::memory_order_relaxed);
+    return ptr;
+}
+
+void stratum_arena_free(void *ptr){
+    if(ptr == NULL) return;
+    arena_block_t *block = arena_owner(ptr);
+    if(block == NULL){
+        free(ptr);
+        return;
+    }
+    block->refs.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void stratum_arena_rotate(){
+    if(!s_ready || s_current < 0 || s_blocks[s_current].used == 0) return;
+    arena_next();
+}
+
+uint32_t stratum_arena_fallbacks(){
+    return s_fallbacks.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,24 @@
+#ifndef STRATUM_ARENA_H_
+#define STRATUM_ARENA_H_
+#include <Arduino.h>
+#include <atomic>
+
+#define  STRATUM_ARENA_BLOCK_SIZE  (1024*32)    //bulk bytes of one job generation
+#define  STRATUM_ARENA_BLOCKS      (4)          //a retired block lives on until its last job is released
+
+/**
+ * @brief Bump allocator for the bulk data of the jobs of one generation.
+ *
+ * The blocks are allocated once, from PSRAM on boards that have it. The
+ * stratum thread bumps through the current block and rotates to a free one
+ * on clean_jobs or when it is full. Every allocation holds a reference on
+ * its block, released from any thread, a block whose references are all
+ * gone is reused as a whole. When no block is free the data falls back to
+ * the heap, callers never see the difference.
+ */
+void     *stratum_arena_alloc(size_t len);  //stratum thread only
+void      stratum_arena_free(void *ptr);    //any thread
+void      stratum_arena_rotate();           //stratum thread only, starts a new job generation
+uint32_t  stratum_arena_fallbacks();        //allocations that went to the heap
+
+#endif
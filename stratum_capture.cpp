@@ -0,0 +1,263 @@
+#include <Arduino.h>
+#include "stratum_capture.h"
+#include "stratum_log.h"
+#include "stratum_metrics.h"
+#include <algorithm>
+
+std::atomic<bool> g_stratum_capture_on(false);
+
+/**
+ * @brief Single producer / single consumer byte ring between the stratum
+ * thread and the flush task.
+ *
+ * The stratum thread owns every pool read and write, so it is the only one
+ * appending records and never touches the file. The flush task frames the
+ * records back out of the ring and is the only one writing SPIFFS, begin()
+ * and end() take the file lock and belong to the stratum thread.
+ */
+static uint8_t                 *s_stage = NULL;
+static std::atomic<uint32_t>    s_tail(0);      //next byte the producer writes
+static std::atomic<uint32_t>    s_head(0);      //next byte the flush task reads
+static std::atomic<uint32_t>    s_dropped(0);
+static uint32_t                 s_last_ms = 0;  //producer side, time of the last record
+static SemaphoreHandle_t        s_file_lock = NULL;
+static FILE                    *s_file = NULL;
+static char                     s_path[56];
+static size_t                   s_segment_max = 0;
+static size_t                   s_segment_bytes = 0;
+static uint32_t                 s_flush_ms = 0; //flush side, time of the last record written
+
+static size_t put_varint(uint8_t *out, uint32_t val){
+    size_t n = 0;
+    while(val >= 0x80){
+        out[n++] = (uint8_t)(val | 0x80);
+        val >>= 7;
+    }
+    out[n++] = (uint8_t)val;
+    return n;
+}
+
+static void stage_put(uint32_t pos, const uint8_t *data, size_t len){
+    size_t off   = pos & (STRATUM_CAPTURE_STAGE_SIZE - 1);
+    size_t first = std::min(len, (size_t)STRATUM_CAPTURE_STAGE_SIZE - off);
+    memcpy(s_stage + off, data, first);
+    memcpy(s_stage, data + first, len - first);
+}
+
+static uint32_t stage_varint(uint32_t *pos){
+    uint32_t val = 0;
+    for(int shift = 0; shift < 35; shift += 7){
+        uint8_t b = s_stage[(*pos)++ & (STRATUM_CAPTURE_STAGE_SIZE - 1)];
+        val |= (uint32_t)(b & 0x7f) << shift;
+        if(!(b & 0x80)) break;
+    }
+    return val;
+}
+
+static void stage_write(uint32_t pos, size_t len){
+    size_t off   = pos & (STRATUM_CAPTURE_STAGE_SIZE - 1);
+    size_t first = std::min(len, (size_t)STRATUM_CAPTURE_STAGE_SIZE - off);
+    fwrite(s_stage + off, 1, first, s_file);
+    fwrite(s_stage, 1, len - first, s_file);
+}
+
+//moves the current segment to <path>.1 and starts a new <path>.0 at base_ms
+static bool segment_open(uint32_t base_ms){
+    char cur[64], old[64];
+    snprintf(cur, sizeof(cur), "%s.0", s_path);
+    snprintf(old, sizeof(old), "%s.1", s_path);
+    if(s_file != NULL) fclose(s_file);
+    remove(old);
+    rename(cur, old);
+    s_file = fopen(cur, "wb");
+    s_segment_bytes = 0;
+    if(s_file == NULL){
+        LOG_E("Failed to open capture segment %s", cur);
+        return false;
+    }
+    uint8_t header[12] = {STRATUM_CAPTURE_MAGIC[0], STRATUM_CAPTURE_MAGIC[1], STRATUM_CAPTURE_MAGIC[2], STRATUM_CAPTURE_MAGIC[3],
+                          STRATUM_CAPTURE_VERSION, 0, 0, 0,
+                          (uint8_t)base_ms, (uint8_t)(base_ms >> 8), (uint8_t)(base_ms >> 16), (uint8_t)(base_ms >> 24)};
+    fwrite(header, 1, sizeof(header), s_file);
+    s_segment_bytes = sizeof(header);
+    return true;
+}
+
+/**
+ * @brief Starts recording the pool traffic to <path>.0.
+ *
+ * A capture already on disk becomes <path>.1, so the session before a
+ * reboot survives until the new one fills its segment. Call it from the
+ * stratum thread.
+ */
+bool stratum_capture_begin(const char *path, size_t max_bytes){
+    if(g_stratum_capture_on.load(std::memory_order_relaxed)) stratum_capture_end();
+    if(strlen(path) >= sizeof(s_path)) return false;
+    if(s_file_lock == NULL) s_file_lock = xSemaphoreCreateMutex();
+    if(s_stage == NULL){
+#ifdef BOARD_HAS_PSRAM
+        s_stage = (uint8_t*)ps_malloc(STRATUM_CAPTURE_STAGE_SIZE);
+#else
+        s_stage = (uint8_t*)malloc(STRATUM_CAPTURE_STAGE_SIZE);
+#endif
+        if(s_stage == NULL){
+            LOG_E("No memory for the %d byte capture stage", STRATUM_CAPTURE_STAGE_SIZE);
+            return false;
+        }
+    }
+    xSemaphoreTake(s_file_lock, portMAX_DELAY);
+    strcpy(s_path, path);
+    s_segment_max = max_bytes / 2;
+    s_last_ms     = millis();
+    s_flush_ms    = s_last_ms;
+    s_head.store(0, std::memory_order_relaxed);
+    s_tail.store(0, std::memory_order_relaxed);
+    s_dropped.store(0, std::memory_order_relaxed);
+    bool ok = segment_open(s_last_ms);
+    xSemaphoreGive(s_file_lock);
+    if(!ok) return false;
+    g_stratum_capture_on.store(true, std::memory_order_release);
+    LOG_I("Capturing pool traffic to %s.0, %d KiB max", path, (int)(max_bytes / 1024));
+    return true;
+}
+
+//writes out what is staged and closes the capture, call it from the stratum thread
+void stratum_capture_end(){
+    if(!g_stratum_capture_on.exchange(false)) return;
+    stratum_capture_flush();
+    xSemaphoreTake(s_file_lock, portMAX_DELAY);
+    if(s_file != NULL) fclose(s_file);
+    s_file = NULL;
+    xSemaphoreGive(s_file_lock);
+    uint32_t dropped = stratum_capture_get_dropped();
+    if(dropped > 0) LOG_W("Capture of %s stopped, %u records dropped", s_path, (unsigned)dropped);
+    else            LOG_I("Capture of %s stopped", s_path);
+}
+
+//appends one record to the stage, drops it if the flush task is behind
+void stratum_capture_record(stratum_capture_kind_t kind, const void *data, size_t len){
+    uint8_t  header[10];
+    uint32_t now  = millis();
+    size_t   hlen = put_varint(header, (uint32_t)(len << 2) | kind);
+    hlen += put_varint(header + hlen, now - s_last_ms);
+
+    uint32_t tail = s_tail.load(std::memory_order_relaxed);
+    uint32_t used = tail - s_head.load(std::memory_order_acquire);
+    if(len > STRATUM_CAPTURE_RECORD_MAX || used + hlen + len > STRATUM_CAPTURE_STAGE_SIZE){
+        s_dropped.fetch_add(1, std::memory_order_relaxed);
+        g_stratum_metrics.capture_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    stage_put(tail, header, hlen);
+    stage_put(tail + hlen, (const uint8_t*)data, len);
+    s_last_ms = now;
+    s_tail.store(tail + hlen + len, std::memory_order_release);
+}
+
+//moves the staged records to the file, rolls the segments over on the way
+size_t stratum_capture_flush(){
+    if(s_file_lock == NULL) return 0;
+    xSemaphoreTake(s_file_lock, portMAX_DELAY);
+    uint32_t head    = s_head.load(std::memory_order_relaxed);
+    uint32_t tail    = s_tail.load(std::memory_order_acquire);
+    size_t   written = 0;
+    while(s_file != NULL && head != tail){
+        uint32_t pos   = head;
+        uint32_t word  = stage_varint(&pos);
+        uint32_t delta = stage_varint(&pos);
+        size_t   size  = (pos - head) + (word >> 2);
+        if(s_segment_bytes + size > s_segment_max && !segment_open(s_flush_ms)) break;
+        stage_write(head, size);
+        s_flush_ms      += delta;
+        s_segment_bytes += size;
+        written         += size;
+        head            += size;
+    }
+    if(s_file != NULL && written > 0) fflush(s_file);
+    s_head.store(s_file != NULL ? head : tail, std::memory_order_release);
+    xSemaphoreGive(s_file_lock);
+    return written;
+}
+
+uint32_t stratum_capture_get_dropped(){
+    return s_dropped.load(std::memory_order_relaxed);
+}
+
+void stratum_capture_thread_entry(void *args){
+    while(true){
+        stratum_capture_flush();
+        delay(STRATUM_CAPTURE_FLUSH_MS);
+    }
+}
+
+bool StratumCaptureReader::open(const char *path){
+    this->close();
+    this->_segments = 0;
+    for(int i = 1; i >= 0; i--){
+        snprintf(this->_paths[this->_segments], sizeof(this->_paths[0]), "%s.%d", path, i);
+        FILE *file = fopen(this->_paths[this->_segments], "rb");
+        if(file == NULL) continue;
+        fclose(file);
+        this->_segments++;
+    }
+    if(this->_segments == 0){
+        snprintf(this->_paths[0], sizeof(this->_paths[0]), "%s", path);
+        this->_segments = 1;
+    }
+    this->_segment = 0;
+    return this->_open_segment();
+}
+
+bool StratumCaptureReader::_open_segment(){
+    uint8_t header[12];
+    if(this->_file != NULL) fclose(this->_file);
+    this->_file = NULL;
+    if(this->_segment >= this->_segments) return false;
+    this->_file = fopen(this->_paths[this->_segment], "rb");
+    if(this->_file == NULL) return false;
+    if(fread(header, 1, sizeof(header), this->_file) != sizeof(header) ||
+       memcmp(header, STRATUM_CAPTURE_MAGIC, 4) != 0 || header[4] != STRATUM_CAPTURE_VERSION){
+        fclose(this->_file);
+        this->_file = NULL;
+        return false;
+    }
+    this->_ms = header[8] | (header[9] << 8) | (header[10] << 16) | ((uint32_t)header[11] << 24);
+    return true;
+}
+
+bool StratumCaptureReader::_varint(uint32_t *val){
+    *val = 0;
+    for(int shift = 0; shift < 35; shift += 7){
+        int b = fgetc(this->_file);
+        if(b == EOF) return false;
+        *val |= (uint32_t)(b & 0x7f) << shift;
+        if(!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+//false at the end of the last segment or on a truncated record
+bool StratumCaptureReader::next(stratum_capture_record_t *record){
+    uint32_t word, delta;
+    while(this->_file != NULL){
+        if(!this->_varint(&word)){
+            this->_segment++;
+            this->_open_segment();
+            continue;
+        }
+        size_t len = word >> 2;
+        if(!this->_varint(&delta) || len > sizeof(this->_buf) || fread(this->_buf, 1, len, this->_file) != len) return false;
+        this->_ms      += delta;
+        record->kind    = (stratum_capture_kind_t)(word & 3);
+        record->ms      = this->_ms;
+        record->data    = this->_buf;
+        record->len     = len;
+        return true;
+    }
+    return false;
+}
+
+void StratumCaptureReader::close(){
+    if(this->_file != NULL) fclose(this->_file);
+    this->_file = NULL;
+}
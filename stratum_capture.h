@@ -0,0 +1,77 @@
+#ifndef STRATUM_CAPTURE_H_
+#define STRATUM_CAPTURE_H_
+#include <Arduino.h>
+#include <atomic>
+
+#ifndef  STRATUM_CAPTURE
+#define  STRATUM_CAPTURE             (0)    //1 records the pool traffic from boot on
+#endif
+#define  STRATUM_CAPTURE_PATH        "/spiffs/stratum.cap"
+#define  STRATUM_CAPTURE_MAX_BYTES   (128*1024)     //both segments together
+#define  STRATUM_CAPTURE_STAGE_SIZE  (16*1024)      //power of two, records wait here for the flush task
+#define  STRATUM_CAPTURE_RECORD_MAX  (4096)         //longer records are dropped
+#define  STRATUM_CAPTURE_FLUSH_MS    (500)
+#define  STRATUM_CAPTURE_MAGIC       "SCAP"
+#define  STRATUM_CAPTURE_VERSION     (1)
+
+/*
+ * Capture file layout, integers little endian:
+ *   header : "SCAP" | u8 version | 3 bytes reserved | u32 base ms
+ *   record : varint (len << 2 | kind) | varint ms since the record before | len bytes
+ * The first record of a file counts from the base. A capture is kept in two
+ * segments, <path>.1 the older and <path>.0 the one being written, so the
+ * newest traffic always survives and the size stays bounded.
+ */
+typedef enum {
+    STRATUM_CAPTURE_RX_LINE,    //line read from the pool, without its newline
+    STRATUM_CAPTURE_TX,         //bytes written to the pool
+    STRATUM_CAPTURE_RX_BYTES,   //raw bytes read from a stratum v2 pool
+} stratum_capture_kind_t;
+
+typedef struct {
+    stratum_capture_kind_t  kind;
+    uint32_t                ms;     //base ms of the segment plus the deltas so far
+    const uint8_t          *data;   //valid until the next read
+    size_t                  len;
+} stratum_capture_record_t;
+
+extern std::atomic<bool> g_stratum_capture_on;
+
+bool     stratum_capture_begin(const char *path, size_t max_bytes);
+void     stratum_capture_end();
+void     stratum_capture_record(stratum_capture_kind_t kind, const void *data, size_t len);
+size_t   stratum_capture_flush();
+uint32_t stratum_capture_get_dropped();
+void     stratum_capture_thread_entry(void *args);
+
+//the pool read and write paths call this, a single load while capture is off
+static inline void stratum_capture(stratum_capture_kind_t kind, const void *data, size_t len){
+    if(g_stratum_capture_on.load(std::memory_order_relaxed)) stratum_capture_record(kind, data, len);
+}
+
+/**
+ * @brief Reads a capture back record by record.
+ *
+ * open() takes the capture path and walks <path>.1 then <path>.0, or a single
+ * segment file given by its own name.
+ */
+class StratumCaptureReader{
+private:
+    FILE       *_file;
+    char        _paths[2][64];
+    int         _segment;
+    int         _segments;
+    uint32_t    _ms;
+    uint8_t     _buf[STRATUM_CAPTURE_RECORD_MAX];
+    bool        _open_segment();
+    bool        _varint(uint32_t *val);
+public:
+    StratumCaptureReader():_file(NULL), _segment(0), _segments(0), _ms(0){};
+    ~StratumCaptureReader(){ this->close(); }
+
+    bool    open(const char *path);
+    bool    next(stratum_capture_record_t *record);
+    void    close();
+};
+
+#endif
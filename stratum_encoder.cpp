@@ -0,0 +1,151 @@
+#include "stratum_encoder.h"
+#include "stratum_log.h"
+
+void StratumEncoder::_put(const char *str, size_t len){
+    if(!this->_ok || len >= sizeof(this->_buf) - this->_len){
+        this->_ok = false;
+        return;
+    }
+    memcpy(this->_buf + this->_len, str, len);
+    this->_len += len;
+}
+
+//JSON string body, quotes and backslashes escaped, control characters dropped
+void StratumEncoder::_put_escaped(const char *str){
+    for(const char *p = str; *p != '\0'; p++){
+        if(*p == '"' || *p == '\\') this->_put("\\", 1);
+        if((uint8_t)*p >= 0x20) this->_put(p, 1);
+    }
+}
+
+void StratumEncoder::_put_u32(uint32_t val){
+    char   digits[10];
+    size_t n = 0;
+    do{
+        digits[sizeof(digits) - 1 - n++] = '0' + val % 10;
+        val /= 10;
+    }while(val != 0);
+    this->_put(digits + sizeof(digits) - n, n);
+}
+
+void StratumEncoder::_put_hex32(uint32_t val){
+    static const char hex[] = "0123456789abcdef";
+    char digits[8];
+    for(int i = 7; i >= 0; i--, val >>= 4) digits[i] = hex[val & 0x0f];
+    this->_put(digits, sizeof(digits));
+}
+
+//terminates the line started at start, rolls it back if anything overflowed
+size_t StratumEncoder::_end(size_t start){
+    this->_put("\n", 1);
+    if(!this->_ok){
+        this->_ok  = true;
+        this->_len = start;
+        return 0;
+    }
+    this->_buf[this->_len] = '\0';
+    return this->_len - start;
+}
+
+//prebuilds everything of mining.submit from the method name to the job id quote
+bool StratumEncoder::set_user(const char *user){
+    size_t len = 0;
+    char  *out = this->_submit_head;
+    const char *head = ",\"method\":\"mining.submit\",\"params\":[\"";
+    len += strlen(head);
+    memcpy(out, head, len);
+    for(const char *p = user; *p != '\0'; p++){
+        if(p - user >= STRATUM_ENCODER_USER_MAX){
+            LOG_E("Worker name longer than %d chars, truncated", STRATUM_ENCODER_USER_MAX);
+            break;
+        }
+        if(*p == '"' || *p == '\\') out[len++] = '\\';
+        if((uint8_t)*p >= 0x20) out[len++] = *p;
+    }
+    memcpy(out + len, "\",\"", 3);
+    this->_submit_head_len = len + 3;
+    return strlen(user) <= STRATUM_ENCODER_USER_MAX;
+}
+
+//a session id asks the pool to resume that subscription
+size_t StratumEncoder::subscribe(uint32_t id, const char *model, const char *version, const char *session_id){
+    size_t start = this->_len;
+    this->_put("{\"id\":");
+    this->_put_u32(id);
+    this->_put(",\"method\":\"mining.subscribe\",\"params\":[\"");
+    this->_put_escaped(model);
+    this->_put("/", 1);
+    this->_put_escaped(version);
+    if(session_id != NULL && *session_id != '\0'){
+        this->_put("\",\"", 3);
+        this->_put_escaped(session_id);
+    }
+    this->_put("\"]}");
+    return this->_end(start);
+}
+
+size_t StratumEncoder::authorize(uint32_t id, const char *user, const char *pwd){
+    size_t start = this->_len;
+    this->_put("{\"id\":");
+    this->_put_u32(id);
+    this->_put(",\"method\":\"mining.authorize\",\"params\":[\"");
+    this->_put_escaped(user);
+    this->_put("\",\"", 3);
+    size_t secret = this->_len;
+    this->_put_escaped(pwd);
+    this->_put("\"]}");
+    size_t len = this->_end(start);
+    if(len != 0){
+        this->_secret_pos = secret;
+        this->_secret_len = start + len - 4 - secret;//up to "]}\n
+    }
+    return len;
+}
+
+//overwrites the authorize password once the requests are written, the buffer is safe to log or capture after
+void StratumEncoder::mask_secret(){
+    if(this->_secret_len == 0) return;
+    memset(this->_buf + this->_secret_pos, '*', this->_secret_len);
+    this->_secret_len = 0;
+}
+
+size_t StratumEncoder::suggest_difficulty(uint32_t id, double difficulty){
+    size_t start = this->_len;
+    char   num[32];
+    int    n = snprintf(num, sizeof(num), "%.4f", difficulty);
+    this->_put("{\"id\":");
+    this->_put_u32(id);
+    this->_put(",\"method\":\"mining.suggest_difficulty\",\"params\":[");
+    if(n > 0 && n < (int)sizeof(num)) this->_put(num, n);
+    else                              this->_ok = false;
+    this->_put("]}");
+    return this->_end(start);
+}
+
+size_t StratumEncoder::configure(uint32_t id, uint32_t version_mask){
+    size_t start = this->_len;
+    this->_put("{\"id\":");
+    this->_put_u32(id);
+    this->_put(",\"method\":\"mining.configure\",\"params\":[[\"version-rolling\"],{\"version-rolling.mask\":\"");
+    this->_put_hex32(version_mask);
+    this->_put("\"}]}");
+    return this->_end(start);
+}
+
+size_t StratumEncoder::submit(uint32_t id, const char *job_id, const char *extranonce2, uint32_t ntime, uint32_t nonce, uint32_t version){
+    size_t start = this->_len;
+    this->_put("{\"id\":", 6);
+    this->_put_u32(id);
+    this->_put(this->_submit_head, this->_submit_head_len);
+    this->_put_escaped(job_id);
+    this->_put("\",\"", 3);
+    this->_put(extranonce2);
+    this->_put("\",\"", 3);
+    this->_put_hex32(ntime);
+    this->_put("\",\"", 3);
+    this->_put_hex32(nonce);
+    this->_put("\",\"", 3);
+    this->_put_hex32(version);
+    this->_put("\"]}", 3);
+    return this->_end(start);
+}
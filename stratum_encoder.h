@@ -0,0 +1,50 @@
+#ifndef STRATUM_ENCODER_H_
+#define STRATUM_ENCODER_H_
+#include <Arduino.h>
+
+#define  STRATUM_ENCODER_SIZE      (16*256) //one flush of the submit queue at 256 bytes a share, longer ones are sent in parts
+#define  STRATUM_ENCODER_USER_MAX  (128)
+
+/**
+ * @brief Allocation free encoder of the upstream stratum requests.
+ *
+ * Requests are appended as JSON lines to a buffer owned by the encoder, the
+ * constant parts of every method are laid out as literals and only the id,
+ * strings, hex fields and numbers are written in between. The submit
+ * template, which carries the worker name, is prebuilt once by set_user().
+ * A request that does not fit is rolled back and reported as 0 bytes, the
+ * lines before it stay intact.
+ */
+class StratumEncoder{
+private:
+    char        _buf[STRATUM_ENCODER_SIZE];
+    size_t      _len;
+    bool        _ok;
+    char        _submit_head[STRATUM_ENCODER_USER_MAX * 2 + 64];
+    size_t      _submit_head_len;
+    size_t      _secret_pos;    //authorize password in _buf, masked before the buffer is logged or captured
+    size_t      _secret_len;
+    void        _put(const char *str, size_t len);
+    void        _put(const char *str){ this->_put(str, strlen(str)); }
+    void        _put_escaped(const char *str);
+    void        _put_u32(uint32_t val);
+    void        _put_hex32(uint32_t val);
+    size_t      _end(size_t start);
+public:
+    StratumEncoder():_len(0), _ok(true), _submit_head_len(0), _secret_pos(0), _secret_len(0){ this->set_user(""); };
+
+    void            clear(){ this->_len = 0; this->_secret_len = 0; }
+    const uint8_t  *data(){ return (const uint8_t*)this->_buf; }
+    const char     *c_str(){ return this->_buf; }
+    size_t          length(){ return this->_len; }
+
+    bool    set_user(const char *user);
+    size_t  subscribe(uint32_t id, const char *model, const char *version, const char *session_id = NULL);
+    size_t  authorize(uint32_t id, const char *user, const char *pwd);
+    size_t  suggest_difficulty(uint32_t id, double difficulty);
+    size_t  configure(uint32_t id, uint32_t version_mask);
+    size_t  submit(uint32_t id, const char *job_id, const char *extranonce2, uint32_t ntime, uint32_t nonce, uint32_t version);
+    void    mask_secret();
+};
+
+#endif
@@ -0,0 +1,286 @@
+#define STRATUM_LOG_SINK    //keep the board logger macros, this file is the one writing to them
+#include "stratum_log.h"
+#include <stdarg.h>
+
+#define  STRATUM_LOG_LINE_MAX      (256)
+
+typedef struct {
+    std::atomic<uint32_t>       seq;    //stored minus the slot index, so the zeroed ring starts out free
+    const stratum_log_site_t   *site;
+    uint8_t                     len;
+    uint8_t                     data[STRATUM_LOG_SLOT_SIZE - sizeof(std::atomic<uint32_t>) - sizeof(void*) - 1];
+} stratum_log_slot_t;
+
+/**
+ * @brief Bounded multi producer / single consumer ring of log records.
+ *
+ * A producer claims a slot by moving the tail, fills it and publishes it
+ * through the slot sequence number. A full ring drops the record instead of
+ * waiting. The drain task is the only consumer, it formats the records in
+ * order and hands the lines to the board logger.
+ */
+static stratum_log_slot_t       s_slots[STRATUM_LOG_SLOTS];
+static std::atomic<uint32_t>    s_tail(0);
+static uint32_t                 s_head = 0;
+static std::atomic<uint32_t>    s_dropped(0);
+static SemaphoreHandle_t        s_drain_sem = NULL;     //given by a commit while the drain task sleeps
+static std::atomic<bool>        s_drain_waiting(false);
+
+//slot of pos is free at sequence pos, holds a record at pos + 1 and is free again at pos + STRATUM_LOG_SLOTS
+static uint32_t slot_seq(uint32_t pos){
+    return s_slots[pos & (STRATUM_LOG_SLOTS - 1)].seq.load(std::memory_order_acquire) + (pos & (STRATUM_LOG_SLOTS - 1));
+}
+
+static void slot_set_seq(uint32_t pos, uint32_t seq){
+    s_slots[pos & (STRATUM_LOG_SLOTS - 1)].seq.store(seq - (pos & (STRATUM_LOG_SLOTS - 1)), std::memory_order_release);
+}
+
+bool stratum_log_reserve(stratum_log_writer_t *w, const stratum_log_site_t *site){
+    uint32_t pos = s_tail.load(std::memory_order_relaxed);
+    while(true){
+        stratum_log_slot_t *slot = &s_slots[pos & (STRATUM_LOG_SLOTS - 1)];
+        int32_t diff = (int32_t)(slot_seq(pos) - pos);
+        if(diff == 0){
+            if(s_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                slot->site  = site;
+                w->slot     = slot;
+                w->pos      = pos;
+                w->p        = slot->data;
+                w->end      = slot->data + sizeof(slot->data);
+                w->index    = 0;
+                w->prev_int = 0;
+                w->bounded  = site->bounded;
+                return true;
+            }
+        }else if(diff < 0){
+            s_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }else{
+            pos = s_tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void stratum_log_commit(stratum_log_writer_t *w){
+    stratum_log_slot_t *slot = (stratum_log_slot_t*)w->slot;
+    slot->len = w->p - slot->data;
+    slot_set_seq(w->pos, w->pos + 1);
+    //pairs with the fence in the drain task, either it sees the record or we see it waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(s_drain_waiting.load(std::memory_order_relaxed) && s_drain_waiting.exchange(false)) xSemaphoreGive(s_drain_sem);
+}
+
+void stratum_log_put_str(stratum_log_writer_t *w, const char *str){
+    if(str == NULL) str = "(null)";
+    if(w->end - w->p < 2){
+        w->end = w->p;
+        return;
+    }
+    size_t room = w->end - w->p - 2;
+    size_t len  = strnlen(str, (room < 0xff) ? room : 0xff);
+    *w->p++ = STRATUM_LOG_ARG_STR;
+    *w->p++ = (uint8_t)len;
+    memcpy(w->p, str, len);
+    w->p += len;
+}
+
+static void sink(uint8_t level, const char *line){
+    switch(level){
+        case STRATUM_LOG_DEBUG: LOG_D("%s", line); break;
+        case STRATUM_LOG_INFO:  LOG_I("%s", line); break;
+        case STRATUM_LOG_LOG:   LOG_L("%s", line); break;
+        case STRATUM_LOG_WARN:  LOG_W("%s", line); break;
+        default:                LOG_E("%s", line); break;
+    }
+}
+
+typedef struct {
+    const uint8_t  *p;
+    const uint8_t  *end;
+} log_reader_t;
+
+static bool read_arg(log_reader_t *r, uint8_t *tag, int64_t *i, double *d, const char **s, size_t *len){
+    if(r->p >= r->end) return false;
+    *tag = *r->p++;
+    switch(*tag){
+        case STRATUM_LOG_ARG_I32:{
+            int32_t v;
+            if(r->end - r->p < 4) return false;
+            memcpy(&v, r->p, 4);
+            r->p += 4;
+            *i = v;
+            return true;
+        }
+        case STRATUM_LOG_ARG_I64:
+            if(r->end - r->p < 8) return false;
+            memcpy(i, r->p, 8);
+            r->p += 8;
+            return true;
+        case STRATUM_LOG_ARG_DBL:
+            if(r->end - r->p < 8) return false;
+            memcpy(d, r->p, 8);
+            r->p += 8;
+            return true;
+        case STRATUM_LOG_ARG_STR:
+            if(r->p >= r->end || r->end - r->p - 1 < *r->p) return false;
+            *len = *r->p++;
+            *s   = (const char*)r->p;
+            r->p += *len;
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Formats one record the way printf would have.
+ *
+ * The format is walked spec by spec, each spec is rebuilt with the length
+ * modifier of the stored value and printed on its own. Args missing from a
+ * truncated record print as '?'.
+ */
+static size_t format_record(const stratum_log_site_t *site, const uint8_t *data, size_t len, char *out, size_t cap){
+    log_reader_t r   = {data, data + len};
+    const char  *fmt = site->fmt;
+    size_t       pos = 0;
+    auto append = [&](const char *str, size_t n){
+        size_t room = (pos < cap - 1) ? cap - 1 - pos : 0;
+        if(n > room) n = room;
+        memcpy(out + pos, str, n);
+        pos += n;
+    };
+
+    while(*fmt != '\0'){
+        const char *pct = strchr(fmt, '%');
+        if(pct == NULL){
+            append(fmt, strlen(fmt));
+            break;
+        }
+        append(fmt, pct - fmt);
+        if(pct[1] == '%'){
+            append("%", 1);
+            fmt = pct + 2;
+            continue;
+        }
+        //rebuild the spec: flags, width and precision kept, stars resolved, length modifiers dropped
+        char        spec[24];
+        size_t      n    = 0;
+        const char *p    = pct + 1;
+        bool        ok   = true;
+        spec[n++] = '%';
+        for(; *p != '\0' && !stratum_log_is_conv(*p); p++){
+            if(*p == 'h' || *p == 'l' || *p == 'z' || *p == 'j' || *p == 't' || *p == 'L') continue;
+            if(*p == '*'){
+                uint8_t tag; int64_t i = 0; double d; const char *s; size_t sl;
+                ok = ok && read_arg(&r, &tag, &i, &d, &s, &sl);
+                n += snprintf(spec + n, sizeof(spec) - n, "%d", (int)i);
+            }else if(n < sizeof(spec) - 4){
+                spec[n++] = *p;
+            }
+            if(n >= sizeof(spec) - 4) n = sizeof(spec) - 4;
+        }
+        if(*p == '\0') break;
+        char conv = *p;
+        fmt = p + 1;
+
+        uint8_t tag; int64_t i = 0; double d = 0; const char *s = ""; size_t sl = 0;
+        char    buf[STRATUM_LOG_LINE_MAX];
+        int     w = -1;
+        if(!ok || !read_arg(&r, &tag, &i, &d, &s, &sl)){
+            append("?", 1);
+            continue;
+        }
+        if(conv == 's'){
+            //the stored string is never longer than the precision asked for, print exactly it
+            const char *dot = (const char*)memchr(spec, '.', n);
+            if(dot != NULL) n = dot - spec;
+            memcpy(spec + n, ".*s", 4);
+            w = snprintf(buf, sizeof(buf), spec, (tag == STRATUM_LOG_ARG_STR) ? (int)sl : 0, (tag == STRATUM_LOG_ARG_STR) ? s : "");
+        }else if(conv == 'f' || conv == 'F' || conv == 'e' || conv == 'E' || conv == 'g' || conv == 'G'){
+            spec[n++] = conv;
+            spec[n]   = '\0';
+            w = snprintf(buf, sizeof(buf), spec, (tag == STRATUM_LOG_ARG_DBL) ? d : (double)i);
+        }else if(conv == 'p'){
+            w = snprintf(buf, sizeof(buf), "%p", (void*)(uintptr_t)i);
+        }else if(conv == 'c'){
+            spec[n++] = 'c';
+            spec[n]   = '\0';
+            w = snprintf(buf, sizeof(buf), spec, (int)i);
+        }else{
+            //32 bit values print as 32 bit, like the varargs they came from
+            bool     is_signed = (conv == 'd' || conv == 'i');
+            int64_t  sv = (tag == STRATUM_LOG_ARG_I32) ? (int64_t)(int32_t)i : i;
+            uint64_t uv = (tag == STRATUM_LOG_ARG_I32) ? (uint64_t)(uint32_t)i : (uint64_t)i;
+            if(tag == STRATUM_LOG_ARG_DBL) sv = (int64_t)d, uv = (uint64_t)d;
+            spec[n++] = 'l';
+            spec[n++] = 'l';
+            spec[n++] = conv;
+            spec[n]   = '\0';
+            w = is_signed ? snprintf(buf, sizeof(buf), spec, (long long)sv) : snprintf(buf, sizeof(buf), spec, (unsigned long long)uv);
+        }
+        if(w > 0) append(buf, ((size_t)w < sizeof(buf)) ? w : sizeof(buf) - 1);
+    }
+    out[pos] = '\0';
+    return pos;
+}
+
+//formats on the spot, STRATUM_LOG_DEFERRED=0
+void stratum_log_printf(const stratum_log_site_t *site, ...){
+    char    line[STRATUM_LOG_LINE_MAX];
+    va_list args;
+    va_start(args, site);
+    vsnprintf(line, sizeof(line), site->fmt, args);
+    va_end(args);
+    sink(site->level, line);
+}
+
+//formats and prints up to max_records queued records, returns how many
+size_t stratum_log_drain(size_t max_records){
+    static uint32_t reported = 0;
+    uint32_t dropped = s_dropped.load(std::memory_order_relaxed);
+    if(dropped != reported){
+        char line[64];
+        snprintf(line, sizeof(line), "%u stratum log records dropped, ring full", dropped - reported);
+        sink(STRATUM_LOG_WARN, line);
+        reported = dropped;
+    }
+
+    size_t count = 0;
+    char   line[STRATUM_LOG_LINE_MAX];
+    while(count < max_records){
+        stratum_log_slot_t *slot = &s_slots[s_head & (STRATUM_LOG_SLOTS - 1)];
+        if(slot_seq(s_head) != s_head + 1) break;//empty or still being written
+        format_record(slot->site, slot->data, slot->len, line, sizeof(line));
+        uint8_t level = slot->site->level;
+        slot_set_seq(s_head, s_head + STRATUM_LOG_SLOTS);
+        s_head++;
+        sink(level, line);
+        count++;
+    }
+    return count;
+}
+
+uint32_t stratum_log_get_dropped(){
+    return s_dropped.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Low priority task, the only place stratum log lines get formatted and written out.
+ *
+ * It sleeps on a semaphore while the ring is empty. Only the commit that
+ * finds it waiting gives the semaphore, the others cost a load.
+ */
+void stratum_log_thread_entry(void *args){
+    s_drain_sem = xSemaphoreCreateCounting(1, 0);
+    while(true){
+        if(stratum_log_drain(STRATUM_LOG_SLOTS) > 0) continue;
+        s_drain_waiting.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        //a record committed before the flag went up finds no waiter, look once more
+        if(stratum_log_drain(STRATUM_LOG_SLOTS) > 0){
+            s_drain_waiting.store(false, std::memory_order_relaxed);
+            continue;
+        }
+        xSemaphoreTake(s_drain_sem, portMAX_DELAY);
+    }
+}
@@ -0,0 +1,163 @@
+#ifndef STRATUM_LOG_H_
+#define STRATUM_LOG_H_
+#include <Arduino.h>
+#include <atomic>
+#include <type_traits>
+#include "logger.h"
+
+#define  STRATUM_LOG_DEBUG         (0)
+#define  STRATUM_LOG_INFO          (1)
+#define  STRATUM_LOG_LOG           (2)
+#define  STRATUM_LOG_WARN          (3)
+#define  STRATUM_LOG_ERROR         (4)
+
+#ifndef  STRATUM_LOG_LEVEL
+#define  STRATUM_LOG_LEVEL         (STRATUM_LOG_INFO)  //lower levels compile out, arguments included
+#endif
+#ifndef  STRATUM_LOG_DEFERRED
+#define  STRATUM_LOG_DEFERRED      (1)  //0 formats on the spot, for builds without the drain task
+#endif
+#define  STRATUM_LOG_SLOTS         (64) //power of two
+#define  STRATUM_LOG_SLOT_SIZE     (128)
+
+//one per log statement, lives in flash, its address is the format id
+typedef struct {
+    uint8_t     level;
+    const char *fmt;
+    uint32_t    bounded;    //args that are %.*s strings, their length is the int before them
+} stratum_log_site_t;
+
+typedef enum {
+    STRATUM_LOG_ARG_I32,
+    STRATUM_LOG_ARG_I64,
+    STRATUM_LOG_ARG_DBL,
+    STRATUM_LOG_ARG_STR,
+} stratum_log_arg_t;
+
+//record under construction, raw args packed as tag | value, strings as tag | len | bytes
+typedef struct {
+    void       *slot;
+    uint32_t    pos;
+    uint8_t    *p;
+    uint8_t    *end;
+    uint8_t     index;
+    int64_t     prev_int;
+    uint32_t    bounded;
+} stratum_log_writer_t;
+
+static constexpr bool stratum_log_is_conv(char c){
+    return c == 'd' || c == 'i' || c == 'u' || c == 'o' || c == 'x' || c == 'X' || c == 'c' || c == 's' ||
+           c == 'f' || c == 'F' || c == 'e' || c == 'E' || c == 'g' || c == 'G' || c == 'p';
+}
+
+//marks the string args whose length comes from a '.*' precision, evaluated at compile time
+static constexpr uint32_t stratum_log_bounded(const char *fmt){
+    uint32_t mask = 0;
+    int      arg  = 0;
+    for(int i = 0; fmt[i] != '\0'; i++){
+        if(fmt[i] != '%') continue;
+        if(fmt[++i] == '%') continue;
+        bool star_precision = false;
+        for(; fmt[i] != '\0' && !stratum_log_is_conv(fmt[i]); i++){
+            if(fmt[i] != '*') continue;
+            star_precision = (fmt[i - 1] == '.');
+            arg++;
+        }
+        if(fmt[i] == '\0') break;
+        if(fmt[i] == 's' && star_precision && arg < 32) mask |= 1u << arg;
+        arg++;
+    }
+    return mask;
+}
+
+bool     stratum_log_reserve(stratum_log_writer_t *w, const stratum_log_site_t *site);
+void     stratum_log_commit(stratum_log_writer_t *w);
+void     stratum_log_printf(const stratum_log_site_t *site, ...);
+void     stratum_log_put_str(stratum_log_writer_t *w, const char *str);
+size_t   stratum_log_drain(size_t max_records);
+uint32_t stratum_log_get_dropped();
+void     stratum_log_thread_entry(void *args);
+
+static inline void stratum_log_put(stratum_log_writer_t *w, uint8_t tag, const void *val, size_t len){
+    if((size_t)(w->end - w->p) < len + 1){
+        w->end = w->p;//no room, drop the rest of the args
+        return;
+    }
+    *w->p++ = tag;
+    memcpy(w->p, val, len);
+    w->p += len;
+}
+
+template<typename T>
+static inline void stratum_log_arg(stratum_log_writer_t *w, T val){
+    if constexpr (std::is_same<typename std::decay<T>::type, char*>::value || std::is_same<typename std::decay<T>::type, const char*>::value){
+        if((w->bounded >> w->index) & 1){
+            size_t len = (w->prev_int < 0) ? 0 : (size_t)w->prev_int;
+            size_t room = (w->end - w->p > 2) ? w->end - w->p - 2 : 0;
+            if(len > room) len = room;
+            if(len > 0xff) len = 0xff;
+            if(val == NULL || w->end - w->p < 2){
+                stratum_log_put_str(w, "(null)");
+            }else{
+                *w->p++ = STRATUM_LOG_ARG_STR;
+                *w->p++ = (uint8_t)len;
+                memcpy(w->p, val, len);
+                w->p += len;
+            }
+        }else{
+            stratum_log_put_str(w, val);
+        }
+    }else if constexpr (std::is_floating_point<T>::value){
+        double d = val;
+        stratum_log_put(w, STRATUM_LOG_ARG_DBL, &d, sizeof(d));
+    }else if constexpr (std::is_pointer<T>::value){
+        int64_t v = (int64_t)(uintptr_t)val;
+        stratum_log_put(w, STRATUM_LOG_ARG_I64, &v, sizeof(v));
+    }else if constexpr (sizeof(T) <= 4){
+        int32_t v = (int32_t)val;
+        w->prev_int = std::is_signed<T>::value ? (int64_t)v : (int64_t)(uint32_t)v;
+        stratum_log_put(w, STRATUM_LOG_ARG_I32, &v, sizeof(v));
+    }else{
+        int64_t v = (int64_t)val;
+        w->prev_int = v;
+        stratum_log_put(w, STRATUM_LOG_ARG_I64, &v, sizeof(v));
+    }
+    w->index++;
+}
+
+//copies the raw args into a ring slot, never formats and never waits
+template<typename... Args>
+static inline void stratum_log_push(const stratum_log_site_t *site, Args... args){
+#if STRATUM_LOG_DEFERRED
+    stratum_log_writer_t w;
+    if(!stratum_log_reserve(&w, site)) return;
+    (stratum_log_arg(&w, args), ...);
+    stratum_log_commit(&w);
+#else
+    stratum_log_printf(site, args...);
+#endif
+}
+
+#define STRATUM_LOG(lvl, fmt, ...) do{                                                              \
+        if constexpr ((lvl) >= STRATUM_LOG_LEVEL){                                                  \
+            (void)sizeof(printf(fmt, ##__VA_ARGS__)); /* format checked, never called */           \
+            static constexpr stratum_log_site_t _log_site = {(lvl), fmt, stratum_log_bounded(fmt)}; \
+            stratum_log_push(&_log_site, ##__VA_ARGS__);                                            \
+        }                                                                                           \
+    }while(0)
+
+//the stratum sources log through the ring, stratum_log.cpp keeps the board logger as the sink
+#ifndef STRATUM_LOG_SINK
+#undef  LOG_D
+#undef  LOG_I
+#undef  LOG_L
+#undef  LOG_W
+#undef  LOG_E
+#define LOG_D(fmt, ...)  STRATUM_LOG(STRATUM_LOG_DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_I(fmt, ...)  STRATUM_LOG(STRATUM_LOG_INFO,  fmt, ##__VA_ARGS__)
+#define LOG_L(fmt, ...)  STRATUM_LOG(STRATUM_LOG_LOG,   fmt, ##__VA_ARGS__)
+#define LOG_W(fmt, ...)  STRATUM_LOG(STRATUM_LOG_WARN,  fmt, ##__VA_ARGS__)
+#define LOG_E(fmt, ...)  STRATUM_LOG(STRATUM_LOG_ERROR, fmt, ##__VA_ARGS__)
+#endif
+
+#endif
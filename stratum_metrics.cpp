@@ -0,0 +1,145 @@
+#include "stratum_metrics.h"
+#include "stratum_log.h"
+#include <stdarg.h>
+
+stratum_metrics_t g_stratum_metrics;
+
+static const char *method_keys[STRATUM_UP_MAX] = {
+    "none", "subscribe", "authorize", "configure", "suggest_difficulty", "submit"
+};
+
+static const char *reject_keys[STRATUM_REJECT_MAX] = {
+    "other", "stale", "duplicate", "low_difficulty", "unauthorized", "not_subscribed"
+};
+
+static bool str_has(stratum_str_t s, const char *needle){
+    size_t n = strlen(needle);
+    for(size_t i = 0; s.ptr != NULL && i + n <= s.len; i++){
+        if(memcmp(s.ptr + i, needle, n) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Maps a pool error onto a reject reason.
+ *
+ * Stratum v1 pools send [code, "message", data] or {"code": .., ...}, the
+ * first number is taken. Stratum v2 sends a bare error string.
+ */
+stratum_reject_reason_t stratum_reject_reason(stratum_str_t error){
+    if(error.ptr == NULL || error.len == 0) return STRATUM_REJECT_OTHER;
+    for(size_t i = 0; i < error.len; i++){
+        char c = error.ptr[i];
+        if(c == '"' && error.ptr[0] == '[') break;//message before any code
+        if(c < '0' || c > '9') continue;
+        int code = 0;
+        for(; i < error.len && error.ptr[i] >= '0' && error.ptr[i] <= '9'; i++) code = code * 10 + (error.ptr[i] - '0');
+        return (code >= 21 && code <= 25) ? (stratum_reject_reason_t)(code - 20) : STRATUM_REJECT_OTHER;
+    }
+    if(str_has(error, "stale") || str_has(error, "invalid-job-id")) return STRATUM_REJECT_STALE;
+    if(str_has(error, "duplicate"))                                 return STRATUM_REJECT_DUPLICATE;
+    if(str_has(error, "difficulty-too-low"))                        return STRATUM_REJECT_LOW_DIFFICULTY;
+    if(str_has(error, "unauthorized"))                              return STRATUM_REJECT_UNAUTHORIZED;
+    return STRATUM_REJECT_OTHER;
+}
+
+void stratum_metrics_request(stratum_method_up method){
+    if(method >= STRATUM_UP_MAX) return;
+    g_stratum_metrics.requests[method].fetch_add(1, std::memory_order_relaxed);
+}
+
+void stratum_metrics_response(stratum_method_up method, uint32_t rtt_ms){
+    if(method >= STRATUM_UP_MAX) return;
+    stratum_histogram_add(&g_stratum_metrics.rtt[method], rtt_ms);
+}
+
+void stratum_metrics_share(bool accepted, stratum_str_t error){
+    if(accepted){
+        g_stratum_metrics.accepted.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    g_stratum_metrics.rejected.fetch_add(1, std::memory_order_relaxed);
+    g_stratum_metrics.rejects[stratum_reject_reason(error)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void stratum_metrics_clear(){
+    stratum_metrics_t *m = &g_stratum_metrics;
+    for(int i = 0; i < STRATUM_UP_MAX; i++){
+        stratum_histogram_clear(&m->rtt[i]);
+        m->requests[i].store(0, std::memory_order_relaxed);
+    }
+    for(auto &reject : m->rejects) reject.store(0, std::memory_order_relaxed);
+    m->accepted.store(0, std::memory_order_relaxed);
+    m->rejected.store(0, std::memory_order_relaxed);
+    m->submit_timeouts.store(0, std::memory_order_relaxed);
+    m->submit_failed.store(0, std::memory_order_relaxed);
+    m->stale_avoided.store(0, std::memory_order_relaxed);
+    m->reconnects.store(0, std::memory_order_relaxed);
+    stratum_histogram_clear(&m->reconnect_ms);
+    m->bytes_in.store(0, std::memory_order_relaxed);
+    m->bytes_out.store(0, std::memory_order_relaxed);
+    m->capture_dropped.store(0, std::memory_order_relaxed);
+}
+
+static void dist_from(const stratum_histogram_t *hist, stratum_metrics_dist_t *dist){
+    dist->count = hist->count.load(std::memory_order_relaxed);
+    dist->p50   = stratum_histogram_percentile(hist, 0.50);
+    dist->p99   = stratum_histogram_percentile(hist, 0.99);
+    dist->max   = hist->max.load(std::memory_order_relaxed);
+}
+
+//safe from any thread, fields may be a few updates apart from each other
+void stratum_metrics_snapshot(stratum_metrics_snapshot_t *snapshot){
+    const stratum_metrics_t *m = &g_stratum_metrics;
+    for(int i = 0; i < STRATUM_UP_MAX; i++){
+        snapshot->requests[i] = m->requests[i].load(std::memory_order_relaxed);
+        dist_from(&m->rtt[i], &snapshot->rtt[i]);
+    }
+    for(int i = 0; i < STRATUM_REJECT_MAX; i++) snapshot->rejects[i] = m->rejects[i].load(std::memory_order_relaxed);
+    snapshot->accepted        = m->accepted.load(std::memory_order_relaxed);
+    snapshot->rejected        = m->rejected.load(std::memory_order_relaxed);
+    snapshot->submit_timeouts = m->submit_timeouts.load(std::memory_order_relaxed);
+    snapshot->submit_failed   = m->submit_failed.load(std::memory_order_relaxed);
+    snapshot->stale_avoided   = m->stale_avoided.load(std::memory_order_relaxed);
+    snapshot->reconnects      = m->reconnects.load(std::memory_order_relaxed);
+    dist_from(&m->reconnect_ms, &snapshot->reconnect_ms);
+    snapshot->bytes_in        = m->bytes_in.load(std::memory_order_relaxed);
+    snapshot->bytes_out       = m->bytes_out.load(std::memory_order_relaxed);
+    snapshot->capture_dropped = m->capture_dropped.load(std::memory_order_relaxed);
+}
+
+//appends with snprintf semantics, pos keeps counting past out_size so the caller sees the needed size
+static void json_append(char *out, size_t out_size, size_t *pos, const char *fmt, ...){
+    va_list args;
+    va_start(args, fmt);
+    size_t room = (*pos < out_size) ? out_size - *pos : 0;
+    int    n    = vsnprintf(room ? out + *pos : NULL, room, fmt, args);
+    va_end(args);
+    if(n > 0) *pos += n;
+}
+
+/**
+ * @brief Serializes a snapshot as one compact JSON object.
+ *
+ * Times are in ms. Returns the length of the whole document, a result of
+ * out_size or more means it was truncated.
+ */
+size_t stratum_metrics_json(const stratum_metrics_snapshot_t *snapshot, char *out, size_t out_size){
+    size_t pos = 0;
+    if(out_size > 0) out[0] = '\0';
+    json_append(out, out_size, &pos, "{\"rtt\":{");
+    for(int i = STRATUM_UP_SUBSCRIBE; i < STRATUM_UP_MAX; i++){
+        const stratum_metrics_dist_t *d = &snapshot->rtt[i];
+        json_append(out, out_size, &pos, "%s\"%s\":{\"req\":%u,\"n\":%u,\"p50\":%u,\"p99\":%u,\"max\":%u}",
+                    (i == STRATUM_UP_SUBSCRIBE) ? "" : ",", method_keys[i], snapshot->requests[i], d->count, d->p50, d->p99, d->max);
+    }
+    json_append(out, out_size, &pos, "},\"shares\":{\"accepted\":%u,\"rejected\":%u,\"timeouts\":%u,\"failed\":%u,\"stale_avoided\":%u,\"rejects\":{",
+                snapshot->accepted, snapshot->rejected, snapshot->submit_timeouts, snapshot->submit_failed, snapshot->stale_avoided);
+    for(int i = 0; i < STRATUM_REJECT_MAX; i++){
+        json_append(out, out_size, &pos, "%s\"%s\":%u", i ? "," : "", reject_keys[i], snapshot->rejects[i]);
+    }
+    const stratum_metrics_dist_t *r = &snapshot->reconnect_ms;
+    json_append(out, out_size, &pos, "}},\"reconnect\":{\"n\":%u,\"p50\":%u,\"p99\":%u,\"max\":%u},\"bytes\":{\"in\":%u,\"out\":%u},\"capture\":{\"dropped\":%u}}",
+                snapshot->reconnects, r->p50, r->p99, r->max, snapshot->bytes_in, snapshot->bytes_out, snapshot->capture_dropped);
+    return pos;
+}
@@ -0,0 +1,79 @@
+#ifndef STRATUM_METRICS_H_
+#define STRATUM_METRICS_H_
+#include <Arduino.h>
+#include "stratum.h"
+
+//pool reject reasons, stratum v1 error codes 20..25, v2 error strings are mapped onto them
+typedef enum {
+    STRATUM_REJECT_OTHER = 0,       //20 or anything not listed
+    STRATUM_REJECT_STALE,           //21 job not found
+    STRATUM_REJECT_DUPLICATE,       //22
+    STRATUM_REJECT_LOW_DIFFICULTY,  //23
+    STRATUM_REJECT_UNAUTHORIZED,    //24
+    STRATUM_REJECT_NOT_SUBSCRIBED,  //25
+    STRATUM_REJECT_MAX
+} stratum_reject_reason_t;
+
+/**
+ * @brief Pool health counters of the stratum thread.
+ *
+ * Plain atomics and fixed histograms, no heap and no lock: the stratum
+ * thread is the only writer (stale_avoided is bumped by the asic rx thread), the monitor/UI and the HTTP server read it
+ * through stratum_metrics_snapshot(). Byte counters are 32 bit and wrap,
+ * readers that want a rate take the difference of two snapshots.
+ */
+typedef struct {
+    stratum_histogram_t     rtt[STRATUM_UP_MAX];        //ms from request to response, per method
+    std::atomic<uint32_t>   requests[STRATUM_UP_MAX];
+    std::atomic<uint32_t>   accepted;
+    std::atomic<uint32_t>   rejected;
+    std::atomic<uint32_t>   rejects[STRATUM_REJECT_MAX];
+    std::atomic<uint32_t>   submit_timeouts;
+    std::atomic<uint32_t>   submit_failed;              //dequeued shares that could not be encoded or written
+    std::atomic<uint32_t>   stale_avoided;              //asic results of flushed jobs, never sent
+    std::atomic<uint32_t>   reconnects;                 //live sessions lost
+    stratum_histogram_t     reconnect_ms;               //from losing a session to the next job
+    std::atomic<uint32_t>   bytes_in;
+    std::atomic<uint32_t>   bytes_out;
+    std::atomic<uint32_t>   capture_dropped;            //records the capture stage had no room for
+} stratum_metrics_t;
+
+typedef struct {
+    uint32_t    count;
+    uint32_t    p50;
+    uint32_t    p99;
+    uint32_t    max;
+} stratum_metrics_dist_t;
+
+//copy of the registry for export, percentiles already resolved
+typedef struct {
+    uint32_t                requests[STRATUM_UP_MAX];
+    stratum_metrics_dist_t  rtt[STRATUM_UP_MAX];
+    uint32_t                accepted;
+    uint32_t                rejected;
+    uint32_t                rejects[STRATUM_REJECT_MAX];
+    uint32_t                submit_timeouts;
+    uint32_t                submit_failed;
+    uint32_t                stale_avoided;
+    uint32_t                reconnects;
+    stratum_metrics_dist_t  reconnect_ms;
+    uint32_t                bytes_in;
+    uint32_t                bytes_out;
+    uint32_t                capture_dropped;
+} stratum_metrics_snapshot_t;
+
+extern stratum_metrics_t g_stratum_metrics;
+
+stratum_reject_reason_t stratum_reject_reason(stratum_str_t error);
+void   stratum_metrics_request(stratum_method_up method);
+void   stratum_metrics_response(stratum_method_up method, uint32_t rtt_ms);
+void   stratum_metrics_share(bool accepted, stratum_str_t error);
+void   stratum_metrics_clear();
+void   stratum_metrics_snapshot(stratum_metrics_snapshot_t *snapshot);
+size_t stratum_metrics_json(const stratum_metrics_snapshot_t *snapshot, char *out, size_t out_size);
+
+static inline void stratum_metrics_bytes(std::atomic<uint32_t> &counter, int n){
+    if(n > 0) counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,195 @@
+#include "stratum_parser.h"
+
+static inline int8_t hex_nibble(char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+int StratumParser::_alloc(stratum_tok_type_t type, size_t start, size_t end, int parent){
+    if(this->_count >= STRATUM_PARSER_MAX_TOKENS) return -1;
+    int idx = this->_count++;
+    stratum_tok_t *tok = &this->_toks[idx];
+    tok->type  = type;
+    tok->size  = 0;
+    tok->next  = idx + 1;
+    tok->start = start;
+    tok->end   = end;
+    if(parent >= 0) this->_toks[parent].size++;
+    return idx;
+}
+
+bool StratumParser::parse(const char *js, size_t len){
+    int      stack[STRATUM_PARSER_MAX_DEPTH];
+    uint8_t  depth  = 0;
+    int      parent = -1;
+
+    this->_js    = js;
+    this->_len   = len;
+    this->_count = 0;
+
+    for(size_t i = 0; i < len; i++){
+        char c = js[i];
+        switch(c){
+            case '{':
+            case '[':{
+                int t = this->_alloc((c == '{') ? SJ_OBJECT : SJ_ARRAY, i, i, parent);
+                if(t < 0 || depth >= STRATUM_PARSER_MAX_DEPTH) return false;
+                stack[depth++] = t;
+                parent = t;
+            }
+                break;
+            case '}':
+            case ']':{
+                if(depth == 0) return false;
+                int t = stack[--depth];
+                if(this->_toks[t].type != ((c == '}') ? SJ_OBJECT : SJ_ARRAY)) return false;
+                this->_toks[t].end  = i + 1;
+                this->_toks[t].next = this->_count;
+                parent = (depth > 0) ? stack[depth - 1] : -1;
+                if(depth == 0) return true;//one line carries one message, ignore trailing bytes
+            }
+                break;
+            case '"':{
+                size_t start = ++i;
+                while(i < len && js[i] != '"'){
+                    if(js[i] == '\\') i++;
+                    i++;
+                }
+                if(i >= len) return false;
+                if(this->_alloc(SJ_STRING, start, i, parent) < 0) return false;
+            }
+                break;
+            case ' ': case '\t': case '\r': case '\n': case ':': case ',':
+                break;
+            default:{
+                size_t start = i;
+                while(i < len && !strchr(" \t\r\n:,]}", js[i])) i++;
+                if(this->_alloc(SJ_PRIMITIVE, start, i, parent) < 0) return false;
+                i--;
+            }
+                break;
+        }
+    }
+    return false;
+}
+
+int StratumParser::find(int obj, const char *key){
+    if(obj < 0 || obj >= this->_count || this->_toks[obj].type != SJ_OBJECT) return -1;
+    int child = obj + 1;
+    for(uint16_t i = 0; i + 1 < this->_toks[obj].size; i += 2){
+        int val = this->_toks[child].next;
+        if(this->_toks[child].type == SJ_STRING && this->eq(child, key)) return val;
+        child = this->_toks[val].next;
+    }
+    return -1;
+}
+
+int StratumParser::at(int arr, size_t idx){
+    if(arr < 0 || arr >= this->_count || this->_toks[arr].type != SJ_ARRAY) return -1;
+    if(idx >= this->_toks[arr].size) return -1;
+    int child = arr + 1;
+    while(idx--) child = this->_toks[child].next;
+    return child;
+}
+
+size_t StratumParser::size(int tok){
+    if(tok < 0 || tok >= this->_count) return 0;
+    return this->_toks[tok].size;
+}
+
+bool StratumParser::is_null(int tok){
+    if(tok < 0 || tok >= this->_count) return true;
+    return (this->_toks[tok].type == SJ_PRIMITIVE) && (this->_js[this->_toks[tok].start] == 'n');
+}
+
+bool StratumParser::is_string(int tok){
+    if(tok < 0 || tok >= this->_count) return false;
+    return this->_toks[tok].type == SJ_STRING;
+}
+
+bool StratumParser::eq(int tok, const char *str){
+    stratum_str_t s = this->str(tok);
+    size_t len = strlen(str);
+    return (s.ptr != NULL) && (s.len == len) && (memcmp(s.ptr, str, len) == 0);
+}
+
+stratum_str_t StratumParser::str(int tok){
+    if(tok < 0 || tok >= this->_count) return {NULL, 0};
+    return {this->_js + this->_toks[tok].start, this->_toks[tok].end - this->_toks[tok].start};
+}
+
+bool StratumParser::as_bool(int tok){
+    if(tok < 0 || tok >= this->_count || this->_toks[tok].type != SJ_PRIMITIVE) return false;
+    return this->_js[this->_toks[tok].start] == 't';
+}
+
+int32_t StratumParser::as_int(int tok, int32_t def){
+    if(tok < 0 || tok >= this->_count || this->_toks[tok].type != SJ_PRIMITIVE || this->is_null(tok)) return def;
+    //the line is NUL terminated and the token is followed by a delimiter, strtol stops there
+    return strtol(this->_js + this->_toks[tok].start, NULL, 10);
+}
+
+double StratumParser::as_double(int tok, double def){
+    if(tok < 0 || tok >= this->_count || this->_toks[tok].type != SJ_PRIMITIVE || this->is_null(tok)) return def;
+    return strtod(this->_js + this->_toks[tok].start, NULL);
+}
+
+uint32_t StratumParser::as_hex32(int tok, uint32_t def){
+    return stratum_hex32(this->str(tok), def);
+}
+
+size_t StratumParser::copy_str(int tok, char *out, size_t out_size){
+    stratum_str_t s = this->str(tok);
+    if(out_size == 0) return 0;
+    size_t n = (s.len < out_size - 1) ? s.len : out_size - 1;
+    if(n > 0) memcpy(out, s.ptr, n);
+    out[n] = '\0';
+    return n;
+}
+
+bool stratum_hex_decode(stratum_str_t hex, uint8_t *out, size_t out_len){
+    if(hex.ptr == NULL || hex.len != out_len * 2) return false;
+    for(size_t i = 0; i < out_len; i++){
+        int8_t hi = hex_nibble(hex.ptr[2 * i]);
+        int8_t lo = hex_nibble(hex.ptr[2 * i + 1]);
+        if(hi < 0 || lo < 0) return false;
+        out[i] = (hi << 4) | lo;
+    }
+    return true;
+}
+
+//writes 2*len chars plus the terminator
+void stratum_hex_encode(const uint8_t *in, size_t len, char *out){
+    static const char digits[] = "0123456789abcdef";
+    for(size_t i = 0; i < len; i++){
+        out[2 * i]     = digits[in[i] >> 4];
+        out[2 * i + 1] = digits[in[i] & 0x0f];
+    }
+    out[2 * len] = '\0';
+}
+
+uint32_t stratum_hex32(stratum_str_t hex, uint32_t def){
+    if(hex.ptr == NULL || hex.len == 0 || hex.len > 8) return def;
+    uint32_t val = 0;
+    for(size_t i = 0; i < hex.len; i++){
+        int8_t nib = hex_nibble(hex.ptr[i]);
+        if(nib < 0) return def;
+        val = (val << 4) | nib;
+    }
+    return val;
+}
+
+//strict form for the fixed width notify fields, exactly 8 hex digits
+bool stratum_hex32_decode(stratum_str_t hex, uint32_t *out){
+    if(hex.ptr == NULL || hex.len != 8) return false;
+    uint32_t val = 0;
+    for(size_t i = 0; i < hex.len; i++){
+        int8_t nib = hex_nibble(hex.ptr[i]);
+        if(nib < 0) return false;
+        val = (val << 4) | nib;
+    }
+    *out = val;
+    return true;
+}
@@ -0,0 +1,67 @@
+#ifndef STRATUM_PARSER_H_
+#define STRATUM_PARSER_H_
+#include <Arduino.h>
+
+#define  STRATUM_PARSER_MAX_TOKENS   (128)
+#define  STRATUM_PARSER_MAX_DEPTH    (8)
+
+//zero-copy view into the received line, not NUL terminated
+typedef struct {
+    const char *ptr;
+    size_t      len;
+} stratum_str_t;
+
+typedef enum {
+    SJ_OBJECT,
+    SJ_ARRAY,
+    SJ_STRING,
+    SJ_PRIMITIVE
+} stratum_tok_type_t;
+
+typedef struct {
+    uint8_t     type;
+    uint16_t    size;   //children count, an object counts keys and values
+    uint16_t    next;   //index of the token after this subtree
+    uint32_t    start;
+    uint32_t    end;
+} stratum_tok_t;
+
+/**
+ * @brief In-place JSON tokenizer for stratum lines.
+ *
+ * One linear pass over the line builds a flat token table, values are handed
+ * out as slices of the original buffer, so nothing is copied or allocated.
+ * The buffer must stay untouched while the tokens are in use.
+ */
+class StratumParser{
+private:
+    const char      *_js;
+    size_t           _len;
+    uint16_t         _count;
+    stratum_tok_t    _toks[STRATUM_PARSER_MAX_TOKENS];
+    int              _alloc(stratum_tok_type_t type, size_t start, size_t end, int parent);
+public:
+    StratumParser():_js(NULL), _len(0), _count(0){};
+
+    bool          parse(const char *js, size_t len);
+    int           root(){ return (this->_count > 0) ? 0 : -1; }
+    int           find(int obj, const char *key);
+    int           at(int arr, size_t idx);
+    size_t        size(int tok);
+    bool          is_null(int tok);
+    bool          is_string(int tok);
+    bool          eq(int tok, const char *str);
+    stratum_str_t str(int tok);
+    bool          as_bool(int tok);
+    int32_t       as_int(int tok, int32_t def = -1);
+    double        as_double(int tok, double def = 0);
+    uint32_t      as_hex32(int tok, uint32_t def = 0);
+    size_t        copy_str(int tok, char *out, size_t out_size);
+};
+
+uint32_t stratum_hex32(stratum_str_t hex, uint32_t def = 0);
+bool     stratum_hex32_decode(stratum_str_t hex, uint32_t *out);
+bool     stratum_hex_decode(stratum_str_t hex, uint8_t *out, size_t out_len);
+void     stratum_hex_encode(const uint8_t *in, size_t len, char *out);
+
+#endif
@@ -0,0 +1,387 @@
+#include <Arduino.h>
+#include <stdarg.h>
+#include <algorithm>
+#include "stratum_proxy.h"
+#include "stratum_parser.h"
+#include "stratum_log.h"
+#if STRATUM_PROXY_PORT
+#include <WiFi.h>
+#include <lwip/sockets.h>
+#endif
+
+StratumProxy *g_stratum_proxy = NULL;
+
+StratumProxy::StratumProxy(StratumClass *upstream, stratum_proxy_write_t write, void *arg){
+    this->_upstream  = upstream;
+    this->_write     = write;
+    this->_write_arg = arg;
+    this->_next_tag  = 1;
+    this->_forwarded = 0;
+    this->_answered  = 0;
+    memset(this->_clients, 0, sizeof(this->_clients));
+    memset(this->_pending, 0, sizeof(this->_pending));
+    this->_chain_cb  = upstream->get_submit_callback(&this->_chain_arg);
+    upstream->set_submit_callback(StratumProxy::_on_result, this);
+}
+
+StratumProxy::~StratumProxy(){
+    this->_upstream->set_submit_callback(this->_chain_cb, this->_chain_arg);
+}
+
+//takes a client slot, -1 if the proxy is full
+int StratumProxy::open(){
+    for(int i = 0; i < STRATUM_PROXY_CLIENTS_MAX; i++){
+        client_t *client = &this->_clients[i];
+        if(client->used) continue;
+        uint8_t epoch = client->epoch + 1;
+        *client = {true, false, false, false, epoch};
+        return i;
+    }
+    return -1;
+}
+
+//frees the slot, answers still on the way for it are dropped by the epoch
+void StratumProxy::close(uint8_t client){
+    if(client >= STRATUM_PROXY_CLIENTS_MAX) return;
+    this->_clients[client].used       = false;
+    this->_clients[client].subscribed = false;
+    this->_clients[client].authorized = false;
+    this->_clients[client].extranonce = false;
+}
+
+void StratumProxy::_send(uint8_t client, const char *fmt, ...){
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(this->_line, sizeof(this->_line) - 1, fmt, args);
+    va_end(args);
+    if(len <= 0 || len >= (int)sizeof(this->_line) - 1){
+        LOG_E("Proxy line to client %d too long", client);
+        return;
+    }
+    this->_line[len++] = '\n';
+    this->_write(client, this->_line, len, this->_write_arg);
+}
+
+void StratumProxy::_broadcast(const char *data, size_t len){
+    for(int i = 0; i < STRATUM_PROXY_CLIENTS_MAX; i++){
+        if(!this->_clients[i].subscribed) continue;
+        this->_write(i, data, len, this->_write_arg);
+        this->_write(i, "\n", 1, this->_write_arg);
+    }
+}
+
+//upstream extranonce1 with the client prefix appended, false until the upstream is subscribed
+bool StratumProxy::_extranonce(uint8_t client, char *extranonce1, size_t size, int *extranonce2_size){
+    String upstream = this->_upstream->get_sub_extranonce1();
+    int    size2    = this->_upstream->get_sub_extranonce2_size();
+    if(!this->_upstream->is_subscribed() || size2 <= STRATUM_PROXY_PREFIX_BYTES) return false;
+    if(upstream.length() + 2 * STRATUM_PROXY_PREFIX_BYTES >= size) return false;
+    snprintf(extranonce1, size, "%s%0*x", upstream.c_str(), 2 * STRATUM_PROXY_PREFIX_BYTES, client);
+    *extranonce2_size = size2 - STRATUM_PROXY_PREFIX_BYTES;
+    return true;
+}
+
+//the current difficulty and job, so a new client starts hashing right away
+void StratumProxy::_send_work(uint8_t client){
+    this->_send(client, "{\"id\":null,\"method\":\"mining.set_difficulty\",\"params\":[%.8g]}", this->_upstream->get_pool_difficulty());
+    if(this->_last_notify.length() > 0){
+        this->_write(client, this->_last_notify.c_str(), this->_last_notify.length(), this->_write_arg);
+        this->_write(client, "\n", 1, this->_write_arg);
+    }
+}
+
+void StratumProxy::_subscribe(uint8_t client, const char *id){
+    char extranonce1[2 * 32 + 1];
+    int  extranonce2_size;
+    if(!this->_extranonce(client, extranonce1, sizeof(extranonce1), &extranonce2_size)){
+        this->_send(client, "{\"id\":%s,\"result\":null,\"error\":[20,\"Upstream pool not ready\",null]}", id);
+        return;
+    }
+    this->_send(client, "{\"id\":%s,\"result\":[[[\"mining.set_difficulty\",\"%x\"],[\"mining.notify\",\"%x\"]],\"%s\",%d],\"error\":null}",
+                id, client, client, extranonce1, extranonce2_size);
+    this->_clients[client].subscribed = true;
+    this->_send_work(client);
+}
+
+void StratumProxy::_configure(uint8_t client, const char *id){
+    this->_send(client, "{\"id\":%s,\"result\":{\"version-rolling\":true,\"version-rolling.mask\":\"%08x\"},\"error\":null}",
+                id, this->_upstream->get_version_mask());
+}
+
+/**
+ * @brief Queues a client share upstream.
+ *
+ * The client prefix goes in front of its extranonce2, the rest of the share
+ * is the pool's job as the client got it. The tag keeps the slot in the
+ * pending table, a share still waiting in the slot it needs gets an error
+ * answer before the slot is reused, its pool answer would find no one.
+ */
+void StratumProxy::_submit(uint8_t client, const char *id, int params){
+    char job_id[sizeof(((stratum_share_t*)0)->job_id)];
+    char extranonce2[sizeof(((stratum_share_t*)0)->extranonce2)];
+    int  prefix = 2 * STRATUM_PROXY_PREFIX_BYTES;
+    snprintf(extranonce2, sizeof(extranonce2), "%0*x", prefix, client);
+
+    if(this->_parser.size(params) < 5 || this->_parser.copy_str(this->_parser.at(params, 1), job_id, sizeof(job_id)) == 0 ||
+       this->_parser.copy_str(this->_parser.at(params, 2), extranonce2 + prefix, sizeof(extranonce2) - prefix) == 0){
+        this->_send(client, "{\"id\":%s,\"result\":null,\"error\":[20,\"Malformed share\",null]}", id);
+        return;
+    }
+    uint32_t ntime   = this->_parser.as_hex32(this->_parser.at(params, 3));
+    uint32_t nonce   = this->_parser.as_hex32(this->_parser.at(params, 4));
+    uint32_t version = (this->_parser.size(params) > 5) ? this->_parser.as_hex32(this->_parser.at(params, 5)) : 0;
+
+    uint32_t   tag  = this->_next_tag++;
+    if(this->_next_tag == 0) this->_next_tag = 1;//0 belongs to the shares of this unit
+    pending_t *slot = &this->_pending[tag & (STRATUM_PROXY_PENDING - 1)];
+    if(slot->tag != 0){
+        LOG_W("Proxy pending table full, share of client %d loses its answer", slot->client);
+        if(this->_clients[slot->client].used && this->_clients[slot->client].epoch == slot->epoch){
+            this->_send(slot->client, "{\"id\":%s,\"result\":null,\"error\":[20,\"Upstream answer lost\",null]}", slot->id);
+        }
+    }
+    slot->tag    = tag;
+    slot->client = client;
+    slot->epoch  = this->_clients[client].epoch;
+    strncpy(slot->id, id, STRATUM_PROXY_ID_MAX);
+    slot->id[STRATUM_PROXY_ID_MAX] = '\0';
+    if(!this->_upstream->submit(job_id, extranonce2, ntime, nonce, version, tag)){
+        slot->tag = 0;
+        this->_send(client, "{\"id\":%s,\"result\":null,\"error\":[20,\"Upstream submit queue full\",null]}", id);
+        return;
+    }
+    this->_forwarded++;
+}
+
+//feeds one line a downstream client sent
+void StratumProxy::on_line(uint8_t client, const char *line, size_t len){
+    if(client >= STRATUM_PROXY_CLIENTS_MAX || !this->_clients[client].used) return;
+    if(!this->_parser.parse(line, len)){
+        LOG_W("Proxy client %d sent unparsable line", client);
+        return;
+    }
+    int root   = this->_parser.root();
+    int method = this->_parser.find(root, "method");
+    int params = this->_parser.find(root, "params");
+    int id_tok = this->_parser.find(root, "id");
+    char id[STRATUM_PROXY_ID_MAX + 1] = "null";
+    if(id_tok >= 0){
+        stratum_str_t raw = this->_parser.str(id_tok);
+        if(raw.len > STRATUM_PROXY_ID_MAX - 2) raw.len = 0;//room for the quotes
+        if(raw.len > 0) snprintf(id, sizeof(id), this->_parser.is_string(id_tok) ? "\"%.*s\"" : "%.*s", (int)raw.len, raw.ptr);
+    }
+    if(method < 0) return;
+
+    if(this->_parser.eq(method, "mining.submit")){
+        if(params < 0) return;
+        this->_submit(client, id, params);
+    }else if(this->_parser.eq(method, "mining.subscribe")){
+        this->_subscribe(client, id);
+    }else if(this->_parser.eq(method, "mining.authorize")){
+        this->_clients[client].authorized = true;//shares go out under the proxy's worker anyway
+        this->_send(client, "{\"id\":%s,\"result\":true,\"error\":null}", id);
+    }else if(this->_parser.eq(method, "mining.configure")){
+        this->_configure(client, id);
+    }else if(this->_parser.eq(method, "mining.extranonce.subscribe")){
+        this->_clients[client].extranonce = true;
+        this->_send(client, "{\"id\":%s,\"result\":true,\"error\":null}", id);
+    }else if(this->_parser.eq(method, "mining.suggest_difficulty")){
+        this->_send(client, "{\"id\":%s,\"result\":true,\"error\":null}", id);
+    }else{
+        this->_send(client, "{\"id\":%s,\"result\":null,\"error\":[20,\"Unsupported method\",null]}", id);
+    }
+}
+
+/**
+ * @brief Forwards what the upstream pool changed to the clients.
+ *
+ * Called for every message of the upstream session after it was handled.
+ * Only Stratum V1 notify lines are forwarded, a Stratum V2 upstream has no
+ * line to pass on.
+ */
+void StratumProxy::on_upstream(StratumClass *stratum, const stratum_method_data *method){
+    if(stratum != this->_upstream) return;
+    switch(method->type){
+        case STRATUM_DOWN_NOTIFY:
+            this->_last_notify = "";
+            this->_last_notify.concat(method->raw.ptr, method->raw.len);
+            this->_broadcast(method->raw.ptr, method->raw.len);
+            break;
+        case STRATUM_DOWN_SET_DIFFICULTY:
+            if(method->difficulty <= 0) break;
+            for(int i = 0; i < STRATUM_PROXY_CLIENTS_MAX; i++){
+                if(!this->_clients[i].subscribed) continue;
+                this->_send(i, "{\"id\":null,\"method\":\"mining.set_difficulty\",\"params\":[%.8g]}", method->difficulty);
+            }
+            break;
+        case STRATUM_DOWN_SET_VERSION_MASK:
+            for(int i = 0; i < STRATUM_PROXY_CLIENTS_MAX; i++){
+                if(!this->_clients[i].subscribed) continue;
+                this->_send(i, "{\"id\":null,\"method\":\"mining.set_version_mask\",\"params\":[\"%08x\"]}", stratum->get_version_mask());
+            }
+            break;
+        case STRATUM_DOWN_SET_EXTRANONCE:
+        case STRATUM_DOWN_SUCCESS:
+            if(method->type == STRATUM_DOWN_SUCCESS && !method->subscribed) break;
+            //a new upstream extranonce1 invalidates every client's, the last job went with it
+            //only clients that sent mining.extranonce.subscribe take set_extranonce, the rest subscribe again
+            this->_last_notify = "";
+            for(int i = 0; i < STRATUM_PROXY_CLIENTS_MAX; i++){
+                char extranonce1[2 * 32 + 1];
+                int  extranonce2_size;
+                if(!this->_clients[i].subscribed) continue;
+                if(this->_clients[i].extranonce && this->_extranonce(i, extranonce1, sizeof(extranonce1), &extranonce2_size)){
+                    this->_send(i, "{\"id\":null,\"method\":\"mining.set_extranonce\",\"params\":[\"%s\",%d]}", extranonce1, extranonce2_size);
+                    continue;
+                }
+                this->_clients[i].subscribed = false;
+                this->_send(i, "{\"id\":null,\"method\":\"client.reconnect\",\"params\":[]}");
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+//routes a pool answer back to the client whose tag it carries, tag 0 is this unit's own share
+void StratumProxy::_on_result(const stratum_submit_result_t *result, void *arg){
+    StratumProxy *proxy = (StratumProxy*)arg;
+    if(result->tag == 0){
+        if(proxy->_chain_cb != NULL) proxy->_chain_cb(result, proxy->_chain_arg);
+        return;
+    }
+    pending_t *slot = &proxy->_pending[result->tag & (STRATUM_PROXY_PENDING - 1)];
+    if(slot->tag != result->tag) return;
+    slot->tag = 0;
+    client_t *client = &proxy->_clients[slot->client];
+    if(!client->used || client->epoch != slot->epoch) return;
+    proxy->_answered++;
+    if(result->accepted){
+        proxy->_send(slot->client, "{\"id\":%s,\"result\":true,\"error\":null}", slot->id);
+    }else if(result->error.len > 0 && (result->error.ptr[0] == '[' || result->error.ptr[0] == '{')){
+        proxy->_send(slot->client, "{\"id\":%s,\"result\":null,\"error\":%.*s}", slot->id, (int)result->error.len, result->error.ptr);
+    }else{
+        proxy->_send(slot->client, "{\"id\":%s,\"result\":null,\"error\":[20,\"%.*s\",null]}", slot->id, (int)result->error.len, result->error.ptr);
+    }
+}
+
+#if STRATUM_PROXY_PORT
+/**
+ * @brief One downstream connection.
+ *
+ * Lines going out wait in tx and leave with non-blocking sends from
+ * stratum_proxy_poll(), a slow miner never holds up the stratum thread or
+ * the other miners. A miner that lets tx fill up is disconnected, it
+ * would be hashing on a job it never got.
+ */
+typedef struct {
+    WiFiClient  sock;
+    char        rx[STRATUM_PROXY_RX_BYTES];
+    size_t      rx_len;
+    bool        rx_skip;    //the line in rx overflowed, dropped up to its newline
+    uint8_t     tx[STRATUM_PROXY_TX_BYTES];
+    size_t      tx_len;
+    bool        stalled;
+} proxy_conn_t;
+
+static WiFiServer    s_proxy_server(STRATUM_PROXY_PORT);
+static proxy_conn_t *s_proxy_conns[STRATUM_PROXY_CLIENTS_MAX];
+
+static size_t proxy_write(uint8_t client, const char *data, size_t len, void *arg){
+    proxy_conn_t *conn = s_proxy_conns[client];
+    if(conn == NULL || !conn->sock || conn->stalled) return 0;
+    if(conn->tx_len + len > sizeof(conn->tx)){
+        conn->stalled = true;
+        return 0;
+    }
+    memcpy(conn->tx + conn->tx_len, data, len);
+    conn->tx_len += len;
+    return len;
+}
+
+//sends what the socket takes without waiting, false once the connection is gone
+static bool proxy_drain(proxy_conn_t *conn){
+    if(conn->tx_len == 0) return true;
+    int sent = send(conn->sock.fd(), conn->tx, conn->tx_len, MSG_DONTWAIT);
+    if(sent < 0) return (errno == EAGAIN || errno == EWOULDBLOCK);
+    memmove(conn->tx, conn->tx + sent, conn->tx_len - sent);
+    conn->tx_len -= sent;
+    return true;
+}
+
+//splits what arrived into lines and feeds them to the proxy
+static void proxy_receive(uint8_t client, proxy_conn_t *conn){
+    int avail;
+    while((avail = conn->sock.available()) > 0){
+        size_t room = sizeof(conn->rx) - conn->rx_len;
+        int    got  = conn->sock.read((uint8_t*)conn->rx + conn->rx_len, std::min((size_t)avail, room));
+        if(got <= 0) return;
+        conn->rx_len += got;
+        size_t start = 0;
+        for(size_t i = conn->rx_len - got; i < conn->rx_len; i++){
+            if(conn->rx[i] != '\n') continue;
+            size_t end = (i > start && conn->rx[i - 1] == '\r') ? i - 1 : i;
+            if(!conn->rx_skip) g_stratum_proxy->on_line(client, conn->rx + start, end - start);
+            conn->rx_skip = false;
+            start = i + 1;
+        }
+        memmove(conn->rx, conn->rx + start, conn->rx_len - start);
+        conn->rx_len -= start;
+        if(conn->rx_len == sizeof(conn->rx)){
+            LOG_W("Stratum proxy client %d sent a line over %d bytes, dropped", client, STRATUM_PROXY_RX_BYTES);
+            conn->rx_len  = 0;
+            conn->rx_skip = true;
+        }
+    }
+}
+
+static void proxy_drop(uint8_t client, proxy_conn_t *conn, const char *why){
+    conn->sock.stop();
+    g_stratum_proxy->close(client);
+    LOG_I("Stratum proxy client %d %s", client, why);
+}
+
+void stratum_proxy_begin(StratumClass *upstream){
+    g_stratum_proxy = new StratumProxy(upstream, proxy_write, NULL);
+    s_proxy_server.begin();
+    s_proxy_server.setNoDelay(true);
+    LOG_I("Stratum proxy listening on port %d", STRATUM_PROXY_PORT);
+}
+
+//accepts new miners, drops gone ones, feeds the received lines and sends the queued ones, never blocks
+void stratum_proxy_poll(){
+    if(g_stratum_proxy == NULL) return;
+    WiFiClient incoming = s_proxy_server.available();
+    if(incoming){
+        int slot = g_stratum_proxy->open();
+        if(slot >= 0 && s_proxy_conns[slot] == NULL) s_proxy_conns[slot] = (proxy_conn_t*)calloc(1, sizeof(proxy_conn_t));
+        if(slot < 0 || s_proxy_conns[slot] == NULL){
+            LOG_W("Stratum proxy full, refusing %s", incoming.remoteIP().toString().c_str());
+            if(slot >= 0) g_stratum_proxy->close(slot);
+            incoming.stop();
+        }else{
+            proxy_conn_t *conn = s_proxy_conns[slot];
+            conn->sock    = incoming;
+            conn->rx_len  = 0;
+            conn->rx_skip = false;
+            conn->tx_len  = 0;
+            conn->stalled = false;
+            LOG_I("Stratum proxy client %d connected from %s", slot, incoming.remoteIP().toString().c_str());
+        }
+    }
+    for(int i = 0; i < STRATUM_PROXY_CLIENTS_MAX; i++){
+        proxy_conn_t *conn = s_proxy_conns[i];
+        if(conn == NULL || !conn->sock) continue;
+        if(!conn->sock.connected()){
+            proxy_drop(i, conn, "disconnected");
+            continue;
+        }
+        proxy_receive(i, conn);
+        if(conn->stalled){
+            proxy_drop(i, conn, "too slow to take its jobs, disconnected");
+            continue;
+        }
+        if(!proxy_drain(conn)) proxy_drop(i, conn, "send failed, disconnected");
+    }
+}
+#endif
@@ -0,0 +1,96 @@
+#ifndef STRATUM_PROXY_H_
+#define STRATUM_PROXY_H_
+#include <Arduino.h>
+#include "stratum.h"
+#include "stratum_parser.h"
+
+#ifndef  STRATUM_PROXY_PORT
+#define  STRATUM_PROXY_PORT          (0)    //tcp port downstream miners connect to, 0 keeps proxy mode off
+#endif
+#define  STRATUM_PROXY_CLIENTS_MAX   (16)
+#define  STRATUM_PROXY_PREFIX_BYTES  (1)    //extranonce2 bytes taken for the client prefix
+#define  STRATUM_PROXY_PENDING       (64)   //forwarded submits awaiting the pool, power of two
+#define  STRATUM_PROXY_ID_MAX        (24)   //request id echoed back, raw json
+#define  STRATUM_PROXY_RX_BYTES      (1024) //longest line a client may send
+#define  STRATUM_PROXY_TX_BYTES      (4096) //per client output waiting for the socket, a few notify lines
+
+//sends a reply or notification line to one downstream client
+typedef size_t (*stratum_proxy_write_t)(uint8_t client, const char *data, size_t len, void *arg);
+
+/**
+ * @brief Stratum V1 server for downstream miners on top of one upstream session.
+ *
+ * Every client gets the upstream extranonce1 followed by its slot number as
+ * a STRATUM_PROXY_PREFIX_BYTES extranonce2 prefix, so their search spaces are
+ * disjoint and their shares are valid upstream shares. notify, difficulty
+ * and version mask lines of the pool are forwarded as they are. Submits go
+ * into the upstream submit queue tagged with the client, they share its
+ * single socket write and the local share check, and the pool answer is
+ * routed back by tag.
+ *
+ * The proxy knows nothing about sockets: the transport feeds received lines
+ * into on_line() and hands out what the write callback gets, without
+ * blocking. A client that did not ask for mining.extranonce.subscribe is
+ * sent client.reconnect when the upstream extranonce1 changes.
+ */
+class StratumProxy{
+private:
+    struct client_t {
+        bool        used;
+        bool        subscribed;
+        bool        authorized;
+        bool        extranonce;     //sent mining.extranonce.subscribe, takes set_extranonce
+        uint8_t     epoch;          //bumped per connection, answers for an older one are dropped
+    };
+    struct pending_t {
+        uint32_t    tag;
+        uint8_t     client;
+        uint8_t     epoch;
+        char        id[STRATUM_PROXY_ID_MAX + 1];
+    };
+    StratumClass           *_upstream;
+    stratum_proxy_write_t   _write;
+    void                   *_write_arg;
+    stratum_submit_cb_t     _chain_cb;//the upstream callback before the proxy took it, gets tag 0 results
+    void                   *_chain_arg;
+    client_t                _clients[STRATUM_PROXY_CLIENTS_MAX];
+    pending_t               _pending[STRATUM_PROXY_PENDING];
+    uint32_t                _next_tag;
+    String                  _last_notify;
+    StratumParser           _parser;
+    char                    _line[512];
+    uint32_t                _forwarded;
+    uint32_t                _answered;
+
+    void    _send(uint8_t client, const char *fmt, ...);
+    void    _broadcast(const char *data, size_t len);
+    bool    _extranonce(uint8_t client, char *extranonce1, size_t size, int *extranonce2_size);
+    void    _send_work(uint8_t client);
+    void    _subscribe(uint8_t client, const char *id);
+    void    _configure(uint8_t client, const char *id);
+    void    _submit(uint8_t client, const char *id, int params);
+    static void _on_result(const stratum_submit_result_t *result, void *arg);
+public:
+    StratumProxy(StratumClass *upstream, stratum_proxy_write_t write, void *arg);
+    ~StratumProxy();
+
+    int     open();
+    void    close(uint8_t client);
+    void    on_line(uint8_t client, const char *line, size_t len);
+    void    on_upstream(StratumClass *stratum, const stratum_method_data *method);
+    uint32_t get_forwarded(){
+        return this->_forwarded;
+    }
+    uint32_t get_answered(){
+        return this->_answered;
+    }
+};
+
+extern StratumProxy *g_stratum_proxy;
+
+#if STRATUM_PROXY_PORT
+void stratum_proxy_begin(StratumClass *upstream);
+void stratum_proxy_poll();
+#endif
+
+#endif
@@ -0,0 +1,56 @@
+#include "stratum_resume.h"
+#include "stratum_log.h"
+#include <Preferences.h>
+
+//NVS keys are 15 chars at most, the pool and worker are folded into a FNV-1a hash
+void stratum_resume_key(const char *url, uint16_t port, const char *user, char *key, size_t key_size){
+    uint32_t hash = 2166136261u;
+    auto mix = [&](const char *str){
+        for(const char *p = str; *p != '\0'; p++) hash = (hash ^ (uint8_t)*p) * 16777619u;
+        hash = (hash ^ 0xff) * 16777619u;//field separator
+    };
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%u", port);
+    mix(url);
+    mix(port_str);
+    mix(user);
+    snprintf(key, key_size, "s%08x", hash);
+}
+
+bool stratum_resume_load(const char *key, stratum_resume_t *resume){
+    Preferences prefs;
+    memset(resume, 0, sizeof(stratum_resume_t));
+    if(!prefs.begin(STRATUM_RESUME_NAMESPACE, true)) return false;
+    size_t len = prefs.getBytes(key, resume, sizeof(stratum_resume_t));
+    prefs.end();
+    if(len != sizeof(stratum_resume_t) || resume->magic != STRATUM_RESUME_MAGIC){
+        memset(resume, 0, sizeof(stratum_resume_t));
+        return false;
+    }
+    //never trust flash with an unterminated string
+    resume->session_id[sizeof(resume->session_id) - 1]   = '\0';
+    resume->extranonce1[sizeof(resume->extranonce1) - 1] = '\0';
+    return true;
+}
+
+bool stratum_resume_save(const char *key, const stratum_resume_t *resume){
+    Preferences prefs;
+    if(!prefs.begin(STRATUM_RESUME_NAMESPACE, false)){
+        LOG_E("Failed to open NVS namespace %s", STRATUM_RESUME_NAMESPACE);
+        return false;
+    }
+    size_t len = prefs.putBytes(key, resume, sizeof(stratum_resume_t));
+    prefs.end();
+    if(len != sizeof(stratum_resume_t)){
+        LOG_E("Failed to store stratum session %s", key);
+        return false;
+    }
+    return true;
+}
+
+void stratum_resume_forget(const char *key){
+    Preferences prefs;
+    if(!prefs.begin(STRATUM_RESUME_NAMESPACE, false)) return;
+    prefs.remove(key);
+    prefs.end();
+}
@@ -0,0 +1,35 @@
+#ifndef STRATUM_RESUME_H_
+#define STRATUM_RESUME_H_
+#include <Arduino.h>
+
+#define  STRATUM_RESUME_NAMESPACE  "stratum"
+#define  STRATUM_RESUME_MAGIC      (0x53525331) //bump when the record layout changes
+#define  STRATUM_SESSION_ID_MAX    (32)
+#define  STRATUM_RESUME_EN1_MAX    (64)         //hex chars, 2 * STRATUM_EXTRANONCE1_MAX
+#define  STRATUM_RESUME_HOLD_MS    (1000*60*2)  //longest outage whose queued jobs and shares outlive a resumed session
+#define  STRATUM_RESUME_SAVE_MS    (1000*30)    //a changed record waits this long before it goes to flash
+
+/**
+ * @brief What a stratum v1 session needs to carry on after a reconnect or a reboot.
+ *
+ * One record per pool url, port and worker lives in NVS. mining.subscribe
+ * offers the session id, a pool that honours it hands back the same
+ * extranonce1 and the jobs, shares and difficulty of the old session stay
+ * valid. Written only when a field changed, at most once per
+ * STRATUM_RESUME_SAVE_MS and right away when the connection drops.
+ */
+typedef struct {
+    uint32_t    magic;              //STRATUM_RESUME_MAGIC, anything else is no record
+    char        session_id[STRATUM_SESSION_ID_MAX + 1];
+    char        extranonce1[STRATUM_RESUME_EN1_MAX + 1];
+    uint8_t     extranonce2_size;
+    uint32_t    version_mask;
+    double      difficulty;
+} stratum_resume_t;
+
+void stratum_resume_key(const char *url, uint16_t port, const char *user, char *key, size_t key_size);
+bool stratum_resume_load(const char *key, stratum_resume_t *resume);
+bool stratum_resume_save(const char *key, const stratum_resume_t *resume);
+void stratum_resume_forget(const char *key);
+
+#endif
@@ -0,0 +1,95 @@
+#include "stratum_trace.h"
+#include "stratum_log.h"
+
+static stratum_trace_stats_t s_trace_stats;
+
+static const char *stage_names[STRATUM_TRACE_STAGES] = {
+    "total", "read", "parse", "decode", "log", "publish", "pop", "dispatch"
+};
+
+//bucket b holds [2^(b-1), 2^b), bucket 0 holds 0
+static uint8_t histogram_bucket(uint32_t value){
+    uint8_t b = (value == 0) ? 0 : 32 - __builtin_clz(value);
+    return (b >= STRATUM_HIST_BUCKETS) ? STRATUM_HIST_BUCKETS - 1 : b;
+}
+
+void stratum_histogram_add(stratum_histogram_t *hist, uint32_t value){
+    hist->bucket[histogram_bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    hist->count.fetch_add(1, std::memory_order_relaxed);
+    uint32_t max = hist->max.load(std::memory_order_relaxed);
+    while(value > max && !hist->max.compare_exchange_weak(max, value, std::memory_order_relaxed));
+}
+
+void stratum_histogram_clear(stratum_histogram_t *hist){
+    for(auto &bucket : hist->bucket) bucket.store(0, std::memory_order_relaxed);
+    hist->count.store(0, std::memory_order_relaxed);
+    hist->max.store(0, std::memory_order_relaxed);
+}
+
+//upper bound of the bucket the percentile falls in, never above the largest value seen
+uint32_t stratum_histogram_percentile(const stratum_histogram_t *hist, double p){
+    uint32_t count = hist->count.load(std::memory_order_relaxed);
+    uint32_t max   = hist->max.load(std::memory_order_relaxed);
+    if(count == 0) return 0;
+    uint32_t rank = (uint32_t)(p * count);
+    if(rank >= count) rank = count - 1;
+    uint32_t seen = 0;
+    for(uint8_t b = 0; b < STRATUM_HIST_BUCKETS; b++){
+        seen += hist->bucket[b].load(std::memory_order_relaxed);
+        if(seen > rank){
+            uint32_t upper = (b == 0) ? 0 : (uint32_t)((1ULL << b) - 1);
+            return (upper < max) ? upper : max;
+        }
+    }
+    return max;
+}
+
+const char *stratum_trace_stage_name(stratum_trace_stage_t stage){
+    return (stage < STRATUM_TRACE_STAGES) ? stage_names[stage] : "unknown";
+}
+
+/**
+ * @brief Adds the stage times of one dispatched job to the histograms.
+ *
+ * Stages that were not stamped are skipped, the time up to the next stamped
+ * stage is booked on that one.
+ */
+void stratum_trace_record(const stratum_job_trace_t *trace, bool clean){
+    if(!STRATUM_JOB_TRACE || trace->us[STRATUM_TRACE_RECV] == 0) return;
+    stratum_histogram_t *hist = s_trace_stats.stage[clean ? STRATUM_TRACE_CLEAN : STRATUM_TRACE_JOB];
+    uint32_t last = trace->us[STRATUM_TRACE_RECV];
+    for(int stage = STRATUM_TRACE_READ; stage < STRATUM_TRACE_STAGES; stage++){
+        if(trace->us[stage] == 0) continue;
+        stratum_histogram_add(&hist[stage], trace->us[stage] - last);
+        last = trace->us[stage];
+    }
+    stratum_histogram_add(&hist[0], last - trace->us[STRATUM_TRACE_RECV]);
+}
+
+const stratum_trace_stats_t *stratum_trace_stats(){
+    return &s_trace_stats;
+}
+
+void stratum_trace_clear(){
+    for(auto &kind : s_trace_stats.stage){
+        for(auto &hist : kind) stratum_histogram_clear(&hist);
+    }
+}
+
+//logs p50/p99 per stage at most once per interval, called from the stratum thread
+void stratum_trace_report(uint32_t interval_ms){
+    static uint32_t last_ms = 0;
+    if(!STRATUM_JOB_TRACE || millis() - last_ms < interval_ms) return;
+    last_ms = millis();
+    for(int kind = 0; kind < STRATUM_TRACE_KIND_MAX; kind++){
+        const stratum_histogram_t *hist = s_trace_stats.stage[kind];
+        uint32_t count = hist[0].count.load(std::memory_order_relaxed);
+        if(count == 0) continue;
+        LOG_I("Job path [%s], %u jobs, p50/p99/max us:", (kind == STRATUM_TRACE_CLEAN) ? "clean" : "job", count);
+        for(int stage = 0; stage < STRATUM_TRACE_STAGES; stage++){
+            if(hist[stage].count.load(std::memory_order_relaxed) == 0) continue;
+            LOG_I("  %-9s %7u %7u %7u", stage_names[stage], stratum_histogram_percentile(&hist[stage], 0.50),
+                  stratum_histogram_percentile(&hist[stage], 0.99), hist[stage].max.load(std::memory_order_relaxed));
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef STRATUM_TRACE_H_
+#define STRATUM_TRACE_H_
+#include <Arduino.h>
+#include <atomic>
+
+#ifndef STRATUM_JOB_TRACE
+#define  STRATUM_JOB_TRACE         (1)  //stamp every job from the socket to the asic
+#endif
+#define  STRATUM_TRACE_REPORT_MS   (1000*60*10)
+#define  STRATUM_HIST_BUCKETS      (24) //log2 buckets, the last one takes everything above 2^22
+
+//stages a job passes on its way from the socket to the asic, in order
+typedef enum {
+    STRATUM_TRACE_RECV = 0,     //listen_methods() entered, data is waiting on the socket
+    STRATUM_TRACE_READ,         //line or frame read
+    STRATUM_TRACE_PARSE,        //tokenized and decoded into stratum_method_data
+    STRATUM_TRACE_DECODE,       //binary job record built
+    STRATUM_TRACE_LOG,          //debug dump written
+    STRATUM_TRACE_PUBLISH,      //in the job ring, visible to the asic tx thread
+    STRATUM_TRACE_POP,          //asic tx thread woke up and took it
+    STRATUM_TRACE_DISPATCH,     //written to the asic
+    STRATUM_TRACE_STAGES
+} stratum_trace_stage_t;
+
+//micros() per stage, 0 when the stage was not reached
+typedef struct {
+    uint32_t    us[STRATUM_TRACE_STAGES];
+} stratum_job_trace_t;
+
+//lock free log2 histogram, one writer, readers may see a count mid update
+typedef struct {
+    std::atomic<uint32_t>   bucket[STRATUM_HIST_BUCKETS];
+    std::atomic<uint32_t>   count;
+    std::atomic<uint32_t>   max;
+} stratum_histogram_t;
+
+typedef enum {
+    STRATUM_TRACE_JOB = 0,      //jobs stacked on the current block
+    STRATUM_TRACE_CLEAN,        //clean_jobs, every share on the old ones is stale
+    STRATUM_TRACE_KIND_MAX
+} stratum_trace_kind_t;
+
+//histogram i holds the time from stage i-1 to stage i, slot 0 the whole path
+typedef struct {
+    stratum_histogram_t     stage[STRATUM_TRACE_KIND_MAX][STRATUM_TRACE_STAGES];
+} stratum_trace_stats_t;
+
+void        stratum_histogram_add(stratum_histogram_t *hist, uint32_t value);
+void        stratum_histogram_clear(stratum_histogram_t *hist);
+uint32_t    stratum_histogram_percentile(const stratum_histogram_t *hist, double p);
+
+#if STRATUM_JOB_TRACE
+static inline void stratum_trace_stamp(stratum_job_trace_t *trace, stratum_trace_stage_t stage){
+    trace->us[stage] = micros();
+}
+#else
+static inline void stratum_trace_stamp(stratum_job_trace_t *trace, stratum_trace_stage_t stage){}
+#endif
+
+const char                  *stratum_trace_stage_name(stratum_trace_stage_t stage);
+void                         stratum_trace_record(const stratum_job_trace_t *trace, bool clean);
+const stratum_trace_stats_t *stratum_trace_stats();
+void                         stratum_trace_clear();
+void                         stratum_trace_report(uint32_t interval_ms);
+
+#endif
@@ -0,0 +1,498 @@
+#include "stratum_v2.h"
+#include "stratum_metrics.h"
+#include "stratum_work.h"
+#include "stratum_log.h"
+#include "stratum_arena.h"
+#include "stratum_capture.h"
+#include "global.h"
+#include <math.h>
+
+const uint8_t *StratumV2Reader::_take(size_t n){
+    if(!this->_ok || this->_len - this->_pos < n){
+        this->_ok = false;
+        return NULL;
+    }
+    const uint8_t *p = this->_p + this->_pos;
+    this->_pos += n;
+    return p;
+}
+
+uint8_t StratumV2Reader::u8(){
+    const uint8_t *p = this->_take(1);
+    return p ? p[0] : 0;
+}
+
+uint16_t StratumV2Reader::u16(){
+    const uint8_t *p = this->_take(2);
+    return p ? (p[0] | (p[1] << 8)) : 0;
+}
+
+uint32_t StratumV2Reader::u32(){
+    const uint8_t *p = this->_take(4);
+    return p ? (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24)) : 0;
+}
+
+uint64_t StratumV2Reader::u64(){
+    uint64_t lo = this->u32();
+    return lo | ((uint64_t)this->u32() << 32);
+}
+
+const uint8_t *StratumV2Reader::u256(){
+    return this->_take(32);
+}
+
+stratum_str_t StratumV2Reader::str255(){
+    uint8_t len = this->u8();
+    const uint8_t *p = this->_take(len);
+    return {p ? (const char*)p : "", p ? len : (size_t)0};
+}
+
+const uint8_t *StratumV2Reader::b32(uint8_t *len){
+    *len = this->u8();
+    if(*len > 32) this->_ok = false;
+    return this->_take(*len);
+}
+
+const uint8_t *StratumV2Reader::b64k(uint16_t *len){
+    *len = this->u16();
+    return this->_take(*len);
+}
+
+uint8_t *StratumV2Writer::_take(size_t n){
+    if(!this->_ok || this->_cap - this->_pos < n){
+        this->_ok = false;
+        return NULL;
+    }
+    uint8_t *p = this->_p + this->_pos;
+    this->_pos += n;
+    return p;
+}
+
+void StratumV2Writer::begin(uint16_t extension, uint8_t type){
+    this->_frame = this->_pos;
+    this->u16(extension);
+    this->u8(type);
+    this->bytes((const uint8_t*)"\0\0\0", 3);
+}
+
+size_t StratumV2Writer::end(){
+    if(!this->_ok) return 0;
+    size_t len = this->_pos - this->_frame - STRATUM_V2_FRAME_HEADER;
+    uint8_t *p = this->_p + this->_frame + 3;
+    p[0] = len & 0xff;
+    p[1] = (len >> 8) & 0xff;
+    p[2] = (len >> 16) & 0xff;
+    return this->_pos - this->_frame;
+}
+
+void StratumV2Writer::u8(uint8_t val){
+    uint8_t *p = this->_take(1);
+    if(p) p[0] = val;
+}
+
+void StratumV2Writer::u16(uint16_t val){
+    uint8_t *p = this->_take(2);
+    if(p){
+        p[0] = val & 0xff;
+        p[1] = val >> 8;
+    }
+}
+
+void StratumV2Writer::u32(uint32_t val){
+    uint8_t *p = this->_take(4);
+    if(p){
+        p[0] = val & 0xff;
+        p[1] = (val >> 8) & 0xff;
+        p[2] = (val >> 16) & 0xff;
+        p[3] = (val >> 24) & 0xff;
+    }
+}
+
+void StratumV2Writer::f32(float val){
+    uint32_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    this->u32(bits);
+}
+
+void StratumV2Writer::bytes(const uint8_t *data, size_t n){
+    uint8_t *p = this->_take(n);
+    if(p && n) memcpy(p, data, n);
+}
+
+void StratumV2Writer::str255(const char *str, size_t len){
+    if(len > 255) len = 255;
+    this->u8(len);
+    this->bytes((const uint8_t*)str, len);
+}
+
+void StratumV2Writer::b32(const uint8_t *data, size_t n){
+    if(n > 32){
+        this->_ok = false;
+        return;
+    }
+    this->u8(n);
+    this->bytes(data, n);
+}
+
+size_t stratum_v2_next_frame_size(const stratum_v2_session_t *v2){
+    size_t avail = v2->rx_len - v2->rx_used;
+    if(avail < STRATUM_V2_FRAME_HEADER) return 0;
+    const uint8_t *h = v2->rx + v2->rx_used;
+    size_t size = STRATUM_V2_FRAME_HEADER + (h[3] | (h[4] << 8) | (h[5] << 16));
+    return (size <= avail) ? size : 0;
+}
+
+//U256 targets are little endian
+static double target_to_difficulty(const uint8_t *target){
+    double val = 0;
+    for(int i = 31; i >= 0; i--) val = val * 256.0 + target[i];
+    return (val > 0) ? ldexp(65535.0, 208) / val : 0;
+}
+
+//stratum v1 sends prevhash with every 32-bit word byte swapped, pool_job_data_t keeps that order
+static void prevhash_from_u256(const uint8_t *u256, uint8_t prevhash[32]){
+    for(int i = 0; i < 32; i++) prevhash[i] = u256[(i & ~3) + 3 - (i & 3)];
+}
+
+void StratumClass::_v2_clear(){
+    stratum_v2_session_t *v2 = this->_v2;
+    for(auto &job : v2->future){
+        if(job != NULL) stratum_job_free(job);
+        job = NULL;
+    }
+    v2->future_next  = 0;
+    v2->rx_len       = 0;
+    v2->rx_used      = 0;
+    v2->has_prevhash = false;
+    v2->channel_id   = 0;
+}
+
+bool StratumClass::_v2_frame(stratum_v2_frame_t *frame){
+    stratum_v2_session_t *v2 = this->_v2;
+    if(v2->rx_used > 0){
+        memmove(v2->rx, v2->rx + v2->rx_used, v2->rx_len - v2->rx_used);
+        v2->rx_len -= v2->rx_used;
+        v2->rx_used = 0;
+    }
+    if(v2->rx_len < sizeof(v2->rx)){
+        int n = this->pool->read(v2->rx + v2->rx_len, sizeof(v2->rx) - v2->rx_len);
+        if(n > 0){
+            stratum_capture(STRATUM_CAPTURE_RX_BYTES, v2->rx + v2->rx_len, n);
+            v2->rx_len += n;
+        }
+        stratum_metrics_bytes(g_stratum_metrics.bytes_in, n);
+    }
+    if(v2->rx_len < STRATUM_V2_FRAME_HEADER) return false;
+
+    size_t size = STRATUM_V2_FRAME_HEADER + (v2->rx[3] | (v2->rx[4] << 8) | (v2->rx[5] << 16));
+    if(size > sizeof(v2->rx)){
+        //can not resync a byte stream, start over
+        LOG_E("Stratum V2 frame of %d bytes is too large, reconnecting...", (int)size);
+        this->pool->end();
+        v2->rx_len = 0;
+        return false;
+    }
+    if(v2->rx_len < size) return false;
+
+    frame->extension = (v2->rx[0] | (v2->rx[1] << 8)) & ~STRATUM_V2_CHANNEL_MSG;
+    frame->type      = v2->rx[2];
+    frame->payload   = v2->rx + STRATUM_V2_FRAME_HEADER;
+    frame->len       = size - STRATUM_V2_FRAME_HEADER;
+    v2->rx_used      = size;
+    return true;
+}
+
+//handshake only, frames of any other type are dropped while waiting
+bool StratumClass::_v2_wait(uint8_t type, uint8_t error_type, stratum_v2_frame_t *frame, uint32_t timeout_ms){
+    uint32_t start = millis();
+    while(millis() - start < timeout_ms){
+        if(!this->_v2_frame(frame)){
+            if(!this->pool->is_connected()) return false;
+            delay(10);
+            continue;
+        }
+        if(frame->extension != 0) continue;
+        if(frame->type == type) return true;
+        if(frame->type == error_type){
+            StratumV2Reader rd(frame->payload, frame->len);
+            rd.u32();//flags or request id
+            stratum_str_t code = rd.str255();
+            LOG_E("Stratum V2 request refused : %.*s", (int)code.len, code.ptr);
+            return false;
+        }
+        LOG_D("Stratum V2 message 0x%02x ignored during handshake", frame->type);
+    }
+    LOG_E("Stratum V2 response 0x%02x timed out", type);
+    return false;
+}
+
+/**
+ * @brief SetupConnection and OpenExtendedMiningChannel, the v2 subscribe.
+ *
+ * The extranonce prefix becomes extranonce1 and the rolled extranonce size
+ * extranonce2_size, so work is built exactly as for a v1 pool.
+ */
+bool StratumClass::_v2_subscribe(){
+    if(this->_v2 == NULL){
+        this->_v2 = new stratum_v2_session_t();
+        memset(this->_v2, 0, sizeof(stratum_v2_session_t));
+    }
+    this->_v2_clear();
+    this->_sub_info.extranonce2 = 0;
+    this->_sub_info.extranonce2_size = 0;
+    this->_is_subscribed = false;
+
+    uint8_t buf[512];
+    StratumV2Writer wr(buf, sizeof(buf));
+    String host  = this->_pool_info.url;
+    String model = g_nmaxe.board.hw_model;
+    wr.begin(0, SV2_SETUP_CONNECTION);
+    wr.u8(0);//mining protocol
+    wr.u16(2);
+    wr.u16(2);
+    wr.u32(SV2_REQUIRES_VERSION_ROLLING);
+    wr.str255(host.c_str(), host.length());
+    wr.u16(this->_pool_info.port);
+    wr.str255("NMAxe", 5);
+    wr.str255(model.c_str(), model.length());
+    wr.str255(CURRENT_FW_VERSION, strlen(CURRENT_FW_VERSION));
+    wr.str255("", 0);
+    size_t len = wr.end();
+    if(len == 0 || this->_pool_write(buf, len) != len){
+        LOG_E("Failed to send SetupConnection");
+        return false;
+    }
+    stratum_v2_frame_t frame;
+    if(!this->_v2_wait(SV2_SETUP_CONNECTION_SUCCESS, SV2_SETUP_CONNECTION_ERROR, &frame, 1000*10)) return false;
+
+    uint32_t request_id = this->_get_msg_id();
+    uint8_t  max_target[32];
+    memset(max_target, 0xff, sizeof(max_target));
+    wr = StratumV2Writer(buf, sizeof(buf));
+    wr.begin(0, SV2_OPEN_EXTENDED_CHANNEL);
+    wr.u32(request_id);
+    wr.str255(this->_stratum_info.user.c_str(), this->_stratum_info.user.length());
+    wr.f32(this->_diff_ctl->get_nominal_hashrate());
+    wr.bytes(max_target, sizeof(max_target));
+    wr.u16(STRATUM_V2_EXTRANONCE_SIZE);
+    len = wr.end();
+    if(len == 0 || this->_pool_write(buf, len) != len){
+        LOG_E("Failed to send OpenExtendedMiningChannel");
+        return false;
+    }
+    if(!this->_v2_wait(SV2_OPEN_EXTENDED_CHANNEL_SUCCESS, SV2_OPEN_CHANNEL_ERROR, &frame, 1000*10)) return false;
+
+    StratumV2Reader rd(frame.payload, frame.len);
+    rd.u32();//request id
+    uint32_t       channel_id  = rd.u32();
+    const uint8_t *target      = rd.u256();
+    uint16_t       en2_size    = rd.u16();
+    uint8_t        prefix_len  = 0;
+    const uint8_t *prefix      = rd.b32(&prefix_len);
+    if(!rd.ok() || en2_size == 0 || en2_size > STRATUM_EXTRANONCE2_MAX){
+        LOG_E("Invalid OpenExtendedMiningChannel.Success, extranonce size %d", en2_size);
+        return false;
+    }
+    this->_v2->channel_id = channel_id;
+    stratum_hex_encode(prefix, prefix_len, this->_v2->extranonce_hex);
+    this->_sub_info.extranonce1      = String(this->_v2->extranonce_hex);
+    this->_sub_info.extranonce2_size = en2_size;
+    this->set_pool_difficulty(target_to_difficulty(target));
+    this->_is_subscribed = true;
+    this->_is_authorized = true;
+    LOG_I("Stratum V2 channel %u opened", channel_id);
+    LOG_I("extranonce1 : %s", this->_sub_info.extranonce1.c_str());
+    LOG_I("extranonce2 size : %d", this->_sub_info.extranonce2_size);
+    return true;
+}
+
+//the v2 counterpart of suggest_difficulty, also serves as keepalive
+bool StratumClass::_v2_update_channel(){
+    if(this->_v2 == NULL || !this->_is_subscribed) return false;
+    uint8_t buf[64];
+    uint8_t max_target[32];
+    memset(max_target, 0xff, sizeof(max_target));
+    StratumV2Writer wr(buf, sizeof(buf));
+    wr.begin(STRATUM_V2_CHANNEL_MSG, SV2_UPDATE_CHANNEL);
+    wr.u32(this->_v2->channel_id);
+    wr.f32(this->_diff_ctl->get_nominal_hashrate());
+    wr.bytes(max_target, sizeof(max_target));
+    size_t len = wr.end();
+    return (len != 0) && (this->_pool_write(buf, len) == len);
+}
+
+size_t StratumClass::_v2_encode_submit(const stratum_share_t *share, stratum_msg_rsp_id_t seq, uint8_t *out, size_t cap){
+    uint8_t en2[STRATUM_EXTRANONCE2_MAX];
+    size_t  en2_len = strlen(share->extranonce2) / 2;
+    if(en2_len > sizeof(en2) || !stratum_hex_decode({share->extranonce2, 2 * en2_len}, en2, en2_len)) return 0;
+
+    //v2 wants the full version, v1 shares carry the rolled bits under the mask
+    const pool_job_data_t *job = (this->_share_validator != NULL) ? this->_share_validator->find_job(share->job_id) : NULL;
+    uint32_t version = (job != NULL) ? ((job->version & ~this->_vr_mask) | (share->version & this->_vr_mask)) : share->version;
+
+    StratumV2Writer wr(out, cap);
+    wr.begin(STRATUM_V2_CHANNEL_MSG, SV2_SUBMIT_SHARES_EXTENDED);
+    wr.u32(this->_v2->channel_id);
+    wr.u32(seq);
+    wr.u32(strtoul(share->job_id, NULL, 10));
+    wr.u32(share->nonce);
+    wr.u32(share->ntime);
+    wr.u32(version);
+    wr.b32(en2, en2_len);
+    return wr.end();
+}
+
+stratum_method_data StratumClass::_v2_listen(){
+    stratum_method_data method = {};
+    method.id   = -1;
+    method.type = STRATUM_DOWN_NONE;
+    method.name = "";
+    method.raw  = {"", 0};
+
+    stratum_v2_session_t *v2 = this->_v2;
+    stratum_v2_frame_t    frame;
+    stratum_trace_stamp(&method.trace, STRATUM_TRACE_RECV);
+    if(v2 == NULL || !this->_v2_frame(&frame)) return method;
+    stratum_trace_stamp(&method.trace, STRATUM_TRACE_READ);
+
+    StratumV2Reader rd(frame.payload, frame.len);
+    method.type = STRATUM_DOWN_UNKNOWN;
+    switch(frame.type){
+        case SV2_NEW_EXTENDED_MINING_JOB:{
+            method.name = "NewExtendedMiningJob";
+            rd.u32();//channel id
+            uint32_t job_id      = rd.u32();
+            bool     has_ntime   = rd.u8() != 0;
+            uint32_t min_ntime   = has_ntime ? rd.u32() : 0;
+            uint32_t version     = rd.u32();
+            rd.u8();//version rolling allowed
+            uint8_t  merkle_count = rd.u8();
+            const uint8_t *merkle = rd.bytes(32 * merkle_count);
+            uint16_t coinb1_len = 0, coinb2_len = 0;
+            const uint8_t *coinb1 = rd.b64k(&coinb1_len);
+            const uint8_t *coinb2 = rd.b64k(&coinb2_len);
+            if(!rd.ok() || merkle_count > STRATUM_MAX_MERKLE_BRANCH){
+                method.type = STRATUM_DOWN_PARSE_ERROR;
+                break;
+            }
+            char id[11];
+            int  id_len = snprintf(id, sizeof(id), "%u", job_id);
+            pool_job_data_t *job = stratum_job_alloc(id, id_len, coinb1_len, coinb2_len, merkle_count);
+            if(job == NULL){
+                method.type = STRATUM_DOWN_PARSE_ERROR;
+                break;
+            }
+            job->version = version;
+            memcpy((uint8_t*)job->coinb1(), coinb1, coinb1_len);
+            memcpy((uint8_t*)job->coinb2(), coinb2, coinb2_len);
+            if(merkle_count) memcpy((uint8_t*)job->merkle(0), merkle, 32 * merkle_count);
+
+            if(!has_ntime){
+                //future job, waits for the SetNewPrevHash that names it
+                pool_job_data_t **slot = &v2->future[v2->future_next];
+                if(*slot != NULL) stratum_job_free(*slot);
+                *slot = job;
+                v2->future_next = (v2->future_next + 1) % STRATUM_V2_FUTURE_JOBS;
+                method.type = STRATUM_DOWN_NONE;
+                break;
+            }
+            if(!v2->has_prevhash){
+                LOG_W("Stratum V2 job %u before any prevhash, dropped", job_id);
+                stratum_job_free(job);
+                method.type = STRATUM_DOWN_NONE;
+                break;
+            }
+            memcpy(job->prevhash, v2->prevhash, sizeof(job->prevhash));
+            job->nbits      = v2->nbits;
+            job->ntime      = min_ntime;
+            job->clean_jobs = false;
+            method.type = STRATUM_DOWN_JOB;
+            method.job  = job;
+        }
+            break;
+        case SV2_SET_NEW_PREV_HASH:{
+            method.name = "SetNewPrevHash";
+            rd.u32();//channel id
+            uint32_t       job_id    = rd.u32();
+            const uint8_t *prevhash  = rd.u256();
+            uint32_t       min_ntime = rd.u32();
+            uint32_t       nbits     = rd.u32();
+            if(!rd.ok()){
+                method.type = STRATUM_DOWN_PARSE_ERROR;
+                break;
+            }
+            stratum_arena_rotate();//a new block, the jobs allocated from here on are the next generation
+            prevhash_from_u256(prevhash, v2->prevhash);
+            v2->nbits        = nbits;
+            v2->min_ntime    = min_ntime;
+            v2->has_prevhash = true;
+
+            char id[11];
+            snprintf(id, sizeof(id), "%u", job_id);
+            method.type = STRATUM_DOWN_NONE;
+            for(auto &job : v2->future){
+                if(job == NULL || strcmp(job->id(), id) != 0) continue;
+                memcpy(job->prevhash, v2->prevhash, sizeof(job->prevhash));
+                job->nbits      = nbits;
+                job->ntime      = min_ntime;
+                job->clean_jobs = true;//new block
+                method.type = STRATUM_DOWN_JOB;
+                method.job  = job;
+                job = NULL;
+                break;
+            }
+            if(method.type == STRATUM_DOWN_NONE) LOG_W("SetNewPrevHash for unknown job %u", job_id);
+        }
+            break;
+        case SV2_SET_TARGET:
+            method.name = "SetTarget";
+            rd.u32();//channel id
+            method.type = STRATUM_DOWN_SET_DIFFICULTY;
+            method.difficulty = rd.ok() ? target_to_difficulty(rd.u256()) : 0;
+            if(!rd.ok()) method.type = STRATUM_DOWN_PARSE_ERROR;
+            break;
+        case SV2_SET_EXTRANONCE_PREFIX:{
+            method.name = "SetExtranoncePrefix";
+            rd.u32();//channel id
+            uint8_t        prefix_len = 0;
+            const uint8_t *prefix     = rd.b32(&prefix_len);
+            if(!rd.ok()){
+                method.type = STRATUM_DOWN_PARSE_ERROR;
+                break;
+            }
+            stratum_hex_encode(prefix, prefix_len, v2->extranonce_hex);
+            method.type = STRATUM_DOWN_SET_EXTRANONCE;
+            method.extranonce1 = {v2->extranonce_hex, 2 * (size_t)prefix_len};
+            method.extranonce2_size = this->_sub_info.extranonce2_size;
+        }
+            break;
+        case SV2_SUBMIT_SHARES_SUCCESS:
+            method.name = "SubmitShares.Success";
+            rd.u32();//channel id
+            method.id         = rd.u32();//last sequence number
+            method.type       = rd.ok() ? STRATUM_DOWN_SUCCESS : STRATUM_DOWN_PARSE_ERROR;
+            method.has_result = true;
+            method.result     = true;
+            method.batch      = true;
+            break;
+        case SV2_SUBMIT_SHARES_ERROR:
+            method.name = "SubmitShares.Error";
+            rd.u32();//channel id
+            method.id    = rd.u32();
+            method.error = rd.str255();
+            method.type  = rd.ok() ? STRATUM_DOWN_ERROR : STRATUM_DOWN_PARSE_ERROR;
+            break;
+        case SV2_RECONNECT:
+        case SV2_CLOSE_CHANNEL:
+            LOG_W("Pool closed the stratum v2 channel, reconnecting...");
+            this->pool->end();
+            method.type = STRATUM_DOWN_NONE;
+            break;
+        default:
+            LOG_D("Stratum V2 message 0x%02x ignored", frame.type);
+            method.type = STRATUM_DOWN_NONE;
+            break;
+    }
+    stratum_trace_stamp(&method.trace, STRATUM_TRACE_PARSE);
+    return method;
+}
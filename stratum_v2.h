@@ -0,0 +1,117 @@
+#ifndef STRATUM_V2_H_
+#define STRATUM_V2_H_
+#include <Arduino.h>
+#include "stratum.h"
+
+#define  STRATUM_V2_FRAME_HEADER      (6)
+#define  STRATUM_V2_FRAME_MAX         (1024*8)
+#define  STRATUM_V2_FUTURE_JOBS       (4)
+#define  STRATUM_V2_EXTRANONCE_SIZE   (4)  //extranonce bytes the miner rolls, asked for when opening the channel
+#define  STRATUM_V2_CHANNEL_MSG       (0x8000)
+
+typedef enum {
+    SV2_SETUP_CONNECTION                = 0x00,
+    SV2_SETUP_CONNECTION_SUCCESS        = 0x01,
+    SV2_SETUP_CONNECTION_ERROR          = 0x02,
+    SV2_OPEN_CHANNEL_ERROR              = 0x12,
+    SV2_OPEN_EXTENDED_CHANNEL           = 0x13,
+    SV2_OPEN_EXTENDED_CHANNEL_SUCCESS   = 0x14,
+    SV2_UPDATE_CHANNEL                  = 0x16,
+    SV2_UPDATE_CHANNEL_ERROR            = 0x17,
+    SV2_CLOSE_CHANNEL                   = 0x18,
+    SV2_SET_EXTRANONCE_PREFIX           = 0x19,
+    SV2_SUBMIT_SHARES_EXTENDED          = 0x1b,
+    SV2_SUBMIT_SHARES_SUCCESS           = 0x1c,
+    SV2_SUBMIT_SHARES_ERROR             = 0x1d,
+    SV2_NEW_EXTENDED_MINING_JOB         = 0x1f,
+    SV2_SET_NEW_PREV_HASH               = 0x20,
+    SV2_SET_TARGET                      = 0x21,
+    SV2_RECONNECT                       = 0x25
+} stratum_v2_msg_t;
+
+//SetupConnection flags of the mining protocol
+#define  SV2_REQUIRES_VERSION_ROLLING (1 << 2)
+
+struct stratum_v2_frame_t {
+    uint16_t        extension;
+    uint8_t         type;
+    const uint8_t  *payload;
+    size_t          len;
+};
+
+//bounds checked little endian field reader, a short payload latches ok() to false
+class StratumV2Reader{
+private:
+    const uint8_t  *_p;
+    size_t          _len;
+    size_t          _pos;
+    bool            _ok;
+    const uint8_t  *_take(size_t n);
+public:
+    StratumV2Reader(const uint8_t *p, size_t len):_p(p), _len(len), _pos(0), _ok(true){};
+
+    bool            ok(){ return this->_ok; }
+    uint8_t         u8();
+    uint16_t        u16();
+    uint32_t        u32();
+    uint64_t        u64();
+    const uint8_t  *u256();
+    const uint8_t  *bytes(size_t n){ return this->_take(n); }
+    stratum_str_t   str255();                      //STR0_255
+    const uint8_t  *b32(uint8_t *len);             //B0_32
+    const uint8_t  *b64k(uint16_t *len);           //B0_64K
+};
+
+//frame builder over a caller owned buffer, overflow latches ok() to false
+class StratumV2Writer{
+private:
+    uint8_t        *_p;
+    size_t          _cap;
+    size_t          _pos;
+    size_t          _frame;
+    bool            _ok;
+    uint8_t        *_take(size_t n);
+public:
+    StratumV2Writer(uint8_t *p, size_t cap):_p(p), _cap(cap), _pos(0), _frame(0), _ok(true){};
+
+    bool            ok(){ return this->_ok; }
+    size_t          length(){ return this->_pos; }
+    void            begin(uint16_t extension, uint8_t type);
+    size_t          end();  //patches the payload length, returns the frame size
+    void            u8(uint8_t val);
+    void            u16(uint16_t val);
+    void            u32(uint32_t val);
+    void            f32(float val);
+    void            bytes(const uint8_t *data, size_t n);
+    void            str255(const char *str, size_t len);
+    void            b32(const uint8_t *data, size_t n);
+};
+
+/**
+ * @brief Stratum V2 state of one pool session.
+ *
+ * The session runs a single extended channel: jobs keep the coinbase
+ * prefix/suffix and the merkle path, so they decode into the same
+ * pool_job_data_t as mining.notify and the extranonce prefix takes the
+ * place of extranonce1. Frames are plain, the Noise handshake is not
+ * spoken, so the pool end must accept unencrypted connections. That is
+ * why the client is only built in with STRATUM_V2, for development pools.
+ */
+struct stratum_v2_session_t {
+    uint32_t            channel_id;
+    uint8_t             rx[STRATUM_V2_FRAME_MAX];
+    size_t              rx_len;
+    size_t              rx_used;    //frame handed out last, dropped on the next read
+    pool_job_data_t    *future[STRATUM_V2_FUTURE_JOBS];//waiting for their SetNewPrevHash
+    uint8_t             future_next;
+    bool                has_prevhash;
+    uint8_t             prevhash[32];//stratum v1 wire order, as in pool_job_data_t
+    uint32_t            nbits;
+    uint32_t            min_ntime;
+    char                extranonce_hex[2 * 32 + 1];
+};
+
+//size of the complete frame after the one handed out last, 0 if it is not all buffered yet
+size_t stratum_v2_next_frame_size(const stratum_v2_session_t *v2);
+
+#endif
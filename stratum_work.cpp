@@ -0,0 +1,385 @@
+#include "stratum_work.h"
+#include "stratum_log.h"
+#include <math.h>
+
+void stratum_sha256d(const uint8_t *data, size_t len, uint8_t hash[32]){
+    uint8_t first[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(first);
+    CSHA256().Write(first, sizeof(first)).Finalize(hash);
+}
+
+//lowest STRATUM_VERSION_BITS_MAX set bits of the mask, the rest stays as the job has it
+uint32_t stratum_version_mask_cap(uint32_t mask){
+    uint32_t capped = 0;
+    for(int i = 0; i < STRATUM_VERSION_BITS_MAX && mask != 0; i++){
+        uint32_t bit = mask & (~mask + 1);
+        capped |= bit;
+        mask &= ~bit;
+    }
+    return capped;
+}
+
+uint32_t stratum_version_variants(uint32_t mask){
+    uint32_t bits = __builtin_popcount(mask);
+    return 1u << ((bits > STRATUM_VERSION_BITS_MAX) ? STRATUM_VERSION_BITS_MAX : bits);
+}
+
+//spreads the bits of index over the set bits of mask, lowest first
+uint32_t stratum_version_bits(uint32_t mask, uint32_t index){
+    uint32_t bits = 0;
+    for(uint32_t bit = 1; mask != 0 && index != 0; bit <<= 1){
+        if(mask & bit){
+            if(index & 1) bits |= bit;
+            index >>= 1;
+            mask &= ~bit;
+        }
+    }
+    return bits;
+}
+
+//inverse of stratum_version_bits()
+uint32_t stratum_version_index(uint32_t mask, uint32_t bits){
+    uint32_t index = 0;
+    uint32_t shift = 0;
+    for(uint32_t bit = 1; mask != 0; bit <<= 1){
+        if(mask & bit){
+            if(bits & bit) index |= 1u << shift;
+            shift++;
+            mask &= ~bit;
+        }
+    }
+    return index;
+}
+
+static void put_extranonce2(uint64_t extranonce2, uint8_t size, uint8_t *out){
+    for(int i = size - 1; i >= 0; i--){
+        out[i] = extranonce2 & 0xff;
+        extranonce2 >>= 8;
+    }
+}
+
+bool StratumWorkEngine::begin(const pool_job_data_t *job, const uint8_t *extranonce1, size_t extranonce1_len, uint8_t extranonce2_size, uint64_t extranonce2_start){
+    if(job == NULL || extranonce2_size == 0 || extranonce2_size > STRATUM_EXTRANONCE2_MAX){
+        LOG_E("Invalid work params, extranonce2 size %d", extranonce2_size);
+        this->_job = NULL;
+        return false;
+    }
+    this->_job               = job;
+    this->_extranonce2_size  = extranonce2_size;
+    this->_extranonce2_mask  = (extranonce2_size >= 8) ? UINT64_MAX : ((1ULL << (8 * extranonce2_size)) - 1);
+    this->_extranonce2       = extranonce2_start & this->_extranonce2_mask;
+    this->_prefix.Reset();
+    this->_prefix.Write(job->coinb1(), job->coinb1_len);
+    this->_prefix.Write(extranonce1, extranonce1_len);
+    return true;
+}
+
+bool StratumWorkEngine::begin(const pool_job_data_t *job, const String &extranonce1, uint8_t extranonce2_size, uint64_t extranonce2_start){
+    uint8_t en1[STRATUM_EXTRANONCE1_MAX];
+    size_t  en1_len = extranonce1.length() / 2;
+    if(en1_len > sizeof(en1) || !stratum_hex_decode({extranonce1.c_str(), extranonce1.length()}, en1, en1_len)){
+        LOG_E("Invalid extranonce1 : %s", extranonce1.c_str());
+        this->_job = NULL;
+        return false;
+    }
+    return this->begin(job, en1, en1_len, extranonce2_size, extranonce2_start);
+}
+
+void StratumWorkEngine::merkle_root(uint64_t extranonce2, uint8_t root[32]){
+    uint8_t en2[STRATUM_EXTRANONCE2_MAX];
+    uint8_t first[CSHA256::OUTPUT_SIZE];
+    put_extranonce2(extranonce2, this->_extranonce2_size, en2);
+
+    //coinbase txid from the cached midstate, only the tail is hashed here
+    CSHA256 ctx = this->_prefix;
+    ctx.Write(en2, this->_extranonce2_size).Write(this->_job->coinb2(), this->_job->coinb2_len).Finalize(first);
+    CSHA256().Write(first, sizeof(first)).Finalize(root);
+
+    uint8_t pair[64];
+    for(uint8_t i = 0; i < this->_job->merkle_count; i++){
+        memcpy(pair, root, 32);
+        memcpy(pair + 32, this->_job->merkle(i), 32);
+        stratum_sha256d(pair, sizeof(pair), root);
+    }
+}
+
+size_t StratumWorkEngine::next(stratum_work_t *works, size_t count){
+    if(this->_job == NULL) return 0;
+    for(size_t i = 0; i < count; i++){
+        works[i].extranonce2 = this->_extranonce2;
+        this->merkle_root(this->_extranonce2, works[i].merkle_root);
+        this->_extranonce2 = (this->_extranonce2 + 1) & this->_extranonce2_mask;
+    }
+    return count;
+}
+
+//writes 2*extranonce2_size chars plus the terminator
+void StratumWorkEngine::extranonce2_hex(uint64_t extranonce2, char *out){
+    uint8_t en2[STRATUM_EXTRANONCE2_MAX];
+    put_extranonce2(extranonce2, this->_extranonce2_size, en2);
+    stratum_hex_encode(en2, this->_extranonce2_size, out);
+}
+
+//target words are little endian, target[7] is the most significant one
+void stratum_difficulty_to_target(double difficulty, uint32_t target[8]){
+    //difficulty 1 target is 0xffff << 208
+    double rest = (difficulty > 0) ? ldexp(65535.0, 208) / difficulty : ldexp(1.0, 256);
+    for(int i = 7; i >= 0; i--){
+        double scale = ldexp(1.0, 32 * i);
+        double word  = floor(rest / scale);
+        if(word >= 4294967295.0){
+            if(i == 7){
+                for(int j = 0; j < 8; j++) target[j] = 0xffffffff;
+                return;
+            }
+            word = 4294967295.0;
+        }
+        target[i] = (uint32_t)word;
+        rest -= word * scale;
+        if(rest < 0) rest = 0;
+    }
+}
+
+//the hash is read as a little endian 256-bit number, as the block header hash is
+bool stratum_hash_meets_target(const uint8_t hash[32], const uint32_t target[8]){
+    for(int i = 7; i >= 0; i--){
+        const uint8_t *p = hash + 4 * i;
+        uint32_t word = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+        if(word != target[i]) return word < target[i];
+    }
+    return true;
+}
+
+static inline void put_le32(uint8_t *out, uint32_t val){
+    out[0] = val & 0xff;
+    out[1] = (val >> 8) & 0xff;
+    out[2] = (val >> 16) & 0xff;
+    out[3] = (val >> 24) & 0xff;
+}
+
+StratumShareValidator::~StratumShareValidator(){
+    this->clear();
+}
+
+void StratumShareValidator::add_job(const pool_job_data_t *job, double difficulty){
+    pool_job_data_t *copy = stratum_job_clone(job);
+    if(copy == NULL){
+        LOG_W("No memory to keep job [%s] for share checks", job->id());
+        return;
+    }
+    check_job_t *slot = &this->_jobs[this->_next];
+    if(slot->job != NULL && slot->job == this->_engine.job()){
+        this->_engine = StratumWorkEngine();
+        this->_mid_valid = false;
+    }
+    if(slot->job != NULL) stratum_job_free(slot->job);
+    slot->job        = copy;
+    slot->difficulty = difficulty;
+    this->_next = (this->_next + 1) % STRATUM_SHARE_CHECK_JOBS;
+}
+
+void StratumShareValidator::clear(){
+    for(auto &slot : this->_jobs){
+        if(slot.job != NULL) stratum_job_free(slot.job);
+        slot.job = NULL;
+    }
+    this->_engine    = StratumWorkEngine();
+    this->_mid_valid = false;
+}
+
+const pool_job_data_t *StratumShareValidator::find_job(const char *job_id){
+    const check_job_t *slot = this->_find(job_id);
+    return (slot != NULL) ? slot->job : NULL;
+}
+
+const StratumShareValidator::check_job_t *StratumShareValidator::_find(const char *job_id){
+    for(const auto &s : this->_jobs){
+        if(s.job != NULL && strcmp(s.job->id(), job_id) == 0) return &s;
+    }
+    return NULL;
+}
+
+stratum_share_verdict_t StratumShareValidator::check(const stratum_share_t *share, const String &extranonce1, uint8_t extranonce2_size, uint32_t version_mask, double difficulty){
+    const check_job_t *slot = this->_find(share->job_id);
+    if(slot == NULL) return STRATUM_SHARE_STALE;
+
+    uint8_t en2[STRATUM_EXTRANONCE2_MAX];
+    size_t  en2_len = strlen(share->extranonce2);
+    if(extranonce2_size == 0 || extranonce2_size > sizeof(en2) || en2_len != 2 * (size_t)extranonce2_size ||
+       !stratum_hex_decode({share->extranonce2, en2_len}, en2, extranonce2_size)){
+        return STRATUM_SHARE_MALFORMED;
+    }
+    uint64_t extranonce2 = 0;
+    for(uint8_t i = 0; i < extranonce2_size; i++) extranonce2 = (extranonce2 << 8) | en2[i];
+
+    const pool_job_data_t *job = slot->job;
+    if(this->_engine.job() != job || this->_engine.get_extranonce2_size() != extranonce2_size || this->_extranonce1 != extranonce1){
+        this->_mid_valid = false;
+        if(!this->_engine.begin(job, extranonce1, extranonce2_size)){
+            //without a usable extranonce1 only the pool can judge the share
+            return STRATUM_SHARE_VALID;
+        }
+        this->_extranonce1 = extranonce1;
+    }
+
+    //BIP310: the pool takes the masked bits from the share and the rest from the job
+    uint32_t version = (job->version & ~version_mask) | (share->version & version_mask);
+    if(!this->_mid_valid || this->_mid_extranonce2 != extranonce2 || this->_mid_version != version){
+        uint8_t head[64];
+        uint8_t root[32];
+        this->_engine.merkle_root(extranonce2, root);
+        put_le32(head, version);
+        //stratum sends prevhash with every 32-bit word byte swapped
+        for(int i = 0; i < 32; i++) head[4 + i] = job->prevhash[(i & ~3) + 3 - (i & 3)];
+        memcpy(head + 36, root, 28);
+        memcpy(this->_root_tail, root + 28, 4);
+        this->_midstate.Reset().Write(head, sizeof(head));
+        this->_mid_extranonce2 = extranonce2;
+        this->_mid_version     = version;
+        this->_mid_valid       = true;
+    }
+
+    uint8_t tail[16];
+    uint8_t first[CSHA256::OUTPUT_SIZE];
+    uint8_t hash[CSHA256::OUTPUT_SIZE];
+    memcpy(tail, this->_root_tail, 4);
+    put_le32(tail + 4, share->ntime);
+    put_le32(tail + 8, job->nbits);
+    put_le32(tail + 12, share->nonce);
+    CSHA256 ctx = this->_midstate;
+    ctx.Write(tail, sizeof(tail)).Finalize(first);
+    CSHA256().Write(first, sizeof(first)).Finalize(hash);
+
+    //a share mined right before a difficulty change is judged by the easier one
+    uint32_t target[8];
+    stratum_difficulty_to_target((slot->difficulty < difficulty) ? slot->difficulty : difficulty, target);
+    return stratum_hash_meets_target(hash, target) ? STRATUM_SHARE_VALID : STRATUM_SHARE_LOW_DIFFICULTY;
+}
+
+bool StratumVersionRoller::begin(const pool_job_data_t *job, const String &extranonce1, uint8_t extranonce2_size, uint32_t version_mask, uint64_t extranonce2_start){
+    if(!this->_engine.begin(job, extranonce1, extranonce2_size, extranonce2_start)) return false;
+    //0xffffffff means version rolling was never negotiated
+    this->_mask              = (version_mask == 0xffffffff) ? 0 : stratum_version_mask_cap(version_mask);
+    this->_base              = job->version & ~this->_mask;
+    this->_variants          = stratum_version_variants(this->_mask);
+    this->_index             = this->_variants;//no merkle root yet
+    this->_extranonce2_start = this->_engine.get_extranonce2();
+    this->_extranonce2_mask  = (extranonce2_size >= 8) ? UINT64_MAX : ((1ULL << (8 * extranonce2_size)) - 1);
+    this->_issued            = 0;
+    this->_roots             = 0;
+    return true;
+}
+
+size_t StratumVersionRoller::next(stratum_header_work_t *works, size_t count){
+    if(this->_engine.job() == NULL) return 0;
+    for(size_t i = 0; i < count; i++){
+        if(this->_index >= this->_variants){
+            this->_engine.next(&this->_work, 1);
+            this->_index = 0;
+            this->_roots++;
+        }
+        stratum_header_work_t *out = &works[i];
+        out->extranonce2  = this->_work.extranonce2;
+        out->version_bits = stratum_version_bits(this->_mask, this->_index++);
+        out->version      = this->_base | out->version_bits;
+        memcpy(out->merkle_root, this->_work.merkle_root, sizeof(out->merkle_root));
+        this->_issued++;
+    }
+    return count;
+}
+
+bool StratumVersionRoller::issued(uint64_t extranonce2, uint32_t version){
+    if(this->_engine.job() == NULL || (version & ~this->_mask) != this->_base) return false;
+    uint64_t root = (extranonce2 - this->_extranonce2_start) & this->_extranonce2_mask;
+    uint64_t slot = root * this->_variants + stratum_version_index(this->_mask, version & this->_mask);
+    return (root < this->_roots) && (slot < this->_issued);
+}
+
+//starts a new estimate window, the hashrate average and the suggestion are kept
+void StratumDiffController::restart(uint32_t now){
+    this->_work         = 0;
+    this->_shares       = 0;
+    this->_window_start = now;
+}
+
+//starts the suggestion from a difficulty known to fit, instead of ramping from the default
+void StratumDiffController::seed(double difficulty){
+    if(difficulty < STRATUM_DIFF_MIN || difficulty > STRATUM_DIFF_MAX) return;
+    this->_suggested = exp2(floor(log2(difficulty)));
+}
+
+void StratumDiffController::add_share(double difficulty){
+    if(difficulty <= 0) return;
+    this->_work += difficulty;
+    this->_shares++;
+}
+
+/**
+ * @brief Closes the window when it is due and moves the suggestion.
+ *
+ * A window without any accepted share is booked as one share at the pool
+ * difficulty, an upper bound that still pulls a too high difficulty down.
+ *
+ * @return true when the suggested difficulty changed and should be sent.
+ */
+bool StratumDiffController::update(uint32_t now, double pool_difficulty){
+    uint32_t elapsed = now - this->_window_start;
+    if(this->_window_start == 0){
+        this->restart(now);
+        return false;
+    }
+    if(elapsed == 0 || (this->_shares < STRATUM_DIFF_MIN_SHARES && elapsed < STRATUM_DIFF_WINDOW_MS)) return false;
+
+    double work = (this->_shares > 0) ? this->_work : pool_difficulty;
+    double rate = work * 4294967296.0 * 1000.0 / elapsed;
+    this->_hashrate = (this->_hashrate > 0) ? (this->_hashrate + rate) / 2 : rate;
+    this->restart(now);
+
+    if(this->_last_change != 0 && now - this->_last_change < STRATUM_DIFF_HOLD_MS) return false;
+    double ideal = this->_hashrate * this->_interval_ms / 1000.0 / 4294967296.0;
+    if(ideal >= this->_suggested / STRATUM_DIFF_HYSTERESIS && ideal <= this->_suggested * STRATUM_DIFF_HYSTERESIS) return false;
+
+    double next = exp2(floor(log2(ideal < STRATUM_DIFF_MIN ? STRATUM_DIFF_MIN : ideal)));
+    if(next > STRATUM_DIFF_MAX) next = STRATUM_DIFF_MAX;
+    if(next == this->_suggested) return false;
+    LOG_I("Hashrate %.2f GH/s, suggested difficulty %.0f => %.0f", this->_hashrate / 1e9, this->_suggested, next);
+    this->_suggested   = next;
+    this->_last_change = now ? now : 1;
+    return true;
+}
+
+StratumWorkRegistry::StratumWorkRegistry(){
+    for(auto &slot : this->_slots){
+        slot.seq.store(0, std::memory_order_relaxed);
+        slot.used = false;
+    }
+}
+
+//asic tx thread only
+void StratumWorkRegistry::put(uint8_t asic_job_id, const stratum_asic_work_t *work){
+    slot_t *slot = &this->_slots[asic_job_id & (STRATUM_ASIC_JOB_IDS - 1)];
+    uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+    slot->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->work = *work;
+    slot->used = true;
+    slot->seq.store(seq + 2, std::memory_order_release);
+}
+
+//any thread, generation is the current job generation of the session
+stratum_work_lookup_t StratumWorkRegistry::get(uint8_t asic_job_id, uint32_t generation, uint32_t now, stratum_asic_work_t *work){
+    const slot_t *slot = &this->_slots[asic_job_id & (STRATUM_ASIC_JOB_IDS - 1)];
+    bool used;
+    while(true){
+        uint32_t seq = slot->seq.load(std::memory_order_acquire);
+        if(seq & 1) continue;
+        used  = slot->used;
+        *work = slot->work;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(slot->seq.load(std::memory_order_relaxed) == seq) break;
+    }
+    if(!used)                                       return STRATUM_WORK_UNKNOWN;
+    if(work->generation != generation)              return STRATUM_WORK_STALE;
+    if(now - work->stamp > STRATUM_WORK_EXPIRE_MS)  return STRATUM_WORK_EXPIRED;
+    return STRATUM_WORK_LIVE;
+}
@@ -0,0 +1,218 @@
+#ifndef STRATUM_WORK_H_
+#define STRATUM_WORK_H_
+#include <Arduino.h>
+#include "csha256.h"
+#include "stratum.h"
+
+#define  STRATUM_EXTRANONCE1_MAX   (32)
+#define  STRATUM_EXTRANONCE2_MAX   (8)
+#define  STRATUM_VERSION_BITS_MAX  (16) //rolled version bits used at most, 2^16 headers per merkle root
+
+typedef struct {
+    uint64_t    extranonce2;
+    uint8_t     merkle_root[32];   //byte order as produced by the hash, ready for the block header
+} stratum_work_t;
+
+/**
+ * @brief Per job merkle root generator.
+ *
+ * begin() absorbs coinb1 || extranonce1 once and keeps the SHA-256 midstate,
+ * every work unit only hashes extranonce2 || coinb2 on top of a copy of it and
+ * folds the result through the merkle branch. extranonce2 is a binary counter,
+ * serialized big endian into the coinbase and the submit params.
+ */
+class StratumWorkEngine{
+private:
+    const pool_job_data_t  *_job;
+    CSHA256                 _prefix;
+    uint8_t                 _extranonce2_size;
+    uint64_t                _extranonce2;
+    uint64_t                _extranonce2_mask;
+public:
+    StratumWorkEngine():_job(NULL), _extranonce2_size(0), _extranonce2(0), _extranonce2_mask(0){};
+
+    bool     begin(const pool_job_data_t *job, const uint8_t *extranonce1, size_t extranonce1_len, uint8_t extranonce2_size, uint64_t extranonce2_start = 0);
+    bool     begin(const pool_job_data_t *job, const String &extranonce1, uint8_t extranonce2_size, uint64_t extranonce2_start = 0);
+    void     merkle_root(uint64_t extranonce2, uint8_t root[32]);
+    size_t   next(stratum_work_t *works, size_t count);
+    void     extranonce2_hex(uint64_t extranonce2, char *out);
+
+    const pool_job_data_t *job(){
+        return this->_job;
+    }
+    uint64_t get_extranonce2(){
+        return this->_extranonce2;
+    }
+    uint8_t  get_extranonce2_size(){
+        return this->_extranonce2_size;
+    }
+};
+
+//one header variant, the nonces of it are left to the asic
+typedef struct {
+    uint64_t    extranonce2;
+    uint32_t    version;            //full header version
+    uint32_t    version_bits;       //rolled bits, what mining.submit reports
+    uint8_t     merkle_root[32];
+} stratum_header_work_t;
+
+/**
+ * @brief Version rolling fan-out on top of StratumWorkEngine.
+ *
+ * Every merkle root is paired with all the versions the negotiated mask
+ * allows before extranonce2 moves on, so one coinbase hash and merkle fold
+ * serve 2^k headers. The variants are handed out in a fixed order, which is
+ * enough to tell afterwards whether a (extranonce2, version) pair reported by
+ * the asic was issued for this job.
+ */
+class StratumVersionRoller{
+private:
+    StratumWorkEngine   _engine;
+    uint32_t            _mask;      //rolled bits, capped to STRATUM_VERSION_BITS_MAX
+    uint32_t            _base;      //job version with the rolled bits cleared
+    uint32_t            _variants;
+    uint32_t            _index;     //next variant of the current merkle root
+    uint64_t            _extranonce2_start;
+    uint64_t            _extranonce2_mask;
+    stratum_work_t      _work;      //merkle root the variants are handed out for
+    uint64_t            _issued;    //variants handed out since begin()
+    uint32_t            _roots;     //merkle roots computed since begin()
+public:
+    StratumVersionRoller():_mask(0), _base(0), _variants(1), _index(0), _extranonce2_start(0), _extranonce2_mask(0), _issued(0), _roots(0){};
+
+    bool     begin(const pool_job_data_t *job, const String &extranonce1, uint8_t extranonce2_size, uint32_t version_mask, uint64_t extranonce2_start = 0);
+    size_t   next(stratum_header_work_t *works, size_t count);
+    bool     issued(uint64_t extranonce2, uint32_t version);
+    uint32_t version_bits(uint32_t version){
+        return (version ^ this->_base) & this->_mask;
+    }
+    uint32_t get_variants(){
+        return this->_variants;
+    }
+    uint64_t get_issued(){
+        return this->_issued;
+    }
+    uint32_t get_roots(){
+        return this->_roots;
+    }
+    StratumWorkEngine *engine(){
+        return &this->_engine;
+    }
+};
+
+#define  STRATUM_SHARE_CHECK_JOBS  (STRATUM_JOB_RING_SIZE)
+
+/**
+ * @brief Local share check, run by the stratum thread before submitting.
+ *
+ * Keeps its own copy of the recent jobs, since the ones in the job ring are
+ * handed over to the asic tx thread. The header is rebuilt as the pool will
+ * do it, the SHA-256 midstate of its first 64 bytes is cached per
+ * (job, extranonce2, version) so further nonces of the same work only hash
+ * the 16 byte tail.
+ */
+class StratumShareValidator{
+private:
+    struct check_job_t {
+        pool_job_data_t *job;
+        double           difficulty;//pool difficulty when the job arrived
+    };
+    check_job_t         _jobs[STRATUM_SHARE_CHECK_JOBS];
+    uint8_t             _next;
+    StratumWorkEngine   _engine;
+    String              _extranonce1;
+    CSHA256             _midstate;
+    uint8_t             _root_tail[4];
+    bool                _mid_valid;
+    uint64_t            _mid_extranonce2;
+    uint32_t            _mid_version;
+    const check_job_t  *_find(const char *job_id);
+public:
+    StratumShareValidator():_next(0), _mid_valid(false), _mid_extranonce2(0), _mid_version(0){
+        memset(this->_jobs, 0, sizeof(this->_jobs));
+    };
+    ~StratumShareValidator();
+
+    void                    add_job(const pool_job_data_t *job, double difficulty);
+    void                    clear();
+    const pool_job_data_t  *find_job(const char *job_id);
+    stratum_share_verdict_t check(const stratum_share_t *share, const String &extranonce1, uint8_t extranonce2_size, uint32_t version_mask, double difficulty);
+};
+
+/**
+ * @brief Picks the difficulty to suggest from the accepted share rate.
+ *
+ * Accepted shares add their difficulty to the work of the current window.
+ * A window closes after STRATUM_DIFF_MIN_SHARES shares or STRATUM_DIFF_WINDOW_MS,
+ * its hashrate goes into a moving average. The suggestion only moves, to a
+ * power of two, once the ideal difficulty for the target share interval
+ * is off by more than STRATUM_DIFF_HYSTERESIS and STRATUM_DIFF_HOLD_MS
+ * have passed since the last move.
+ */
+class StratumDiffController{
+private:
+    uint32_t    _interval_ms;
+    double      _suggested;
+    double      _hashrate;      //H/s, 0 until the first window closed
+    double      _work;          //sum of the accepted share difficulties in the window
+    uint32_t    _shares;
+    uint32_t    _window_start;
+    uint32_t    _last_change;
+public:
+    StratumDiffController():_interval_ms(STRATUM_SHARE_INTERVAL_MS), _suggested(DEFAULT_POOL_DIFFICULTY), _hashrate(0),
+                            _work(0), _shares(0), _window_start(0), _last_change(0){};
+
+    void    restart(uint32_t now);
+    void    seed(double difficulty);
+    void    add_share(double difficulty);
+    bool    update(uint32_t now, double pool_difficulty);
+    void    set_interval(uint32_t interval_ms){
+        this->_interval_ms = interval_ms ? interval_ms : STRATUM_SHARE_INTERVAL_MS;
+    }
+    uint32_t get_interval(){
+        return this->_interval_ms;
+    }
+    double  get_suggested(){
+        return this->_suggested;
+    }
+    double  get_hashrate(){
+        return this->_hashrate;
+    }
+    //hashrate that yields one share per interval at the suggested difficulty
+    double  get_nominal_hashrate(){
+        return this->_suggested * 4294967296.0 * 1000.0 / this->_interval_ms;
+    }
+};
+
+/**
+ * @brief Dispatched work, indexed by the asic job id.
+ *
+ * The asic tx thread writes a slot when it sends work under that id, the
+ * asic rx thread reads it back for every nonce. Each slot is a seqlock, the
+ * reader copies and retries while the writer is in the middle of it. A
+ * slot lives until its id comes round again.
+ */
+class StratumWorkRegistry{
+private:
+    struct slot_t {
+        std::atomic<uint32_t>   seq;    //odd while the slot is rewritten
+        bool                    used;
+        stratum_asic_work_t     work;
+    };
+    slot_t              _slots[STRATUM_ASIC_JOB_IDS];
+public:
+    StratumWorkRegistry();
+
+    void                    put(uint8_t asic_job_id, const stratum_asic_work_t *work);
+    stratum_work_lookup_t   get(uint8_t asic_job_id, uint32_t generation, uint32_t now, stratum_asic_work_t *work);
+};
+
+void     stratum_sha256d(const uint8_t *data, size_t len, uint8_t hash[32]);
+uint32_t stratum_version_mask_cap(uint32_t mask);
+uint32_t stratum_version_variants(uint32_t mask);
+uint32_t stratum_version_bits(uint32_t mask, uint32_t index);
+uint32_t stratum_version_index(uint32_t mask, uint32_t bits);
+void     stratum_difficulty_to_target(double difficulty, uint32_t target[8]);
+bool     stratum_hash_meets_target(const uint8_t hash[32], const uint32_t target[8]);
+
+#endif